@@ -0,0 +1,468 @@
+#include <stdlib.h>
+#include <string.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#include "allocator.h"
+#include "panic.h"
+
+/*
+ * Stats of the default allocator are shared by every thread,
+ * so all counters go through relaxed atomics.
+ */
+static inline void mem_add(uint64_t *counter, uint64_t n) {
+    __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+static inline void mem_sub(uint64_t *counter, uint64_t n) {
+    __atomic_fetch_sub(counter, n, __ATOMIC_RELAXED);
+}
+
+static void mem_addInUse(AllocatorStats *stats, uint64_t n) {
+    uint64_t inUse = __atomic_add_fetch(&stats->bytesInUse, n, __ATOMIC_RELAXED);
+    uint64_t peak = __atomic_load_n(&stats->peakBytesInUse, __ATOMIC_RELAXED);
+    while (inUse > peak && !__atomic_compare_exchange_n(&stats->peakBytesInUse, &peak, inUse, 1,
+                                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/* default: libc */
+
+static void *mem_libcMalloc(Allocator *allocator, size_t size) {
+    (void) allocator;
+    return malloc(size);
+}
+
+static void *mem_libcRealloc(Allocator *allocator, void *ptr, size_t oldSize, size_t size) {
+    (void) allocator, (void) oldSize;
+    return realloc(ptr, size);
+}
+
+static void mem_libcFree(Allocator *allocator, void *ptr, size_t size) {
+    (void) allocator, (void) size;
+    free(ptr);
+}
+
+static size_t mem_libcUsableSize(Allocator *allocator, void *ptr, size_t size) {
+    (void) allocator;
+#ifdef __GLIBC__
+    (void) size;
+    return malloc_usable_size(ptr);
+#else
+    (void) ptr;
+    return size;
+#endif
+}
+
+static Allocator mem_libc = {mem_libcMalloc, mem_libcRealloc, mem_libcFree, NULL, mem_libcUsableSize, {0}};
+
+static __thread Allocator *mem_current = NULL;
+
+Allocator *AllocatorDefault() {
+    return &mem_libc;
+}
+
+inline Allocator *AllocatorCurrent() {
+    return mem_current ? mem_current : &mem_libc;
+}
+
+Allocator *AllocatorUse(Allocator *allocator) {
+    Allocator *prev = AllocatorCurrent();
+    mem_current = allocator;
+    return prev;
+}
+
+AllocatorStats AllocatorGetStats(Allocator *allocator) {
+    AllocatorStats stats;
+    stats.allocs = __atomic_load_n(&allocator->stats.allocs, __ATOMIC_RELAXED);
+    stats.reallocs = __atomic_load_n(&allocator->stats.reallocs, __ATOMIC_RELAXED);
+    stats.frees = __atomic_load_n(&allocator->stats.frees, __ATOMIC_RELAXED);
+    stats.bytesInUse = __atomic_load_n(&allocator->stats.bytesInUse, __ATOMIC_RELAXED);
+    stats.peakBytesInUse = __atomic_load_n(&allocator->stats.peakBytesInUse, __ATOMIC_RELAXED);
+    stats.bytesReserved = __atomic_load_n(&allocator->stats.bytesReserved, __ATOMIC_RELAXED);
+    return stats;
+}
+
+void AllocatorFree(Allocator *allocator) {
+    if (allocator == NULL || allocator == &mem_libc) {
+        return;
+    }
+    if (mem_current == allocator) {
+        mem_current = NULL;
+    }
+    allocator->destroy(allocator);
+}
+
+void *mem_malloc(size_t size) {
+    Allocator *allocator = AllocatorCurrent();
+    void *ptr = allocator->malloc(allocator, size);
+    if (ptr) {
+        mem_add(&allocator->stats.allocs, 1);
+        mem_addInUse(&allocator->stats, size);
+    }
+    return ptr;
+}
+
+void *mem_calloc(size_t size) {
+    void *ptr = mem_malloc(size);
+    if (ptr) memset(ptr, 0, size);
+    return ptr;
+}
+
+void *mem_realloc(void *ptr, size_t oldSize, size_t size) {
+    if (ptr == NULL) {
+        return mem_malloc(size);
+    }
+    Allocator *allocator = AllocatorCurrent();
+    void *moved = allocator->realloc(allocator, ptr, oldSize, size);
+    if (moved) {
+        mem_add(&allocator->stats.reallocs, 1);
+        if (size > oldSize) {
+            mem_addInUse(&allocator->stats, size - oldSize);
+        } else {
+            mem_sub(&allocator->stats.bytesInUse, oldSize - size);
+        }
+    }
+    return moved;
+}
+
+void mem_free(void *ptr, size_t size) {
+    if (ptr == NULL) {
+        return;
+    }
+    Allocator *allocator = AllocatorCurrent();
+    allocator->free(allocator, ptr, size);
+    mem_add(&allocator->stats.frees, 1);
+    mem_sub(&allocator->stats.bytesInUse, size);
+}
+
+size_t mem_usableSize(void *ptr, size_t size) {
+    Allocator *allocator = AllocatorCurrent();
+    return allocator->usableSize ? allocator->usableSize(allocator, ptr, size) : size;
+}
+
+/* arena */
+
+#define ARENA_ALIGN 16
+
+typedef struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t size;
+    size_t used;
+    char data[] __attribute__((aligned(ARENA_ALIGN)));
+} ArenaBlock;
+
+typedef struct {
+    Allocator base;
+    size_t blockSize;
+    ArenaBlock *blocks; //latest first, only the latest is bumped
+    char *last; //latest allocation, it can grow and be freed in place
+} Arena;
+
+static inline size_t arena_align(size_t size) {
+    return (size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+}
+
+static ArenaBlock *arena_newBlock(Arena *arena, size_t need) {
+    size_t size = need > arena->blockSize ? need : arena->blockSize;
+    ArenaBlock *block;
+    if ((block = malloc(sizeof(ArenaBlock) + size)) == NULL) {
+        return NULL;
+    }
+    block->size = size;
+    block->used = 0;
+    block->next = arena->blocks;
+    arena->blocks = block;
+    mem_add(&arena->base.stats.bytesReserved, sizeof(ArenaBlock) + size);
+    return block;
+}
+
+static void *arena_malloc(Allocator *allocator, size_t size) {
+    Arena *arena = (Arena *) allocator;
+    ArenaBlock *block = arena->blocks;
+    size = arena_align(size);
+    if (block == NULL || block->size - block->used < size) {
+        if ((block = arena_newBlock(arena, size)) == NULL) {
+            return NULL;
+        }
+    }
+    arena->last = block->data + block->used;
+    block->used += size;
+    return arena->last;
+}
+
+static void *arena_realloc(Allocator *allocator, void *ptr, size_t oldSize, size_t size) {
+    Arena *arena = (Arena *) allocator;
+    ArenaBlock *block = arena->blocks;
+    //the latest allocation resizes in place while its block has room
+    if (ptr == arena->last) {
+        size_t start = (size_t) (arena->last - block->data);
+        if (block->size - start >= arena_align(size)) {
+            block->used = start + arena_align(size);
+            return ptr;
+        }
+    }
+    void *moved = arena_malloc(allocator, size);
+    if (moved) {
+        memcpy(moved, ptr, oldSize < size ? oldSize : size);
+    }
+    return moved;
+}
+
+static void arena_free(Allocator *allocator, void *ptr, size_t size) {
+    Arena *arena = (Arena *) allocator;
+    (void) size;
+    if (ptr == arena->last) {
+        arena->blocks->used = (size_t) (arena->last - arena->blocks->data);
+        arena->last = NULL;
+    }
+}
+
+static size_t arena_usableSize(Allocator *allocator, void *ptr, size_t size) {
+    (void) allocator, (void) ptr;
+    return arena_align(size);
+}
+
+static void arena_releaseAfter(Arena *arena, ArenaBlock *keep) {
+    ArenaBlock *block = keep ? keep->next : arena->blocks;
+    while (block) {
+        ArenaBlock *next = block->next;
+        mem_sub(&arena->base.stats.bytesReserved, sizeof(ArenaBlock) + block->size);
+        free(block);
+        block = next;
+    }
+    if (keep) {
+        keep->next = NULL;
+        keep->used = 0;
+    } else {
+        arena->blocks = NULL;
+    }
+    arena->last = NULL;
+}
+
+static void arena_destroy(Allocator *allocator) {
+    arena_releaseAfter((Arena *) allocator, NULL);
+    free(allocator);
+}
+
+Allocator *AllocatorArenaNew(size_t blockSize) {
+    Arena *arena;
+    if ((arena = calloc(1, sizeof(*arena))) == NULL) {
+        panic("Allocator arena malloc failed\n");
+    }
+    arena->base.malloc = arena_malloc;
+    arena->base.realloc = arena_realloc;
+    arena->base.free = arena_free;
+    arena->base.destroy = arena_destroy;
+    arena->base.usableSize = arena_usableSize;
+    arena->blockSize = blockSize > 0 ? blockSize : ALLOCATOR_ARENA_DEFAULT_BLOCK;
+    return (Allocator *) arena;
+}
+
+void AllocatorArenaReset(Allocator *allocator) {
+    if (allocator->destroy != arena_destroy) {
+        panic("Allocator reset: not an arena\n");
+    }
+    Arena *arena = (Arena *) allocator;
+    arena_releaseAfter(arena, arena->blocks);
+    //everything handed out is gone, so is what was in use
+    __atomic_store_n(&allocator->stats.bytesInUse, 0, __ATOMIC_RELAXED);
+}
+
+/* pool */
+
+#define POOL_CLASSES 25
+#define POOL_MAX_BYTES (16 << 12) //size of the last class
+#define POOL_SLAB_BYTES (256 * 1024)
+
+typedef struct PoolSlab {
+    struct PoolSlab *next;
+    char data[] __attribute__((aligned(ARENA_ALIGN)));
+} PoolSlab;
+
+typedef struct {
+    Allocator base;
+    void *freeLists[POOL_CLASSES]; //each free block holds the next one
+    PoolSlab *slabs;
+    char *carve; //unused rest of the latest slab
+    size_t carveLeft;
+} Pool;
+
+/*
+ * Classes alternate between 16 << k and 24 << k, so a block is
+ * never more than a third larger than asked for.
+ */
+static inline uint32_t pool_classOf(size_t size) {
+    if (size <= 16) {
+        return 0;
+    }
+    uint32_t lg = 64 - (uint32_t) __builtin_clzll(size - 1); //size <= 1 << lg
+    return size <= (size_t) 3 << (lg - 2) ? 2 * (lg - 5) + 1 : 2 * (lg - 4);
+}
+
+static inline size_t pool_classBytes(uint32_t cls) {
+    return (size_t) (cls % 2 ? 24 : 16) << (cls / 2);
+}
+
+static void *pool_malloc(Allocator *allocator, size_t size) {
+    Pool *pool = (Pool *) allocator;
+    if (size > POOL_MAX_BYTES) {
+        void *ptr = malloc(size);
+        if (ptr) mem_add(&allocator->stats.bytesReserved, size);
+        return ptr;
+    }
+    uint32_t cls = pool_classOf(size);
+    void *ptr = pool->freeLists[cls];
+    if (ptr) {
+        memcpy(&pool->freeLists[cls], ptr, sizeof(void *));
+        return ptr;
+    }
+
+    size_t bytes = pool_classBytes(cls);
+    if (pool->carveLeft < bytes) {
+        PoolSlab *slab;
+        if ((slab = malloc(sizeof(PoolSlab) + POOL_SLAB_BYTES)) == NULL) {
+            return NULL;
+        }
+        slab->next = pool->slabs;
+        pool->slabs = slab;
+        pool->carve = slab->data;
+        pool->carveLeft = POOL_SLAB_BYTES;
+        mem_add(&allocator->stats.bytesReserved, sizeof(PoolSlab) + POOL_SLAB_BYTES);
+    }
+    ptr = pool->carve;
+    pool->carve += bytes;
+    pool->carveLeft -= bytes;
+    return ptr;
+}
+
+static void pool_free(Allocator *allocator, void *ptr, size_t size) {
+    Pool *pool = (Pool *) allocator;
+    if (size > POOL_MAX_BYTES) {
+        free(ptr);
+        mem_sub(&allocator->stats.bytesReserved, size);
+        return;
+    }
+    uint32_t cls = pool_classOf(size);
+    memcpy(ptr, &pool->freeLists[cls], sizeof(void *));
+    pool->freeLists[cls] = ptr;
+}
+
+static void *pool_realloc(Allocator *allocator, void *ptr, size_t oldSize, size_t size) {
+    if (oldSize > POOL_MAX_BYTES && size > POOL_MAX_BYTES) {
+        void *moved = realloc(ptr, size);
+        if (moved) {
+            mem_sub(&allocator->stats.bytesReserved, oldSize);
+            mem_add(&allocator->stats.bytesReserved, size);
+        }
+        return moved;
+    }
+    if (oldSize <= POOL_MAX_BYTES && size <= POOL_MAX_BYTES && pool_classOf(oldSize) == pool_classOf(size)) {
+        return ptr;
+    }
+    void *moved = pool_malloc(allocator, size);
+    if (moved) {
+        memcpy(moved, ptr, oldSize < size ? oldSize : size);
+        pool_free(allocator, ptr, oldSize);
+    }
+    return moved;
+}
+
+static size_t pool_usableSize(Allocator *allocator, void *ptr, size_t size) {
+    if (size > POOL_MAX_BYTES) {
+        return mem_libcUsableSize(allocator, ptr, size);
+    }
+    return pool_classBytes(pool_classOf(size));
+}
+
+/*
+ * Blocks above POOL_MAX_BYTES still in use are not tracked,
+ * they must be freed before the pool.
+ */
+static void pool_destroy(Allocator *allocator) {
+    Pool *pool = (Pool *) allocator;
+    PoolSlab *slab = pool->slabs;
+    while (slab) {
+        PoolSlab *next = slab->next;
+        free(slab);
+        slab = next;
+    }
+    free(pool);
+}
+
+Allocator *AllocatorPoolNew() {
+    Pool *pool;
+    if ((pool = calloc(1, sizeof(*pool))) == NULL) {
+        panic("Allocator pool malloc failed\n");
+    }
+    pool->base.malloc = pool_malloc;
+    pool->base.realloc = pool_realloc;
+    pool->base.free = pool_free;
+    pool->base.destroy = pool_destroy;
+    pool->base.usableSize = pool_usableSize;
+    return (Allocator *) pool;
+}
+
+//#define ALLOCATOR_TEST
+#ifdef ALLOCATOR_TEST
+
+#include <assert.h>
+
+int main() {
+    //classes cover every size with at most a third wasted
+    for (size_t size = 1; size <= POOL_MAX_BYTES; size++) {
+        uint32_t cls = pool_classOf(size);
+        assert(cls < POOL_CLASSES && pool_classBytes(cls) >= size);
+        assert(cls == 0 || pool_classBytes(cls - 1) < size);
+    }
+
+    Allocator *allocators[] = {AllocatorDefault(), AllocatorArenaNew(4096), AllocatorPoolNew()};
+    for (int a = 0; a < 3; a++) {
+        Allocator *prev = AllocatorUse(allocators[a]);
+        assert(prev == AllocatorDefault() && AllocatorCurrent() == allocators[a]);
+
+        char *blocks[200];
+        size_t sizes[200];
+        for (int i = 0; i < 200; i++) {
+            sizes[i] = (size_t) (i * 37 % 300 + 1) * (i % 50 == 0 ? 400 : 1);
+            blocks[i] = mem_malloc(sizes[i]);
+            memset(blocks[i], i, sizes[i]);
+        }
+        for (int i = 0; i < 200; i++) {
+            size_t size = sizes[i] * 2 + 3;
+            blocks[i] = mem_realloc(blocks[i], sizes[i], size);
+            for (size_t b = 0; b < sizes[i]; b++) assert(blocks[i][b] == (char) i);
+            memset(blocks[i], i, size);
+            sizes[i] = size;
+        }
+        AllocatorStats stats = AllocatorGetStats(allocators[a]);
+        assert(stats.allocs == 200 && stats.reallocs == 200 && stats.peakBytesInUse >= stats.bytesInUse);
+        for (int i = 0; i < 200; i++) {
+            for (size_t b = 0; b < sizes[i]; b++) assert(blocks[i][b] == (char) i);
+            assert(mem_usableSize(blocks[i], sizes[i]) >= sizes[i]);
+            mem_free(blocks[i], sizes[i]);
+        }
+        stats = AllocatorGetStats(allocators[a]);
+        assert(stats.frees == 200 && stats.bytesInUse == 0);
+
+        AllocatorUse(prev);
+        assert(AllocatorCurrent() == AllocatorDefault());
+    }
+
+    //freed pool blocks are reused, the latest arena block grows in place
+    AllocatorUse(allocators[2]);
+    void *p = mem_malloc(100);
+    mem_free(p, 100);
+    assert(mem_malloc(97) == p);
+    assert(mem_realloc(p, 97, 128) == p);
+    AllocatorUse(allocators[1]);
+    p = mem_malloc(10);
+    assert(mem_realloc(p, 10, 1000) == p);
+    AllocatorArenaReset(allocators[1]);
+    assert(AllocatorGetStats(allocators[1]).bytesReserved <= sizeof(ArenaBlock) + 4096 * 2);
+    AllocatorUse(NULL);
+
+    AllocatorFree(allocators[1]);
+    AllocatorFree(allocators[2]);
+    return 0;
+}
+#endif
@@ -0,0 +1,93 @@
+#ifndef ALLOCATOR_H
+#define ALLOCATOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Memory hooks behind every structure.
+ *
+ * Structures allocate through the current allocator of the calling
+ * thread, which is AllocatorDefault() (libc) until AllocatorUse()
+ * picks another one. A structure must be grown and freed under the
+ * allocator it was created with. Callers pass block sizes back when
+ * reallocating and freeing, so backends keep no per-block headers.
+ *
+ * Backends:
+ * arena: bump allocation out of large blocks. Free only takes back
+ *        the latest block, everything else goes at once through
+ *        AllocatorArenaReset or AllocatorFree. Meant for structures
+ *        that live as long as a request.
+ * pool: free lists of size classes 16, 24, 32, 48, ... up to 64KB,
+ *       carved from slabs, larger blocks go to malloc. Meant for
+ *       long lived structures, a realloc within the class keeps the
+ *       block.
+ *
+ * Arena and pool are not thread safe, give each thread its own.
+ * Temporary buffers freed before a call returns stay on malloc.
+ */
+typedef struct {
+    uint64_t allocs;
+    uint64_t reallocs;
+    uint64_t frees;
+    uint64_t bytesInUse; //bytes asked for and not freed yet
+    uint64_t peakBytesInUse;
+    uint64_t bytesReserved; //bytes taken from malloc
+} AllocatorStats;
+
+typedef struct Allocator Allocator;
+
+/**
+ * A backend fills in the hooks and embeds this struct first.
+ * Statistics are kept by the callers of the hooks, except
+ * bytesReserved which the backend updates.
+ */
+struct Allocator {
+    void *(*malloc)(Allocator *allocator, size_t size);
+    void *(*realloc)(Allocator *allocator, void *ptr, size_t oldSize, size_t size);
+    void (*free)(Allocator *allocator, void *ptr, size_t size);
+    void (*destroy)(Allocator *allocator);
+    //bytes a block of size really occupies, NULL means size
+    size_t (*usableSize)(Allocator *allocator, void *ptr, size_t size);
+    AllocatorStats stats;
+};
+
+#define ALLOCATOR_ARENA_DEFAULT_BLOCK (64 * 1024)
+
+Allocator *AllocatorDefault();
+Allocator *AllocatorArenaNew(size_t blockSize);
+Allocator *AllocatorPoolNew();
+
+/**
+ * Release everything allocated from an arena, keeping its latest
+ * block for reuse.
+ */
+void AllocatorArenaReset(Allocator *allocator);
+
+/**
+ * Destroy an allocator with all memory it handed out.
+ * The default allocator is never destroyed.
+ */
+void AllocatorFree(Allocator *allocator);
+
+Allocator *AllocatorCurrent();
+
+/**
+ * Make allocator current for the calling thread, NULL means the
+ * default one. Return the previous allocator to restore it later.
+ */
+Allocator *AllocatorUse(Allocator *allocator);
+
+AllocatorStats AllocatorGetStats(Allocator *allocator);
+
+/*
+ * Used by the structures, through the current allocator.
+ * Like malloc and friends, they return NULL on failure.
+ */
+void *mem_malloc(size_t size);
+void *mem_calloc(size_t size);
+void *mem_realloc(void *ptr, size_t oldSize, size_t size);
+void mem_free(void *ptr, size_t size);
+size_t mem_usableSize(void *ptr, size_t size);
+
+#endif //ALLOCATOR_H
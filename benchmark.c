@@ -0,0 +1,535 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "integer.h"
+#include "int_vector.h"
+#include "int_set.h"
+#include "compact_list.h"
+#include "quick_list.h"
+#include "allocator.h"
+#include "panic.h"
+#include "stats.h"
+
+/*
+ * Microbenchmarks of the public APIs.
+ *
+ * ds_bench [--quick] [--json path]
+ *
+ * Every row is one operation on one structure of a given size and
+ * value mix: ns per operation, and bytes per element of the
+ * structure once built (allocator bytes in use, headers included).
+ * --json writes the rows to path, - for stdout, so runs of two
+ * releases can be diffed. --quick uses smaller sizes. A DS_STATS
+ * build adds the totals of the stats counters to the JSON.
+ *
+ * The integer rows time the text codec on numbers of a digit range,
+ * next to the loops it replaced and snprintf.
+ *
+ * QuickList+z rows keep idle nodes compressed, next to the same
+ * list kept expanded: bytes saved against the cost of reads that
+ * expand a node first.
+ */
+
+#define BENCH_MAX_RESULTS 512
+#define BENCH_OPS 1000 //operations of the O(n) kinds per row
+#define BENCH_PROBES 100000
+
+typedef struct {
+    const char *structure;
+    const char *op;
+    const char *mix;
+    uint32_t size;
+    uint64_t ops;
+    double nsPerOp;
+    double bytesPerElement;
+} bench_result;
+
+static bench_result bench_results[BENCH_MAX_RESULTS];
+static int bench_count;
+static int bench_quiet; //json goes to stdout, no table
+static volatile uint64_t bench_sink; //keeps results alive, unsigned so sums wrap
+
+static uint64_t bench_rngState = 0x9E3779B97F4A7C15ULL;
+
+static uint64_t bench_rand() {
+    uint64_t x = bench_rngState;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    bench_rngState = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+static double bench_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static uint64_t bench_bytesInUse() {
+    return AllocatorGetStats(AllocatorDefault()).bytesInUse;
+}
+
+static void bench_record(const char *structure, const char *op, const char *mix, uint32_t size,
+                         uint64_t ops, double ns, double bytesPerElement) {
+    if (bench_count == BENCH_MAX_RESULTS) {
+        panic("benchmark: too many results\n");
+    }
+    bench_result *r = &bench_results[bench_count++];
+    r->structure = structure;
+    r->op = op;
+    r->mix = mix;
+    r->size = size;
+    r->ops = ops;
+    r->nsPerOp = ops ? ns / ops : 0;
+    r->bytesPerElement = bytesPerElement;
+    if (!bench_quiet) {
+        printf("%-12s %-16s %-6s %9u %10.1f ns/op %8.2f B/elem\n",
+               structure, op, mix, size, r->nsPerOp, bytesPerElement);
+    }
+}
+
+static void bench_writeJson(FILE *fp, int quick) {
+    fprintf(fp, "{\n  \"version\": 1,\n  \"quick\": %s,\n  \"results\": [\n", quick ? "true" : "false");
+    for (int i = 0; i < bench_count; i++) {
+        bench_result *r = &bench_results[i];
+        fprintf(fp, "    {\"structure\": \"%s\", \"op\": \"%s\", \"mix\": \"%s\", \"size\": %u, "
+                    "\"ops\": %lu, \"ns_per_op\": %.2f, \"bytes_per_element\": %.3f}%s\n",
+                r->structure, r->op, r->mix, r->size, (unsigned long) r->ops, r->nsPerOp,
+                r->bytesPerElement, i + 1 < bench_count ? "," : "");
+    }
+    fprintf(fp, "  ]");
+    if (StatsEnabled()) {
+        StatsSnapshot snapshot;
+        StatsGet(&snapshot);
+        fprintf(fp, ",\n  \"stats\": {");
+        for (int i = 0; i < STATS_COUNTERS; i++) {
+            fprintf(fp, "%s\"%s\": %lu", i ? ", " : "", StatsCounterName(i),
+                    (unsigned long) snapshot.counters[i]);
+        }
+        fprintf(fp, "}");
+    }
+    fprintf(fp, "\n}\n");
+}
+
+/*
+ * Integer mixes, named after the encoding their values need, and
+ * ids, a narrow range far from zero that packs into 17 bits.
+ */
+typedef struct {
+    const char *name;
+    int64_t range; //values in [-range, range), 0 for any 64 bit value
+    int64_t offset; //added to every value
+} bench_intMix;
+
+static const bench_intMix bench_intMixes[] = {
+        {"int8",  100,        0},
+        {"int16", 30000,      0},
+        {"int32", 2000000000, 0},
+        {"int64", 0,          0},
+        {"ids",   50000,      3000000000},
+};
+
+#define BENCH_IDS_MIX 4
+
+static int64_t bench_intValue(const bench_intMix *mix) {
+    uint64_t r = bench_rand();
+    return mix->range ? (int64_t) (r % (uint64_t) (2 * mix->range)) - mix->range + mix->offset : (int64_t) r;
+}
+
+static IntVector *bench_newVector(uint8_t mode, int packed) {
+    IntVector *vector = IntVectorNewWithMode(mode);
+    return packed ? IntVectorPack(vector) : vector;
+}
+
+static void bench_intVector(uint32_t size, const bench_intMix *mix, int packed) {
+    const char *structure = packed ? "IntVector+packed" : "IntVector";
+    int64_t *vals = malloc(size * sizeof(int64_t));
+    for (uint32_t i = 0; i < size; i++) {
+        vals[i] = bench_intValue(mix);
+    }
+
+    uint64_t before = bench_bytesInUse();
+    double t = bench_now();
+    IntVector *vector = bench_newVector(INT_VECTOR_COMPACT, packed);
+    for (uint32_t i = 0; i < size; i++) {
+        vector = IntVectorAppend(vector, vals[i]);
+    }
+    t = bench_now() - t;
+    double bytes = (double) (bench_bytesInUse() - before) / size;
+    bench_record(structure, "append", mix->name, size, size, t, bytes);
+
+    IntVector *growable = bench_newVector(INT_VECTOR_GROWABLE, packed);
+    before = bench_bytesInUse();
+    t = bench_now();
+    for (uint32_t i = 0; i < size; i++) {
+        growable = IntVectorAppend(growable, vals[i]);
+    }
+    t = bench_now() - t;
+    bench_record(structure, "append_growable", mix->name, size, size, t,
+                 (double) (bench_bytesInUse() - before) / size);
+    IntVectorFree(growable);
+
+    t = bench_now();
+    for (int i = 0; i < BENCH_OPS; i++) {
+        bench_sink += (uint64_t) IntVectorIndexOf(vector, vals[bench_rand() % size]);
+    }
+    bench_record(structure, "search", mix->name, size, BENCH_OPS, bench_now() - t, bytes);
+
+    t = bench_now();
+    for (int i = 0; i < BENCH_OPS; i++) {
+        vector = IntVectorInsert(vector, vals[i % size], (int64_t) (bench_rand() % IntVectorSize(vector)));
+    }
+    bench_record(structure, "insert", mix->name, size, BENCH_OPS, bench_now() - t, bytes);
+
+    t = bench_now();
+    for (int i = 0; i < BENCH_OPS; i++) {
+        vector = IntVectorRemoveAt(vector, (int64_t) (bench_rand() % IntVectorSize(vector)));
+    }
+    bench_record(structure, "remove", mix->name, size, BENCH_OPS, bench_now() - t, bytes);
+
+    t = bench_now();
+    IntVectorIterator *iter = IntVectorIteratorNew(vector);
+    while (IntVectorIteratorHasNext(iter)) {
+        bench_sink += (uint64_t) IntVectorIteratorNext(iter);
+    }
+    IntVectorIteratorFree(iter);
+    bench_record(structure, "iterate", mix->name, size, IntVectorSize(vector), bench_now() - t, bytes);
+
+    IntVectorFree(vector);
+    free(vals);
+}
+
+static void bench_intSet(uint32_t size, const bench_intMix *mix, int packed) {
+    const char *structure = packed ? "IntSet+packed" : "IntSet";
+    int64_t *vals = malloc(size * sizeof(int64_t));
+    for (uint32_t i = 0; i < size; i++) {
+        vals[i] = bench_intValue(mix);
+    }
+
+    uint64_t before = bench_bytesInUse();
+    double t = bench_now();
+    IntSet *set = IntSetPutMany(bench_newVector(INT_VECTOR_COMPACT, packed), vals, size, NULL);
+    t = bench_now() - t;
+    //small mixes hold fewer distinct values than size
+    uint32_t distinct = IntSetSize(set);
+    double bytes = (double) (bench_bytesInUse() - before) / distinct;
+    bench_record(structure, "put_many", mix->name, distinct, size, t, bytes);
+
+    t = bench_now();
+    for (uint32_t i = 0; i < BENCH_PROBES; i++) {
+        bench_sink += (uint64_t) IntSetContains(set, i % 2 ? vals[bench_rand() % size] : bench_intValue(mix));
+    }
+    bench_record(structure, "contains", mix->name, distinct, BENCH_PROBES, bench_now() - t, bytes);
+
+    int ret;
+    t = bench_now();
+    for (int i = 0; i < BENCH_OPS; i++) {
+        set = IntSetPut(set, bench_intValue(mix), &ret);
+    }
+    bench_record(structure, "put", mix->name, distinct, BENCH_OPS, bench_now() - t, bytes);
+
+    t = bench_now();
+    for (int i = 0; i < BENCH_OPS; i++) {
+        set = IntSetRemove(set, vals[bench_rand() % size], &ret);
+    }
+    bench_record(structure, "remove", mix->name, distinct, BENCH_OPS, bench_now() - t, bytes);
+
+    t = bench_now();
+    IntSetIterator *iter = IntSetIteratorNew(set);
+    while (IntSetIteratorHasNext(iter)) {
+        bench_sink += (uint64_t) IntSetIteratorNext(iter);
+    }
+    IntSetIteratorFree(iter);
+    bench_record(structure, "iterate", mix->name, distinct, IntSetSize(set), bench_now() - t, bytes);
+
+    IntSetFree(set);
+    free(vals);
+}
+
+/*
+ * CompactList mixes: small integers, 16 byte strings, or both
+ * alternating, then counters and millisecond timestamps, the lists
+ * int runs pack, and keys of a small vocabulary, text that
+ * compresses.
+ */
+#define BENCH_STR_LEN 16
+
+static const char *bench_listMixes[] = {"int", "str", "mixed", "counter", "time", "key"};
+
+static size_t bench_listValue(int mix, uint32_t i, char *buf) {
+    if (mix == 3) {
+        return (size_t) sprintf(buf, "%lu", 1000000UL + i);
+    } else if (mix == 4) {
+        return (size_t) sprintf(buf, "%lu", 1700000000000UL + i * 1000UL + bench_rand() % 1000);
+    } else if (mix == 5) {
+        static const char *fields[] = {"name", "mail", "seen", "cart"};
+        return (size_t) sprintf(buf, "user:%lu:%s", (unsigned long) (bench_rand() % 5000), fields[i % 4]);
+    }
+    if (mix == 0 || (mix == 2 && i % 2 == 0)) {
+        return (size_t) sprintf(buf, "%lu", (unsigned long) (bench_rand() % 1000000));
+    }
+    for (int k = 0; k < BENCH_STR_LEN; k++) {
+        buf[k] = (char) ('a' + bench_rand() % 26);
+    }
+    return BENCH_STR_LEN;
+}
+
+static void bench_compactList(uint32_t size, int mix, uint32_t ops) {
+    const char *name = bench_listMixes[mix];
+    char buf[32];
+    char (*keys)[32] = malloc(ops * sizeof(*keys));
+    size_t *keyLens = malloc(ops * sizeof(size_t));
+
+    uint64_t before = bench_bytesInUse();
+    double t = bench_now();
+    CompactList *list = CompactListNew();
+    for (uint32_t i = 0; i < size; i++) {
+        size_t len = bench_listValue(mix, i, buf);
+        //keep some values to search for later, spread over the list
+        if (i % (size / ops + 1) == 0 && i / (size / ops + 1) < ops) {
+            memcpy(keys[i / (size / ops + 1)], buf, len);
+            keyLens[i / (size / ops + 1)] = len;
+        }
+        list = CompactListInsert(list, buf, len, (int64_t) i);
+    }
+    t = bench_now() - t;
+    double bytes = (double) (bench_bytesInUse() - before) / size;
+    bench_record("CompactList", "append", name, size, size, t, bytes);
+
+    uint32_t nkeys = size < ops ? size : ops;
+    t = bench_now();
+    for (uint32_t i = 0; i < ops; i++) {
+        bench_sink += (uint64_t) CompactListIndexOf(list, keys[i % nkeys], keyLens[i % nkeys]);
+    }
+    bench_record("CompactList", "search", name, size, ops, bench_now() - t, bytes);
+
+    t = bench_now();
+    for (uint32_t i = 0; i < ops; i++) {
+        size_t len = bench_listValue(mix, i, buf);
+        list = CompactListInsert(list, buf, len, (int64_t) (bench_rand() % CompactListSize(list)));
+    }
+    bench_record("CompactList", "insert", name, size, ops, bench_now() - t, bytes);
+
+    t = bench_now();
+    for (uint32_t i = 0; i < ops; i++) {
+        list = CompactListRemoveAt(list, (int64_t) (bench_rand() % CompactListSize(list)));
+    }
+    bench_record("CompactList", "remove", name, size, ops, bench_now() - t, bytes);
+
+    CompactListCursor cursor;
+    CompactListValue value;
+    t = bench_now();
+    CompactListCursorInit(&cursor, list, CL_CURSOR_FORWARD);
+    while (CompactListCursorNext(&cursor, &value)) {
+        bench_sink += (uint64_t) value.intVal + (uint64_t) value.len;
+    }
+    bench_record("CompactList", "iterate", name, size, (uint64_t) CompactListSize(list), bench_now() - t, bytes);
+
+    CompactListFree(list);
+    free(keys);
+    free(keyLens);
+}
+
+//nodes idle for this many calls are compressed
+#define BENCH_COLD_IDLE 1000
+
+static void bench_quickList(uint32_t size, int mix, uint32_t ops, int compress) {
+    const char *name = bench_listMixes[mix];
+    const char *structure = compress ? "QuickList+z" : "QuickList";
+    char buf[32];
+
+    uint64_t before = bench_bytesInUse();
+    double t = bench_now();
+    QuickList *ql = QuickListNew();
+    if (compress) {
+        QuickListSetCompress(ql, QUICK_LIST_DEFAULT_BYTES / 8, BENCH_COLD_IDLE, 2);
+    }
+    for (uint32_t i = 0; i < size; i++) {
+        size_t len = bench_listValue(mix, i, buf);
+        ql = QuickListPushTail(ql, buf, len);
+    }
+    if (compress) {
+        QuickListCompressIdle(ql);
+    }
+    t = bench_now() - t;
+    double bytes = (double) (bench_bytesInUse() - before) / size;
+    bench_record(structure, "append", name, size, size, t, bytes);
+
+    t = bench_now();
+    for (uint32_t i = 0; i < ops; i++) {
+        int64_t intVal = 0;
+        char *strVal;
+        bench_sink += (uint64_t) QuickListValueAt(ql, (int64_t) (bench_rand() % size), &intVal, &strVal) + (uint64_t) intVal;
+    }
+    bench_record(structure, "read", name, size, ops, bench_now() - t, bytes);
+
+    QuickListFree(ql);
+}
+
+/*
+ * The integer codec, by digits of the values.
+ */
+typedef struct {
+    const char *name;
+    int minDigits;
+    int maxDigits;
+} bench_digitMix;
+
+static const bench_digitMix bench_digitMixes[] = {
+        {"1-4",   1,  4},
+        {"5-9",   5,  9},
+        {"10-19", 10, 19},
+};
+
+//string2int and countDigit as they were before the SWAR parser
+static int bench_legacyString2int(char *str, uint64_t len, int64_t *ret) {
+    if (len >= UINT8_MAX) {
+        return 0;
+    }
+    uint64_t result = 0, weight = 1; //unsigned, the weight passes INT64_MAX on 20 digits
+    for (int64_t i = len - 1; i >= 0; i--) {
+        char c = str[i];
+        if (isdigit(c)) {
+            result += weight * (c - '0');
+            weight *= 10;
+        } else if (c == '-' && i == 0) {
+            result = -result;
+        } else {
+            return 0;
+        }
+    }
+    if (ret) *ret = (int64_t) result;
+    return 1;
+}
+
+static uint8_t bench_legacyCountDigit(int64_t val) {
+    uint8_t ret = 0;
+    while (val != 0) {
+        ret++;
+        val /= 10;
+    }
+    return ret;
+}
+
+static void bench_integer(uint32_t size, const bench_digitMix *mix) {
+    int64_t *vals = malloc(size * sizeof(int64_t));
+    char (*texts)[INT_STRING_MAX] = malloc(size * sizeof(*texts));
+    uint8_t *lens = malloc(size);
+    for (uint32_t i = 0; i < size; i++) {
+        int digits = mix->minDigits + (int) (bench_rand() % (mix->maxDigits - mix->minDigits + 1));
+        int64_t low = 1;
+        for (int d = 1; d < digits; d++) low *= 10;
+        //low * 9 doesn't fit for 19 digits, take what is left up to INT64_MAX
+        uint64_t span = digits == 19 ? (uint64_t) INT64_MAX - low + 1 : (uint64_t) low * 9;
+        int64_t val = low + (int64_t) (bench_rand() % span);
+        vals[i] = bench_rand() & 1 ? -val : val;
+        lens[i] = (uint8_t) int2string(texts[i], vals[i]);
+    }
+
+    int64_t val;
+    double t = bench_now();
+    for (uint32_t i = 0; i < size; i++) {
+        string2int(texts[i], lens[i], &val);
+        bench_sink += (uint64_t) val;
+    }
+    bench_record("integer", "string2int", mix->name, size, size, bench_now() - t, 0);
+
+    t = bench_now();
+    for (uint32_t i = 0; i < size; i++) {
+        bench_legacyString2int(texts[i], lens[i], &val);
+        bench_sink += (uint64_t) val;
+    }
+    bench_record("integer", "string2int_old", mix->name, size, size, bench_now() - t, 0);
+
+    char buf[32];
+    t = bench_now();
+    for (uint32_t i = 0; i < size; i++) {
+        bench_sink += (uint64_t) int2string(buf, vals[i]) + (uint64_t) buf[0];
+    }
+    bench_record("integer", "int2string", mix->name, size, size, bench_now() - t, 0);
+
+    t = bench_now();
+    for (uint32_t i = 0; i < size; i++) {
+        bench_sink += (uint64_t) snprintf(buf, sizeof(buf), "%ld", (long) vals[i]) + (uint64_t) buf[0];
+    }
+    bench_record("integer", "snprintf", mix->name, size, size, bench_now() - t, 0);
+
+    t = bench_now();
+    for (uint32_t i = 0; i < size; i++) {
+        bench_sink += (uint64_t) countDigit(vals[i]);
+    }
+    bench_record("integer", "countDigit", mix->name, size, size, bench_now() - t, 0);
+
+    t = bench_now();
+    for (uint32_t i = 0; i < size; i++) {
+        bench_sink += (uint64_t) bench_legacyCountDigit(vals[i]);
+    }
+    bench_record("integer", "countDigit_old", mix->name, size, size, bench_now() - t, 0);
+
+    free(vals);
+    free(texts);
+    free(lens);
+}
+
+int main(int argc, char **argv) {
+    int quick = 0;
+    const char *jsonPath = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--quick") == 0) {
+            quick = 1;
+        } else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            jsonPath = argv[++i];
+        } else {
+            fprintf(stderr, "usage: %s [--quick] [--json path]\n", argv[0]);
+            return 1;
+        }
+    }
+    bench_quiet = jsonPath && strcmp(jsonPath, "-") == 0;
+
+    uint32_t fullSizes[] = {1000, 10000, 100000};
+    uint32_t quickSizes[] = {100, 1000};
+    uint32_t *sizes = quick ? quickSizes : fullSizes;
+    int nsizes = quick ? 2 : 3;
+    uint32_t listOps = quick ? 100 : BENCH_OPS;
+
+    for (int s = 0; s < nsizes; s++) {
+        for (size_t m = 0; m < sizeof(bench_intMixes) / sizeof(bench_intMixes[0]); m++) {
+            bench_intVector(sizes[s], &bench_intMixes[m], 0);
+        }
+        bench_intVector(sizes[s], &bench_intMixes[BENCH_IDS_MIX], 1);
+    }
+    for (int s = 0; s < nsizes; s++) {
+        for (size_t m = 0; m < sizeof(bench_intMixes) / sizeof(bench_intMixes[0]); m++) {
+            bench_intSet(sizes[s], &bench_intMixes[m], 0);
+        }
+        bench_intSet(sizes[s], &bench_intMixes[BENCH_IDS_MIX], 1);
+    }
+    for (int s = 0; s < nsizes; s++) {
+        for (int m = 0; m < (int) (sizeof(bench_listMixes) / sizeof(bench_listMixes[0])); m++) {
+            bench_compactList(sizes[s], m, listOps);
+        }
+    }
+    for (int s = 0; s < nsizes; s++) {
+        for (int m = 0; m < (int) (sizeof(bench_listMixes) / sizeof(bench_listMixes[0])); m++) {
+            bench_quickList(sizes[s], m, listOps, 0);
+            bench_quickList(sizes[s], m, listOps, 1);
+        }
+    }
+    for (size_t m = 0; m < sizeof(bench_digitMixes) / sizeof(bench_digitMixes[0]); m++) {
+        bench_integer(quick ? 1000 : BENCH_PROBES, &bench_digitMixes[m]);
+    }
+
+    if (jsonPath) {
+        FILE *fp = bench_quiet ? stdout : fopen(jsonPath, "w");
+        if (fp == NULL) {
+            fprintf(stderr, "can't open %s\n", jsonPath);
+            return 1;
+        }
+        bench_writeJson(fp, quick);
+        if (fp != stdout) fclose(fp);
+    }
+    return 0;
+}
@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include "blob_file.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define BLOB_X86
+#endif
+
+#define BLOB_CRC_POLY 0x82F63B78 //CRC-32C, reflected
+
+static uint32_t blob_crcTable[256];
+
+static void blob_initTable() {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int b = 0; b < 8; b++) {
+            crc = crc & 1 ? (crc >> 1) ^ BLOB_CRC_POLY : crc >> 1;
+        }
+        blob_crcTable[i] = crc;
+    }
+}
+
+static uint32_t blob_crcScalar(uint32_t crc, const unsigned char *pt, size_t len) {
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, blob_initTable);
+    for (size_t i = 0; i < len; i++) {
+        crc = (crc >> 8) ^ blob_crcTable[(crc ^ pt[i]) & 0xFF];
+    }
+    return crc;
+}
+
+#ifdef BLOB_X86
+
+//SSE4.2 has the CRC-32C step as an instruction, 8 bytes at a time
+__attribute__((target("sse4.2")))
+static uint32_t blob_crcSse42(uint32_t crc, const unsigned char *pt, size_t len) {
+    uint64_t crc64 = crc;
+    for (; len >= 8; pt += 8, len -= 8) {
+        uint64_t word;
+        memcpy(&word, pt, 8);
+        crc64 = __builtin_ia32_crc32di(crc64, word);
+    }
+    crc = (uint32_t) crc64;
+    for (; len > 0; pt++, len--) {
+        crc = __builtin_ia32_crc32qi(crc, *pt);
+    }
+    return crc;
+}
+
+static int blob_hasSse42() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2");
+}
+
+#else
+
+static int blob_hasSse42() {
+    return 0;
+}
+
+#endif
+
+uint32_t blob_crc32c(const void *data, size_t len) {
+    uint32_t crc = 0xFFFFFFFF;
+#ifdef BLOB_X86
+    if (blob_hasSse42()) {
+        return ~blob_crcSse42(crc, data, len);
+    }
+#endif
+    return ~blob_crcScalar(crc, data, len);
+}
+
+static uint32_t blob_crcUpdate(uint32_t crc, const void *data, size_t len) {
+#ifdef BLOB_X86
+    if (blob_hasSse42()) {
+        return blob_crcSse42(crc, data, len);
+    }
+#endif
+    return blob_crcScalar(crc, data, len);
+}
+
+int blob_save(const char *path, uint8_t type, const void *part, size_t partBytes,
+              const void *tail, size_t tailBytes) {
+    BlobFileHeader header;
+    memcpy(header.magic, BLOB_FILE_MAGIC, sizeof(header.magic));
+    header.version = BLOB_FILE_VERSION;
+    header.type = type;
+    header.reserved = 0;
+    header.endian = BLOB_FILE_ENDIAN;
+    header.checksum = ~blob_crcUpdate(blob_crcUpdate(0xFFFFFFFF, part, partBytes), tail, tailBytes);
+    header.bytes = partBytes + tailBytes;
+
+    FILE *fp;
+    if ((fp = fopen(path, "wb")) == NULL) {
+        return 0;
+    }
+    int ok = fwrite(&header, sizeof(header), 1, fp) == 1
+             && fwrite(part, 1, partBytes, fp) == partBytes
+             && (tailBytes == 0 || fwrite(tail, 1, tailBytes, fp) == tailBytes);
+    //a failed flush is a failed write too
+    ok = fclose(fp) == 0 && ok;
+    return ok;
+}
+
+const void *blob_view(const void *addr, size_t len, uint8_t type, int verify, uint64_t *bytes) {
+    const BlobFileHeader *header = addr;
+    if (addr == NULL || len < sizeof(*header)
+        || memcmp(header->magic, BLOB_FILE_MAGIC, sizeof(header->magic)) != 0
+        || header->version != BLOB_FILE_VERSION
+        || header->endian != BLOB_FILE_ENDIAN
+        || header->type != type
+        || header->bytes != len - sizeof(*header)) {
+        return NULL;
+    }
+    const char *blob = (const char *) addr + sizeof(*header);
+    if (verify && blob_crc32c(blob, header->bytes) != header->checksum) {
+        return NULL;
+    }
+    *bytes = header->bytes;
+    return blob;
+}
+
+const void *BlobFileMap(const char *path, size_t *len) {
+    int fd;
+    struct stat st;
+    if ((fd = open(path, O_RDONLY)) == -1) {
+        return NULL;
+    }
+    if (fstat(fd, &st) == -1 || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+    void *addr = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        return NULL;
+    }
+    *len = (size_t) st.st_size;
+    return addr;
+}
+
+void BlobFileUnmap(const void *addr, size_t len) {
+    munmap((void *) addr, len);
+}
+
+//#define BLOB_FILE_TEST
+#ifdef BLOB_FILE_TEST
+
+#include <assert.h>
+
+int main() {
+    //reference value of CRC-32C
+    assert(blob_crc32c("123456789", 9) == 0xE3069283);
+    assert(blob_crcScalar(0xFFFFFFFF, (const unsigned char *) "123456789", 9) == ~0xE3069283u);
+
+    char blob[1000];
+    for (int i = 0; i < 1000; i++) blob[i] = (char) (i * 7);
+    const char *path = "/tmp/blob_file_test.bin";
+    assert(blob_save(path, BLOB_TYPE_INT_VECTOR, blob, 100, blob + 100, 900));
+
+    size_t len;
+    uint64_t bytes;
+    const char *addr = BlobFileMap(path, &len);
+    assert(addr && len == sizeof(BlobFileHeader) + 1000);
+    const char *view = blob_view(addr, len, BLOB_TYPE_INT_VECTOR, 1, &bytes);
+    assert(view == addr + sizeof(BlobFileHeader) && bytes == 1000 && memcmp(view, blob, 1000) == 0);
+    assert(blob_view(addr, len, BLOB_TYPE_COMPACT_LIST, 1, &bytes) == NULL);
+    assert(blob_view(addr, len - 1, BLOB_TYPE_INT_VECTOR, 0, &bytes) == NULL);
+    BlobFileUnmap(addr, len);
+
+    //a flipped bit fails the checksum
+    FILE *fp = fopen(path, "r+b");
+    fseek(fp, sizeof(BlobFileHeader) + 500, SEEK_SET);
+    fputc(blob[500] ^ 1, fp);
+    fclose(fp);
+    addr = BlobFileMap(path, &len);
+    assert(blob_view(addr, len, BLOB_TYPE_INT_VECTOR, 0, &bytes) != NULL);
+    assert(blob_view(addr, len, BLOB_TYPE_INT_VECTOR, 1, &bytes) == NULL);
+    BlobFileUnmap(addr, len);
+    unlink(path);
+    assert(BlobFileMap(path, &len) == NULL);
+    return 0;
+}
+#endif
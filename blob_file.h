@@ -0,0 +1,58 @@
+#ifndef BLOB_FILE_H
+#define BLOB_FILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * File format for structures that are a single packed blob.
+ *
+ * [header] [blob]
+ *
+ * The blob is written as it sits in memory, so a mapped file can
+ * be read in place. The header is 8 byte aligned and keeps the
+ * blob aligned the same way.
+ *
+ * Files are read on hosts of the same byte order only, the endian
+ * marker rejects the others. The checksum is CRC-32C of the blob.
+ */
+typedef struct __attribute__((__packed__)) {
+    char magic[4];
+    uint16_t version;
+    uint8_t type;
+    uint8_t reserved;
+    uint32_t endian;
+    uint32_t checksum;
+    uint64_t bytes; //blob bytes
+} BlobFileHeader;
+
+#define BLOB_FILE_MAGIC "DSBF"
+#define BLOB_FILE_VERSION 1
+#define BLOB_FILE_ENDIAN 0x01020304
+
+#define BLOB_TYPE_INT_VECTOR 1
+#define BLOB_TYPE_COMPACT_LIST 2
+
+/**
+ * Map a file read only, return NULL if it can't be opened.
+ */
+const void *BlobFileMap(const char *path, size_t *len);
+void BlobFileUnmap(const void *addr, size_t len);
+
+uint32_t blob_crc32c(const void *data, size_t len);
+
+/**
+ * Write header and blob, blob is written in parts so a header in
+ * it can be patched: part bytes from blob, then the rest from tail.
+ * Return 1 on success.
+ */
+int blob_save(const char *path, uint8_t type, const void *part, size_t partBytes,
+              const void *tail, size_t tailBytes);
+
+/**
+ * Check a region holding header and blob, return the blob or NULL.
+ * The checksum is only computed when verify is set.
+ */
+const void *blob_view(const void *addr, size_t len, uint8_t type, int verify, uint64_t *bytes);
+
+#endif //BLOB_FILE_H
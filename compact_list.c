@@ -6,33 +6,10 @@
 #include "integer.h"
 #include "compact_list.h"
 #include "panic.h"
-
-#define COMPACT_LIST_DEBUG
-#ifdef COMPACT_LIST_DEBUG
-
-static void show_bytes(CompactList *list) {
-    unsigned char *pt = (unsigned char *) list;
-    printf("bytes: ");
-    for (int i = 0; i < 8; i++) {
-        printf("%2X ", pt[i]);
-    }
-    printf("\nsize: ");
-
-    pt += 8;
-    for (int i = 0; i < 4; i++) {
-        printf("%2X ", pt[i]);
-    }
-    printf("\nelements: ");
-    pt += 4;
-
-    for (int i = 12; i < list->bytes - 1; i++) {
-        printf("%2X ", pt[i - 12]);
-    }
-
-    printf("\nend: %02X\n", ((char *) list)[list->bytes - 1]);
-}
-
-#endif
+#include "allocator.h"
+#include "blob_file.h"
+#include "stats.h"
+#include "lzf.h"
 
 /**
  * Used for constructing an entry.
@@ -46,11 +23,17 @@ typedef struct {
 
     char *data;
     uint32_t sizeofData;
+    char intData[8]; //integer data is encoded here, data points at it
 
     char total[10];
     int sizeofTotal;
 } CompactListNode;
 
+#define CL_RUN_MIN 4 //shorter stretches of integers stay plain entries
+#define CL_RUN_MAX 64 //reading inside a run walks it, keep that short
+#define CL_RUN_BLOCK 32 //appends pack the tail this many integers at a time
+#define CL_INT_ENTRY_MAX (CL_ENC_BYTES + 8 + 1) //largest plain integer entry
+
 inline int64_t CompactListSize(CompactList *list) {
     return list->size;
 }
@@ -67,20 +50,59 @@ static inline size_t cl_sizeofEmptyList() {
     return cl_headerBytes() + CL_END_BYTES;
 }
 
+//#define COMPACT_LIST_DEBUG
+#ifdef COMPACT_LIST_DEBUG
+
+static void show_bytes(CompactList *list) {
+    unsigned char *pt = (unsigned char *) list;
+    printf("bytes: ");
+    for (int i = 0; i < 8; i++) {
+        printf("%2X ", pt[i]);
+    }
+    printf("\nsize: ");
+
+    pt += 8;
+    for (int i = 0; i < 4; i++) {
+        printf("%2X ", pt[i]);
+    }
+    printf("\ngeneration: ");
+
+    pt += 4;
+    for (int i = 0; i < 4; i++) {
+        printf("%2X ", pt[i]);
+    }
+    printf("\nelements: ");
+
+    pt = (unsigned char *) list;
+    for (size_t i = cl_headerBytes(); i < list->bytes - CL_END_BYTES; i++) {
+        printf("%2X ", pt[i]);
+    }
+
+    printf("\nend: %02X\n", pt[list->bytes - 1]);
+}
+
+#endif
+
+
+//every change to a list calls this, an offset index compares the generation
+static inline void cl_changed(CompactList *list) {
+    list->generation++;
+}
 
 CompactList *CompactListNew() {
     CompactList *list;
-    if ((list = malloc(cl_sizeofEmptyList())) == NULL) {
+    if ((list = mem_malloc(cl_sizeofEmptyList())) == NULL) {
         panic("CompactList malloc failed\n");
     }
     list->size = 0;
     list->bytes = cl_sizeofEmptyList();
+    list->generation = 0;
     ((char *) list)[cl_headerBytes()] = (char) CL_END;
     return list;
 }
 
 inline void CompactListFree(CompactList *list) {
-    free(list);
+    mem_free(list, list->bytes);
 }
 
 static int cl_getEntryType(char encoding) {
@@ -95,26 +117,96 @@ static inline int cl_isStrEntry(const char *ele) {
     return cl_getEntryType(ele[0]) == CL_TYPE_STR;
 }
 
+static inline int cl_isRunEntry(const char *ele) {
+    return (unsigned char) ele[0] == CL_INTRUN;
+}
+
+//elements held by an entry
+static inline uint32_t cl_entryCount(const char *ele) {
+    return cl_isRunEntry(ele) ? (unsigned char) ele[CL_ENC_BYTES + 1] : 1;
+}
+
 static inline int cl_isEndOfList(const char *ele) {
     return ele[0] == (char) CL_END;
 }
 
+//string lengths are unsigned, 1, 2 or 4 bytes
+static void cl_setStrLen(char *pt, uint32_t len, uint8_t sizeofLen) {
+    uint8_t len8 = (uint8_t) len;
+    uint16_t len16 = (uint16_t) len;
+    switch (sizeofLen) {
+        case 1:
+            memcpy(pt, &len8, 1);
+            break;
+        case 2:
+            memcpy(pt, &len16, 2);
+            break;
+        default:
+            memcpy(pt, &len, 4);
+            break;
+    }
+}
+
+static uint32_t cl_getStrLen(const char *pt, uint8_t sizeofLen) {
+    uint8_t len8;
+    uint16_t len16;
+    uint32_t len32;
+    switch (sizeofLen) {
+        case 1:
+            memcpy(&len8, pt, 1);
+            return len8;
+        case 2:
+            memcpy(&len16, pt, 2);
+            return len16;
+        default:
+            memcpy(&len32, pt, 4);
+            return len32;
+    }
+}
+
+//encoding of a string of dataLen bytes, sizeofLen is the length field size
+static unsigned char cl_strEncoding(uint32_t dataLen, uint8_t *sizeofLen) {
+    if (dataLen <= 0x0F) {
+        *sizeofLen = 0;
+        return (unsigned char) (CL_STR4 | dataLen);
+    } else if (dataLen <= UINT8_MAX) {
+        *sizeofLen = 1;
+        return CL_STR8;
+    } else if (dataLen <= UINT16_MAX) {
+        *sizeofLen = 2;
+        return CL_STR16;
+    } else {
+        *sizeofLen = 4;
+        return CL_STR32;
+    }
+}
+
+//encoding of an integer, bytes is the data size
+static unsigned char cl_intEncoding(int64_t val, uint8_t *bytes) {
+    if (val >= 0 && val <= 0x0F) {
+        *bytes = 0;
+        return (unsigned char) (CL_INT4 | val);
+    }
+    *bytes = bytesForInt(val);
+    switch (*bytes) {
+        case INT8_BYTES:
+            return CL_INT8;
+        case INT16_BYTES:
+            return CL_INT16;
+        case INT32_BYTES:
+            return CL_INT32;
+        case INT64_BYTES:
+            return CL_INT64;
+        default:
+            panic("CompactList unknown int type %d\n", *bytes);
+    }
+}
+
 static void cl_strNode_setEncoding(CompactListNode *node) {
     assert(node->type == CL_TYPE_STR);
-    int64_t dataLen = node->sizeofData;
-    uint8_t dataLenbits = bitCount(dataLen);
-
-    if (dataLenbits <= 4) {
-        node->encoding = (unsigned char) (CL_STR4 | dataLen);
-    } else if (dataLenbits <= 8 * INT8_BYTES) {
-        node->encoding = CL_STR8;
-        node->sizeofLen = (uint8_t) int_setValue(node->len, (int64_t) dataLen);
-    } else if (dataLenbits <= 8 * INT16_BYTES) {
-        node->encoding = CL_STR16;
-        node->sizeofLen = (uint8_t) int_setValue(node->len, (int64_t) dataLen);
-    } else {
-        node->encoding = CL_STR32;
-        node->sizeofLen = (uint8_t) int_setValue(node->len, (int64_t) dataLen);
+    node->encoding = cl_strEncoding(node->sizeofData, &node->sizeofLen);
+    if (node->sizeofLen > 0) {
+        cl_setStrLen(node->len, node->sizeofData, node->sizeofLen);
     }
 }
 
@@ -122,34 +214,15 @@ static void cl_strNode_setEncoding(CompactListNode *node) {
 static void cl_intNode_setEncodingAndData(CompactListNode *node, int64_t val) {
     assert(node->type == CL_TYPE_INT);
 
-    uint8_t bytes = bytesForInt(val), bits = bitCount(val);
-    if (bits <= 4) {
-        node->encoding = (unsigned char) (CL_INT4 | val);
+    uint8_t bytes;
+    node->encoding = cl_intEncoding(val, &bytes);
+    if (bytes == 0) {
+        node->data = NULL;
         node->sizeofData = 0;
     } else {
-        char *intVal;
-        if ((intVal = malloc(bytes)) == NULL) {
-            panic("CompactList malloc for int val node failed\n");
-        }
-        int_setValue(intVal, val);
-        node->data = intVal;
+        int_setValueByType(node->intData, val, bytes);
+        node->data = node->intData;
         node->sizeofData = bytes;
-        switch (bytes) {
-            case INT8_BYTES:
-                node->encoding = CL_INT8;
-                break;
-            case INT16_BYTES:
-                node->encoding = CL_INT16;
-                break;
-            case INT32_BYTES:
-                node->encoding = CL_INT32;
-                break;
-            case INT64_BYTES:
-                node->encoding = CL_INT64;
-                break;
-            default:
-                panic("CompactList unknown int type %d\n", bytes);
-        }
     }
 }
 
@@ -166,10 +239,11 @@ static uint32_t cl_getDataLenSize(const char *ele) {
         case CL_INT64:
             return 0;
         case CL_STR8:
+        case CL_INTRUN:
             return 1;
         case CL_STR16:
             return 2;
-        case CL_STR32:
+        case CL_STR32 & 0xF0:
             return 4;
         default:
             panic("CompactList getDataLenSize: unknown entry encoding %d\n", enc & 0xF0);
@@ -183,6 +257,8 @@ static inline uint32_t cl_getDataSize(char *ele) {
 
     if (type == CL_INT4) {
         return 0;
+    } else if (enc == CL_INTRUN) {
+        return (unsigned char) ele[1];
     } else if (type == CL_STR4) {
         return (uint32_t) (enc & 0x0F);
     } else if (cl_isIntEntry(ele)) {
@@ -199,8 +275,7 @@ static inline uint32_t cl_getDataSize(char *ele) {
             goto err;
         }
     } else if (cl_isStrEntry(ele)) {
-        uint32_t dataLenSize = cl_getDataLenSize(ele);
-        return (uint32_t) int_getValue(ele + 1, dataLenSize);
+        return cl_getStrLen(ele + 1, (uint8_t) cl_getDataLenSize(ele));
     } else {
         goto err;
     }
@@ -209,41 +284,225 @@ static inline uint32_t cl_getDataSize(char *ele) {
     panic("CompactList getDataSize: unknown string entry encoding 0x%x\n", enc & 0xF0);
 }
 
-//get total size
-static inline uint32_t cl_getTotalSize(char *ele) {
-    uint32_t tot = cl_getDataLenSize(ele) + CL_ENC_BYTES + cl_getDataSize(ele);
-    uint32_t totBits = bitCount(tot);
-    return totBits / 7 + (totBits % 7 > 0 ? 1 : 0);
+//bytes of the 7 bit groups storing tot, tot is at least CL_ENC_BYTES
+static inline uint32_t cl_totalBytes(uint32_t tot) {
+    uint32_t totBits = 32 - (uint32_t) __builtin_clz(tot);
+    return (totBits + 6) / 7;
 }
 
-
-static inline void cl_node_setTotal(CompactListNode *node) {
-    uint32_t encDataSize = node->sizeofLen + node->sizeofData + CL_ENC_BYTES;
-    uint32_t encDataBits = bitCount(encDataSize);
-
-    uint32_t sizeofTotal = encDataBits / 7 + (encDataBits % 7 > 0 ? 1 : 0);
-    node->sizeofTotal = sizeofTotal;
-
-    for (int i = node->sizeofTotal - 1; i >= 0; i--) {
+//write the backlink of an entry of encDataSize bytes, return its size
+static int cl_setTotal(char *total, uint32_t encDataSize) {
+    int sizeofTotal = (int) cl_totalBytes(encDataSize);
+    for (int i = sizeofTotal - 1; i >= 0; i--) {
         char part = (char) (encDataSize & 0x7F);
         if (i == 0) {
             part |= 0x80;
         }
-        node->total[i] = part;
+        total[i] = part;
         encDataSize >>= 7;
     }
+    return sizeofTotal;
+}
+
+static inline void cl_node_setTotal(CompactListNode *node) {
+    node->sizeofTotal = cl_setTotal(node->total, node->sizeofLen + node->sizeofData + CL_ENC_BYTES);
 }
 
 static inline void cl_ensureNode(const char *ele) {
     char enc = ele[0];
     if (enc != (char) CL_END) {
-        char type = (char) cl_getEntryType(enc);
-        assert(type == CL_TYPE_STR || type == CL_TYPE_INT);
+        assert(cl_getEntryType(enc) == CL_TYPE_STR || cl_getEntryType(enc) == CL_TYPE_INT
+               || (unsigned char) enc == CL_INTRUN);
     }
 }
 
+//same as summing the parts, decoding the encoding byte once, it is on every walk
 static inline uint32_t cl_getEntrySize(char *ele) {
-    return CL_ENC_BYTES + cl_getDataLenSize(ele) + cl_getDataSize(ele) + cl_getTotalSize(ele);
+    unsigned char enc = (unsigned char) ele[0];
+    uint32_t tot;
+    switch (enc >> 4) {
+        case CL_STR4 >> 4:
+            tot = CL_ENC_BYTES + (enc & 0x0F);
+            break;
+        case CL_STR8 >> 4:
+            tot = CL_ENC_BYTES + 1 + cl_getStrLen(ele + 1, 1);
+            break;
+        case CL_STR16 >> 4:
+            tot = CL_ENC_BYTES + 2 + cl_getStrLen(ele + 1, 2);
+            break;
+        case CL_STR32 >> 4:
+            tot = CL_ENC_BYTES + 4 + cl_getStrLen(ele + 1, 4);
+            break;
+        case CL_INT4 >> 4:
+            tot = CL_ENC_BYTES;
+            break;
+        case CL_INT8 >> 4:
+            tot = CL_ENC_BYTES + 1;
+            break;
+        case CL_INT16 >> 4:
+            tot = CL_ENC_BYTES + 2;
+            break;
+        case CL_INT32 >> 4:
+            tot = CL_ENC_BYTES + (enc == CL_INT64 ? 8 : 4);
+            break;
+        case CL_INTRUN >> 4:
+            tot = CL_ENC_BYTES + 1 + (unsigned char) ele[1];
+            break;
+        default:
+            panic("CompactList getEntrySize: unknown entry encoding 0x%x\n", enc);
+    }
+    return tot + cl_totalBytes(tot);
+}
+
+static inline uint64_t cl_zigzag(int64_t val) {
+    return ((uint64_t) val << 1) ^ (uint64_t) (val >> 63);
+}
+
+static inline int64_t cl_unzigzag(uint64_t val) {
+    return (int64_t) (val >> 1) ^ -(int64_t) (val & 1);
+}
+
+static inline uint32_t cl_varintBytes(uint64_t val) {
+    return (uint32_t) (64 - __builtin_clzll(val | 1) + 6) / 7;
+}
+
+static uint32_t cl_putVarint(unsigned char *pt, uint64_t val) {
+    uint32_t i = 0;
+    for (; val >= 0x80; val >>= 7) {
+        pt[i++] = (unsigned char) (val | 0x80);
+    }
+    pt[i++] = (unsigned char) val;
+    return i;
+}
+
+static uint32_t cl_getVarint(const unsigned char *pt, uint64_t *val) {
+    uint64_t ret = 0;
+    uint32_t i = 0, shift = 0;
+    do {
+        ret |= (uint64_t) (pt[i] & 0x7F) << shift;
+        shift += 7;
+    } while (pt[i++] & 0x80);
+    *val = ret;
+    return i;
+}
+
+static void cl_runDecode(const char *ele, CompactListRun *run) {
+    const unsigned char *pt = (const unsigned char *) ele + CL_ENC_BYTES + 1;
+    uint64_t val;
+    run->count = pt[0];
+    run->width = pt[1];
+    pt += 2;
+    pt += cl_getVarint(pt, &val);
+    run->base = cl_unzigzag(val);
+    pt += cl_getVarint(pt, &val);
+    run->step = cl_unzigzag(val);
+    run->deltas = pt;
+}
+
+//delta k, between values k and k + 1, may span 9 bytes
+static inline uint64_t cl_runDelta(const CompactListRun *run, uint32_t k) {
+    if (run->width == 0) {
+        return 0;
+    }
+    uint64_t bit = (uint64_t) k * run->width;
+    const unsigned char *pt = run->deltas + bit / 8;
+    uint32_t shift = (uint32_t) (bit % 8), bytes = (shift + run->width + 7) / 8;
+    uint64_t val = 0;
+    for (uint32_t i = 0; i < bytes && i < 8; i++) {
+        val |= (uint64_t) pt[i] << (8 * i);
+    }
+    val >>= shift;
+    if (bytes > 8) {
+        val |= (uint64_t) pt[8] << (64 - shift);
+    }
+    return run->width == 64 ? val : val & ((1ULL << run->width) - 1);
+}
+
+static void cl_runPutDelta(unsigned char *deltas, uint8_t width, uint32_t k, uint64_t val) {
+    uint64_t bit = (uint64_t) k * width;
+    unsigned char *pt = deltas + bit / 8;
+    uint32_t shift = (uint32_t) (bit % 8), bytes = (shift + width + 7) / 8;
+    for (uint32_t i = 0; i < bytes; i++) {
+        pt[i] |= (unsigned char) (i < 8 ? (val << shift) >> (8 * i) : val >> (64 - shift));
+    }
+}
+
+//integers wrap, so any two values have a delta and decoding is exact
+static inline int64_t cl_runNext(const CompactListRun *run, int64_t val, uint32_t k) {
+    return (int64_t) ((uint64_t) val + (uint64_t) run->step + cl_runDelta(run, k));
+}
+
+static inline int64_t cl_runPrev(const CompactListRun *run, int64_t val, uint32_t k) {
+    return (int64_t) ((uint64_t) val - (uint64_t) run->step - cl_runDelta(run, k - 1));
+}
+
+static int64_t cl_runValueAt(const CompactListRun *run, uint32_t pos) {
+    if (run->width == 0) {
+        return (int64_t) ((uint64_t) run->base + (uint64_t) run->step * pos);
+    }
+    int64_t val = run->base;
+    for (uint32_t k = 0; k < pos; k++) {
+        val = cl_runNext(run, val, k);
+    }
+    return val;
+}
+
+//decode every value of the run at ele, return the count
+static uint32_t cl_runValues(const char *ele, int64_t *vals) {
+    CompactListRun run;
+    cl_runDecode(ele, &run);
+    vals[0] = run.base;
+    for (uint32_t k = 1; k < run.count; k++) {
+        vals[k] = cl_runNext(&run, vals[k - 1], k - 1);
+    }
+    return run.count;
+}
+
+/*
+ * Bytes of n values as one run, 0 if the run would not fit its
+ * length byte. step is the smallest difference of neighbours, the
+ * widest delta above it sets width.
+ */
+static uint32_t cl_runSize(const int64_t *vals, uint32_t n, uint8_t *width, int64_t *step) {
+    int64_t minStep = INT64_MAX;
+    for (uint32_t k = 1; k < n; k++) {
+        int64_t diff = (int64_t) ((uint64_t) vals[k] - (uint64_t) vals[k - 1]);
+        if (diff < minStep) minStep = diff;
+    }
+    uint64_t spread = 0;
+    for (uint32_t k = 1; k < n; k++) {
+        spread |= (uint64_t) vals[k] - (uint64_t) vals[k - 1] - (uint64_t) minStep;
+    }
+    *width = (uint8_t) (spread ? 64 - __builtin_clzll(spread) : 0);
+    *step = minStep;
+
+    uint64_t payload = 2 + cl_varintBytes(cl_zigzag(vals[0])) + cl_varintBytes(cl_zigzag(minStep))
+                       + ((uint64_t) (n - 1) * *width + 7) / 8;
+    if (payload > UINT8_MAX) {
+        return 0;
+    }
+    uint32_t tot = CL_ENC_BYTES + 1 + (uint32_t) payload;
+    return tot + cl_totalBytes(tot);
+}
+
+static char *cl_runWrite(char *ele, const int64_t *vals, uint32_t n, uint8_t width, int64_t step) {
+    unsigned char *pt = (unsigned char *) ele + CL_ENC_BYTES + 1;
+    pt[0] = (unsigned char) n;
+    pt[1] = width;
+    pt += 2;
+    pt += cl_putVarint(pt, cl_zigzag(vals[0]));
+    pt += cl_putVarint(pt, cl_zigzag(step));
+    uint32_t deltaBytes = ((n - 1) * width + 7) / 8;
+    memset(pt, 0, deltaBytes);
+    for (uint32_t k = 1; k < n; k++) {
+        cl_runPutDelta(pt, width, k - 1, (uint64_t) vals[k] - (uint64_t) vals[k - 1] - (uint64_t) step);
+    }
+    pt += deltaBytes;
+
+    uint32_t payload = (uint32_t) ((char *) pt - ele) - CL_ENC_BYTES - 1;
+    ele[0] = (char) CL_INTRUN;
+    ele[1] = (char) payload;
+    return (char *) pt + cl_setTotal((char *) pt, CL_ENC_BYTES + 1 + payload);
 }
 
 static char *cl_nextElement(char *ele) {
@@ -251,6 +510,7 @@ static char *cl_nextElement(char *ele) {
     if (ele[0] == (char) CL_END) {
         return NULL;
     } else {
+        STATS_ADD(STATS_CL_WALKED, 1);
         return ele + cl_getEntrySize(ele);
     }
 }
@@ -259,6 +519,7 @@ static char *cl_nextElement(char *ele) {
 static char *cl_prevElement(char *ele, int64_t idx) {
     if (idx - 1 < 0) return NULL;
     cl_ensureNode(ele);
+    STATS_ADD(STATS_CL_WALKED, 1);
 
     char *pt = ele - 1;
     unsigned char totPart, weight = 0;
@@ -287,33 +548,36 @@ static char *cl_lastElement(CompactList *list) {
     }
 }
 
-static char *cl_elementAt(CompactList *list, int64_t idx) {
+//entry holding element idx, pos is the position of idx inside it
+static char *cl_elementAt(CompactList *list, int64_t idx, uint32_t *pos) {
     assert(list->size > 0 && idx >= 0 && idx < list->size);
     char *node;
+    int64_t first; //index of the first element of node
 
     if (idx <= list->size / 2) {
         //iter from head
         node = cl_firstElement(list);
-        while (idx > 0) {
+        first = 0;
+        while (first + cl_entryCount(node) <= idx) {
+            first += cl_entryCount(node);
             node = cl_nextElement(node);
-            idx--;
         }
     } else {
         //iter from tail
         node = cl_lastElement(list);
-        int64_t curIdx = list->size - 1;
-        while (curIdx > idx) {
-            node = cl_prevElement(node, curIdx);
-            curIdx--;
+        first = list->size - cl_entryCount(node);
+        while (first > idx) {
+            node = cl_prevElement(node, first);
+            first -= cl_entryCount(node);
         }
     }
 
+    *pos = (uint32_t) (idx - first);
     return node;
 }
 
 //return -1 if int val, 0 or positive number if string val
-static int64_t cl_valueAt(CompactList *list, int64_t idx, int64_t *intVal, char **strVal) {
-    char *ele = cl_elementAt(list, idx);
+static int64_t cl_entryValue(char *ele, int64_t *intVal, char **strVal) {
     unsigned char enc = (unsigned char) ele[0];
     unsigned char type = (unsigned char) cl_getEntryType(enc);
     uint32_t dataLenSize = cl_getDataLenSize(ele);
@@ -324,14 +588,16 @@ static int64_t cl_valueAt(CompactList *list, int64_t idx, int64_t *intVal, char
             return ele[0] & 0x0F;
         } else {
             if (strVal) *strVal = ele + CL_ENC_BYTES + dataLenSize;
-            return int_getValue(ele + 1, dataLenSize);
+            return cl_getStrLen(ele + 1, (uint8_t) dataLenSize);
         }
     } else if (type == CL_TYPE_INT) {
-        //TODO refactor encoding
-        if (enc & 0xF0 == CL_INT4) {
+        //CL_INT64 shares its high nibble with CL_INT32, test it first
+        if ((enc & 0xF0) == CL_INT4) {
             if (intVal) *intVal = ele[0] & 0x0F;
         } else if (enc == CL_INT64) {
             if (intVal) *intVal = int_getValue(ele + 1, INT64_BYTES);
+        } else if ((enc & 0xF0) == CL_INT8) {
+            if (intVal) *intVal = int_getValue(ele + 1, INT8_BYTES);
         } else if ((enc & 0xF0) == CL_INT16) {
             if (intVal) *intVal = int_getValue(ele + 1, INT16_BYTES);
         } else if ((enc & 0xF0) == CL_INT32) {
@@ -345,157 +611,1154 @@ static int64_t cl_valueAt(CompactList *list, int64_t idx, int64_t *intVal, char
     }
 }
 
-static inline CompactListNode *cl_node_init(CompactListNode *node) {
-    node->data = NULL;
-    node->sizeofData = 0;
-    node->sizeofLen = 0;
-    node->sizeofTotal = 0;
-    return node;
+//value of element pos of the entry ele, same as cl_entryValue
+static int64_t cl_elementValue(char *ele, uint32_t pos, int64_t *intVal, char **strVal) {
+    if (cl_isRunEntry(ele)) {
+        CompactListRun run;
+        cl_runDecode(ele, &run);
+        if (intVal) *intVal = cl_runValueAt(&run, pos);
+        return -1;
+    }
+    return cl_entryValue(ele, intVal, strVal);
 }
 
-static inline uint32_t cl_node_size(CompactListNode *node) {
-    return CL_ENC_BYTES + node->sizeofLen + node->sizeofData + node->sizeofTotal;
+static int64_t cl_valueAt(CompactList *list, int64_t idx, int64_t *intVal, char **strVal) {
+    uint32_t pos;
+    char *ele = cl_elementAt(list, idx, &pos);
+    return cl_elementValue(ele, pos, intVal, strVal);
 }
 
-int64_t CompactListIndexOf(CompactList *list, char *data, size_t len){
-    if(list->size == 0){
-        return -1;
+#define CL_OFFSETS_MIN_CAPACITY 8
+
+CompactListOffsets *CompactListOffsetsNew(uint32_t stride) {
+    CompactListOffsets *offsets;
+    if ((offsets = mem_malloc(sizeof(*offsets))) == NULL) {
+        panic("CompactList offsets malloc failed\n");
     }
+    offsets->stride = stride > 0 ? stride : CL_OFFSETS_DEFAULT_STRIDE;
+    offsets->valid = 0;
+    offsets->generation = 0;
+    offsets->count = 0;
+    offsets->capacity = 0;
+    offsets->checkpoints = NULL;
+    return offsets;
+}
 
-    uint32_t idx = 0;
-    char *strVal;
-    int64_t intVal;
-    while (idx < list->size ) {
-        int64_t entryDataLen = cl_valueAt(list, idx, &intVal, &strVal);
-        if (entryDataLen == -1) {
-            int64_t idata;
-            int succ = string2int(data, len, &idata);
-            if (succ && (idata == intVal)) {
-                return idx;
-            }
-        } else {
-            if ((entryDataLen == len) && (strncmp(strVal, data, len) == 0)) {
-                return idx;
-            }
+void CompactListOffsetsFree(CompactListOffsets *offsets) {
+    mem_free(offsets->checkpoints, offsets->capacity * sizeof(CompactListCheckpoint));
+    mem_free(offsets, sizeof(*offsets));
+}
+
+//insert a checkpoint at position pos of the checkpoint array
+static void cl_offsets_insert(CompactListOffsets *offsets, uint32_t pos, uint32_t idx, uint64_t offset) {
+    if (offsets->count == offsets->capacity) {
+        uint32_t capacity = offsets->capacity < CL_OFFSETS_MIN_CAPACITY ? CL_OFFSETS_MIN_CAPACITY : offsets->capacity * 2;
+        CompactListCheckpoint *checkpoints;
+        if ((checkpoints = mem_realloc(offsets->checkpoints, offsets->capacity * sizeof(*checkpoints),
+                                       capacity * sizeof(*checkpoints))) == NULL) {
+            panic("CompactList offsets realloc failed\n");
         }
-        idx++;
+        offsets->checkpoints = checkpoints;
+        offsets->capacity = capacity;
     }
-    return -1;
+    CompactListCheckpoint *cp = offsets->checkpoints + pos;
+    memmove(cp + 1, cp, (offsets->count - pos) * sizeof(*cp));
+    cp->idx = idx;
+    cp->offset = offset;
+    offsets->count++;
 }
 
-//TODO getValue(entry)
-CompactList *CompactListRemove(CompactList *list, char *data, size_t len, int *ret) {
-    int64_t idx = CompactListIndexOf(list, data, len);
-    if(idx == -1){
-        if(ret) *ret = 0;
-        return list;
-    }
+static void cl_offsets_delete(CompactListOffsets *offsets, uint32_t pos) {
+    CompactListCheckpoint *cp = offsets->checkpoints + pos;
+    memmove(cp, cp + 1, (offsets->count - pos - 1) * sizeof(*cp));
+    offsets->count--;
+}
 
-    if(ret) *ret = 1;
-    char *tar = cl_elementAt(list, idx);
-    //shift left
-    uint32_t entrySize = cl_getEntrySize(tar);
-    int64_t cpyLen = cl_getEndOfList(list) - (tar + entrySize) + 1;
-    memcpy(tar, tar + entrySize, (size_t)cpyLen);
+static void cl_offsets_snapshot(CompactList *list, CompactListOffsets *offsets) {
+    offsets->generation = list->generation;
+}
 
-    list->bytes -= entrySize;
-    list->size--;
-    if((list = realloc(list, list->bytes)) == NULL){
-        panic("CompactList remove: realloc failed\n");
+static void cl_offsets_rebuild(CompactList *list, CompactListOffsets *offsets) {
+    offsets->count = 0;
+    char *ele = cl_firstElement(list);
+    uint32_t due = 0; //element index the next checkpoint is due at
+    for (uint32_t i = 0; i < list->size; i += cl_entryCount(ele), ele = cl_nextElement(ele)) {
+        if (i >= due) {
+            cl_offsets_insert(offsets, offsets->count, i, (uint64_t) (ele - (char *) list));
+            due = i + offsets->stride;
+        }
     }
+    offsets->valid = 1;
+    cl_offsets_snapshot(list, offsets);
+}
 
-    return list;
+static inline int cl_offsets_isFresh(CompactList *list, CompactListOffsets *offsets) {
+    return offsets->valid && offsets->generation == list->generation;
+}
 
+//position of the first checkpoint with entry index not less than idx
+static uint32_t cl_offsets_lowerBound(CompactListOffsets *offsets, int64_t idx) {
+    uint32_t lf = 0, len = offsets->count;
+    while (len > 0) {
+        uint32_t half = len / 2;
+        if (offsets->checkpoints[lf + half].idx < idx) {
+            lf += half + 1;
+            len -= half + 1;
+        } else {
+            len = half;
+        }
+    }
+    return lf;
 }
 
-CompactList *CompactListInsert(CompactList *list, char *data, size_t dataLen, int64_t idx) {
-    if (list->size == UINT32_MAX) {
-        panic("CompactList list is full\n");
-    } else if (idx > list->size) {
-        panic("index too big, max index is list size\n");
+//find the entry holding idx, walking from the closest checkpoint or the tail
+static char *cl_seek(CompactList *list, CompactListOffsets *offsets, int64_t idx, uint32_t *pos) {
+    if (offsets == NULL) {
+        return cl_elementAt(list, idx, pos);
+    }
+    assert(list->size > 0 && idx >= 0 && idx < list->size);
+    if (!cl_offsets_isFresh(list, offsets)) {
+        cl_offsets_rebuild(list, offsets);
     }
-    //create node
-    int64_t val;
-    CompactListNode node;
-    cl_node_init(&node);
-    node.sizeofData = (uint32_t) dataLen;
-    node.data = data;
 
-    if (string2int(data, dataLen, &val) == 1) {
-        node.type = CL_TYPE_INT;
-        cl_intNode_setEncodingAndData(&node, val);
+    uint32_t next = cl_offsets_lowerBound(offsets, idx + 1);
+    CompactListCheckpoint *floor = offsets->checkpoints + next - 1;
+    int64_t forward = idx - floor->idx;
+    int64_t backIdx = next < offsets->count ? offsets->checkpoints[next].idx : list->size - 1;
+
+    char *ele;
+    int64_t first; //index of the first element of ele
+    if (backIdx - idx < forward) {
+        if (next < offsets->count) {
+            ele = (char *) list + offsets->checkpoints[next].offset;
+            first = offsets->checkpoints[next].idx;
+        } else {
+            ele = cl_lastElement(list);
+            first = list->size - cl_entryCount(ele);
+        }
+        while (first > idx) {
+            ele = cl_prevElement(ele, first);
+            first -= cl_entryCount(ele);
+        }
     } else {
-        node.type = CL_TYPE_STR;
-        cl_strNode_setEncoding(&node);
+        ele = (char *) list + floor->offset;
+        first = floor->idx;
+        while (first + cl_entryCount(ele) <= idx) {
+            first += cl_entryCount(ele);
+            ele = cl_nextElement(ele);
+        }
     }
-    cl_node_setTotal(&node);
+    *pos = (uint32_t) (idx - first);
+    return ele;
+}
 
-    //resize
-    if ((list = realloc(list, list->bytes + cl_node_size(&node))) == NULL) {
-        panic("CompactList realloc failed\n");
+//an entry of entrySize bytes was inserted at idx, at byte offset
+static void cl_offsets_onInsert(CompactList *list, CompactListOffsets *offsets, int64_t idx,
+                                uint64_t offset, uint32_t entrySize) {
+    if (offsets == NULL) {
+        return;
+    }
+    //the insert must be the only change since the last update
+    if (!offsets->valid || offsets->generation + 1 != list->generation) {
+        offsets->valid = 0;
+        return;
+    }
+    uint32_t pos = cl_offsets_lowerBound(offsets, idx);
+    for (uint32_t c = pos; c < offsets->count; c++) {
+        offsets->checkpoints[c].idx++;
+        offsets->checkpoints[c].offset += entrySize;
     }
 
-    //shift right
-    char *ele;
-    if (idx == list->size) {
-        //add at tail
-        ele = cl_getEndOfList(list);
-        list->bytes += cl_node_size(&node);
-        char *end = cl_getEndOfList(list);
-        end[0] = (char) CL_END;
-    } else {
-        char *start = cl_elementAt(list, idx);
-        char *end = cl_getEndOfList(list);
-        ele = start;
-        memcpy(start + cl_node_size(&node), start, end - start + 1);
-        list->bytes += cl_node_size(&node);
+    //checkpoint the new entry once the walk around it grows too long
+    uint32_t prevIdx = pos > 0 ? offsets->checkpoints[pos - 1].idx : 0;
+    uint32_t nextIdx = pos < offsets->count ? offsets->checkpoints[pos].idx : list->size;
+    if (pos == 0 || nextIdx - prevIdx > offsets->stride) {
+        cl_offsets_insert(offsets, pos, (uint32_t) idx, offset);
     }
-    list->size++;
+    cl_offsets_snapshot(list, offsets);
+}
 
-    //insert node
-    ele[0] = node.encoding;
-    ele++;
-    if (node.sizeofLen > 0) {
-        memcpy(ele, node.len, node.sizeofLen);
-        ele += node.sizeofLen;
+//the entry of entrySize bytes at idx was removed
+static void cl_offsets_onRemove(CompactList *list, CompactListOffsets *offsets, int64_t idx, uint32_t entrySize) {
+    if (offsets == NULL) {
+        return;
+    }
+    if (!offsets->valid || offsets->generation + 1 != list->generation) {
+        offsets->valid = 0;
+        return;
+    }
+    uint32_t pos = cl_offsets_lowerBound(offsets, idx);
+    uint32_t c = pos;
+    //a checkpoint on the removed entry now points at its successor
+    if (c < offsets->count && offsets->checkpoints[c].idx == idx) {
+        c++;
+    }
+    for (; c < offsets->count; c++) {
+        offsets->checkpoints[c].idx--;
+        offsets->checkpoints[c].offset -= entrySize;
+    }
+    if (pos < offsets->count && offsets->checkpoints[pos].idx == idx) {
+        int last = idx == list->size;
+        int duplicate = pos + 1 < offsets->count && offsets->checkpoints[pos + 1].idx == idx;
+        if ((last || duplicate) && pos > 0) {
+            cl_offsets_delete(offsets, pos);
+        } else if (duplicate) {
+            cl_offsets_delete(offsets, pos + 1);
+        } else if (last) {
+            offsets->count = 0;
+        }
     }
+    cl_offsets_snapshot(list, offsets);
+}
 
-    if (node.sizeofData > 0) {
-        memcpy(ele, node.data, node.sizeofData);
+/*
+ * The entries in [at, end) were rewritten into delta more bytes,
+ * holding the same elements. fresh tells if the index matched the
+ * list before. Checkpoints inside them are dropped, later ones move.
+ */
+static void cl_offsets_onRewrite(CompactList *list, CompactListOffsets *offsets, int fresh,
+                                 uint64_t at, uint64_t end, int64_t delta) {
+    if (offsets == NULL) {
+        return;
+    }
+    if (!fresh) {
+        offsets->valid = 0;
+        return;
     }
-    ele += node.sizeofData;
+    uint32_t kept = 0;
+    for (uint32_t c = 0; c < offsets->count; c++) {
+        CompactListCheckpoint cp = offsets->checkpoints[c];
+        if (cp.offset > at && cp.offset < end) {
+            continue;
+        }
+        if (cp.offset >= end) {
+            cp.offset += delta;
+        }
+        offsets->checkpoints[kept++] = cp;
+    }
+    offsets->count = kept;
+    cl_offsets_snapshot(list, offsets);
+}
 
-    memcpy(ele, node.total, (size_t) node.sizeofTotal);
-    if (node.type == CL_TYPE_INT) free(node.data);
-    return list;
+int64_t CompactListValueAt(CompactList *list, CompactListOffsets *offsets, int64_t idx,
+                           int64_t *intVal, char **strVal) {
+    if (idx < 0 || idx >= list->size) {
+        panic("CompactList index out of range: %ld\n", idx);
+    }
+    uint32_t pos;
+    char *ele = cl_seek(list, offsets, idx, &pos);
+    return cl_elementValue(ele, pos, intVal, strVal);
 }
 
+static inline CompactListNode *cl_node_init(CompactListNode *node) {
+    node->data = NULL;
+    node->sizeofData = 0;
+    node->sizeofLen = 0;
+    node->sizeofTotal = 0;
+    return node;
+}
 
-#define COMPACT_LIST_TEST
-#ifdef COMPACT_LIST_TEST
+static inline uint32_t cl_node_size(CompactListNode *node) {
+    return CL_ENC_BYTES + node->sizeofLen + node->sizeofData + node->sizeofTotal;
+}
 
-int main() {
-    CompactList *list = CompactListNew();
+//encode data into node the way it will be stored
+static void cl_node_build(CompactListNode *node, char *data, size_t dataLen) {
+    int64_t val;
+    cl_node_init(node);
+    node->sizeofData = (uint32_t) dataLen;
+    node->data = data;
 
-    char *strVal;
-    int64_t intVal, ret;
-    int rmRet;
+    if (string2int(data, dataLen, &val) == 1) {
+        node->type = CL_TYPE_INT;
+        cl_intNode_setEncodingAndData(node, val);
+    } else {
+        node->type = CL_TYPE_STR;
+        cl_strNode_setEncoding(node);
+    }
+    cl_node_setTotal(node);
+}
 
-    list = CompactListInsert(list, "hello", 5, 0);
-    ret = cl_valueAt(list, 0, &intVal, &strVal);
-    assert(ret == 5);
-    assert(strncmp(strVal, "hello", (size_t) ret) == 0);
+//write node at ele, return the byte after it
+static char *cl_node_write(CompactListNode *node, char *ele) {
+    ele[0] = node->encoding;
+    ele++;
+    if (node->sizeofLen > 0) {
+        memcpy(ele, node->len, node->sizeofLen);
+        ele += node->sizeofLen;
+    }
 
+    if (node->sizeofData > 0) {
+        memcpy(ele, node->data, node->sizeofData);
+    }
+    ele += node->sizeofData;
 
-    list = CompactListInsert(list, "world", 5, 0);
-    ret = cl_valueAt(list, 0, &intVal, &strVal);
-    assert(ret >= 0);
-    assert(strncmp(strVal, "world", (size_t) ret) == 0);
+    memcpy(ele, node->total, (size_t) node->sizeofTotal);
+    return ele + node->sizeofTotal;
+}
 
-    list = CompactListInsert(list, "12345", 5, 1);
-    ret = cl_valueAt(list, 1, &intVal, &strVal);
-    assert(ret == -1);
-    assert(intVal == 12345);
+static uint32_t cl_intEntrySize(int64_t val) {
+    uint8_t bytes;
+    cl_intEncoding(val, &bytes);
+    return CL_ENC_BYTES + bytes + cl_totalBytes(CL_ENC_BYTES + bytes);
+}
+
+/*
+ * Write n integers at ele, in runs of up to CL_RUN_MAX wherever a
+ * run is smaller than plain entries. A NULL ele only counts.
+ * Return the bytes written.
+ */
+static uint64_t cl_writeInts(char *ele, const int64_t *vals, uint32_t n) {
+    uint64_t bytes = 0;
+    while (n > 0) {
+        uint32_t take = n < CL_RUN_MAX ? n : CL_RUN_MAX, runBytes = 0, plainBytes = 0;
+        uint8_t width = 0;
+        int64_t step = 0;
+        //wide deltas overflow the length byte, try fewer values
+        while (take >= CL_RUN_MIN && (runBytes = cl_runSize(vals, take, &width, &step)) == 0) {
+            take /= 2;
+        }
+        for (uint32_t i = 0; i < take; i++) {
+            plainBytes += cl_intEntrySize(vals[i]);
+        }
+
+        if (take >= CL_RUN_MIN && runBytes < plainBytes) {
+            if (ele) cl_runWrite(ele + bytes, vals, take, width, step);
+            bytes += runBytes;
+        } else if (ele) {
+            for (uint32_t i = 0; i < take; i++) {
+                CompactListNode node;
+                cl_node_init(&node);
+                node.type = CL_TYPE_INT;
+                cl_intNode_setEncodingAndData(&node, vals[i]);
+                cl_node_setTotal(&node);
+                cl_node_write(&node, ele + bytes);
+                bytes += cl_node_size(&node);
+            }
+        } else {
+            bytes += plainBytes;
+        }
+        vals += take;
+        n -= take;
+    }
+    return bytes;
+}
+
+/*
+ * Replace the oldBytes of entries at offset at with the newBytes in
+ * buf, which hold the same elements. The rest of the list moves.
+ */
+static CompactList *cl_rewrite(CompactList *list, CompactListOffsets *offsets, uint64_t at,
+                               uint64_t oldBytes, const char *buf, uint64_t newBytes) {
+    int fresh = offsets && cl_offsets_isFresh(list, offsets);
+    uint64_t bytes = list->bytes, rest = bytes - at - oldBytes; //end byte included
+    if (newBytes > oldBytes) {
+        STATS_ADD(STATS_CL_REALLOCS, 1);
+        STATS_ADD(STATS_CL_REALLOC_BYTES, bytes - oldBytes + newBytes);
+        if ((list = mem_realloc(list, bytes, bytes - oldBytes + newBytes)) == NULL) {
+            panic("CompactList rewrite: realloc failed\n");
+        }
+    }
+    memmove((char *) list + at + newBytes, (char *) list + at + oldBytes, rest);
+    STATS_ADD(STATS_CL_MOVED_BYTES, rest);
+    memcpy((char *) list + at, buf, newBytes);
+    list->bytes = bytes - oldBytes + newBytes;
+    cl_changed(list);
+    if (newBytes < oldBytes) {
+        STATS_ADD(STATS_CL_REALLOCS, 1);
+        STATS_ADD(STATS_CL_REALLOC_BYTES, list->bytes);
+        if ((list = mem_realloc(list, bytes, list->bytes)) == NULL) {
+            panic("CompactList rewrite: realloc failed\n");
+        }
+    }
+    cl_offsets_onRewrite(list, offsets, fresh, at, at + oldBytes, (int64_t) newBytes - (int64_t) oldBytes);
+    return list;
+}
+
+/*
+ * Cut the run at offset at before each of the ncuts ascending
+ * positions in cuts. A piece may take more bytes than its share of
+ * the run, so the list can grow.
+ */
+static CompactList *cl_cutRun(CompactList *list, CompactListOffsets *offsets, uint64_t at,
+                              const uint32_t *cuts, int ncuts) {
+    int64_t vals[UINT8_MAX];
+    char buf[UINT8_MAX * CL_INT_ENTRY_MAX];
+    char *ele = (char *) list + at;
+    uint32_t count = cl_runValues(ele, vals), from = 0;
+    uint64_t bytes = 0;
+    for (int c = 0; c <= ncuts; c++) {
+        uint32_t to = c < ncuts ? cuts[c] : count;
+        bytes += cl_writeInts(buf + bytes, vals + from, to - from);
+        from = to;
+    }
+    return cl_rewrite(list, offsets, at, cl_getEntrySize(ele), buf, bytes);
+}
+
+/*
+ * Cut the run holding element idx so idx starts an entry, at is the
+ * offset of that entry, of the end byte when idx is the size.
+ */
+static CompactList *cl_splitRunAt(CompactList *list, CompactListOffsets *offsets, int64_t idx, uint64_t *at) {
+    if (idx == list->size) {
+        *at = list->bytes - CL_END_BYTES;
+        return list;
+    }
+    uint32_t pos;
+    char *ele = cl_seek(list, offsets, idx, &pos);
+    *at = (uint64_t) (ele - (char *) list);
+    if (pos == 0) {
+        return list;
+    }
+    list = cl_cutRun(list, offsets, *at, &pos, 1);
+    //skip the pieces ahead of idx
+    ele = (char *) list + *at;
+    for (uint32_t skipped = 0; skipped < pos; ele += cl_getEntrySize(ele)) {
+        skipped += cl_entryCount(ele);
+    }
+    *at = (uint64_t) (ele - (char *) list);
+    return list;
+}
+
+//cut the run holding element idx around it, tar is then its own plain entry
+static CompactList *cl_isolate(CompactList *list, CompactListOffsets *offsets, int64_t idx, char **tar) {
+    uint32_t pos;
+    char *ele = cl_seek(list, offsets, idx, &pos);
+    if (cl_isRunEntry(ele)) {
+        uint32_t cuts[2];
+        int ncuts = 0;
+        if (pos > 0) cuts[ncuts++] = pos;
+        if (pos + 1 < cl_entryCount(ele)) cuts[ncuts++] = pos + 1;
+        list = cl_cutRun(list, offsets, (uint64_t) (ele - (char *) list), cuts, ncuts);
+        ele = cl_seek(list, offsets, idx, &pos);
+    }
+    *tar = ele;
+    return list;
+}
+
+//integers in the entries in [from, to)
+static uint64_t cl_countInts(char *from, char *to) {
+    uint64_t ints = 0;
+    for (char *ele = from; ele < to; ele += cl_getEntrySize(ele)) {
+        if (!cl_isStrEntry(ele)) ints += cl_entryCount(ele);
+    }
+    return ints;
+}
+
+/*
+ * Write the entries in [from, to) to buf with their integers packed
+ * into runs where that is smaller, return the bytes written. Strings
+ * are copied as they are and end a stretch of integers. vals holds
+ * every integer, buf the entries plain and ints more bytes.
+ */
+static uint64_t cl_packEntries(char *from, char *to, int64_t *vals, char *buf) {
+    uint64_t bytes = 0;
+    uint32_t n = 0;
+    for (char *ele = from; ele < to; ele += cl_getEntrySize(ele)) {
+        if (cl_isRunEntry(ele)) {
+            n += cl_runValues(ele, vals + n);
+        } else if (cl_isIntEntry(ele)) {
+            cl_entryValue(ele, vals + n++, NULL);
+        } else {
+            bytes += cl_writeInts(buf + bytes, vals, n);
+            n = 0;
+            memcpy(buf + bytes, ele, cl_getEntrySize(ele));
+            bytes += cl_getEntrySize(ele);
+        }
+    }
+    return bytes + cl_writeInts(buf + bytes, vals, n);
+}
+
+//pack the integers of the entries in [at, end) into runs where that is smaller
+static CompactList *cl_pack(CompactList *list, CompactListOffsets *offsets, uint64_t at, uint64_t end) {
+    uint64_t ints = cl_countInts((char *) list + at, (char *) list + end);
+    if (ints < CL_RUN_MIN) {
+        return list;
+    }
+    //a stretch is never written larger than plain entries
+    int64_t *vals;
+    char *buf;
+    if ((vals = malloc(ints * sizeof(int64_t))) == NULL
+        || (buf = malloc(end - at + ints * CL_INT_ENTRY_MAX)) == NULL) {
+        panic("CompactList pack: malloc failed\n");
+    }
+    uint64_t bytes = cl_packEntries((char *) list + at, (char *) list + end, vals, buf);
+
+    if (bytes != end - at || memcmp(buf, (char *) list + at, bytes) != 0) {
+        list = cl_rewrite(list, offsets, at, end - at, buf, bytes);
+    }
+    free(vals);
+    free(buf);
+    return list;
+}
+
+//once an append ends the list in a block of plain integers, pack them
+static CompactList *cl_packTail(CompactList *list, CompactListOffsets *offsets) {
+    if (list->size % CL_RUN_BLOCK != 0) {
+        return list;
+    }
+    char *ele = cl_getEndOfList(list);
+    for (int64_t idx = list->size; idx > list->size - CL_RUN_BLOCK; idx--) {
+        ele = cl_prevElement(ele, idx);
+        if (!cl_isIntEntry(ele)) {
+            return list;
+        }
+    }
+    return cl_pack(list, offsets, (uint64_t) (ele - (char *) list), list->bytes - CL_END_BYTES);
+}
+
+CompactList *CompactListPackRuns(CompactList *list) {
+    return cl_pack(list, NULL, cl_headerBytes(), list->bytes - CL_END_BYTES);
+}
+
+void CompactListCursorInit(CompactListCursor *cursor, CompactList *list, int direction) {
+    cursor->list = list;
+    cursor->direction = direction;
+    if (direction == CL_CURSOR_REVERSE) {
+        //prevElement of the end byte is the last entry
+        cursor->entry = cl_getEndOfList(list);
+        cursor->idx = list->size;
+    } else {
+        cursor->entry = NULL;
+        cursor->idx = -1;
+    }
+    cursor->runPos = 0;
+    cursor->runVal = 0;
+}
+
+int CompactListCursorNext(CompactListCursor *cursor, CompactListValue *value) {
+    CompactList *list = cursor->list;
+    //inside a run the value moves by one delta, a run entered is decoded once
+    if (cursor->direction == CL_CURSOR_REVERSE) {
+        if (cursor->idx <= 0) return 0;
+        if (cursor->runPos > 0) {
+            cursor->runVal = cl_runPrev(&cursor->run, cursor->runVal, cursor->runPos--);
+        } else {
+            cursor->entry = cl_prevElement(cursor->entry, cursor->idx);
+            if (cl_isRunEntry(cursor->entry)) {
+                cl_runDecode(cursor->entry, &cursor->run);
+                cursor->runPos = cursor->run.count - 1;
+                cursor->runVal = cl_runValueAt(&cursor->run, cursor->runPos);
+            }
+        }
+        cursor->idx--;
+    } else {
+        if (cursor->idx + 1 >= list->size) return 0;
+        if (cursor->idx >= 0 && cl_isRunEntry(cursor->entry) && cursor->runPos + 1 < cursor->run.count) {
+            cursor->runVal = cl_runNext(&cursor->run, cursor->runVal, cursor->runPos++);
+        } else {
+            cursor->entry = cursor->idx < 0 ? cl_firstElement(list) : cl_nextElement(cursor->entry);
+            cursor->runPos = 0;
+            if (cl_isRunEntry(cursor->entry)) {
+                cl_runDecode(cursor->entry, &cursor->run);
+                cursor->runVal = cursor->run.base;
+            }
+        }
+        cursor->idx++;
+    }
+
+    if (value && cl_isRunEntry(cursor->entry)) {
+        value->type = CL_TYPE_INT;
+        value->intVal = cursor->runVal;
+        value->strVal = NULL;
+        value->len = 0;
+    } else if (value) {
+        int64_t len = cl_entryValue(cursor->entry, &value->intVal, &value->strVal);
+        if (len == -1) {
+            value->type = CL_TYPE_INT;
+            value->strVal = NULL;
+            value->len = 0;
+        } else {
+            value->type = CL_TYPE_STR;
+            value->len = (uint32_t) len;
+        }
+    }
+    return 1;
+}
+
+//remove the plain entry tar at idx
+static CompactList *cl_deleteEntry(CompactList *list, CompactListOffsets *offsets, char *tar, int64_t idx) {
+    assert(!cl_isRunEntry(tar));
+    //shift left
+    uint32_t entrySize = cl_getEntrySize(tar);
+    int64_t cpyLen = cl_getEndOfList(list) - (tar + entrySize) + 1;
+    memmove(tar, tar + entrySize, (size_t)cpyLen);
+    STATS_ADD(STATS_CL_MOVED_BYTES, cpyLen);
+    STATS_ADD(STATS_CL_REALLOCS, 1);
+    STATS_ADD(STATS_CL_REALLOC_BYTES, list->bytes - entrySize);
+
+    list->bytes -= entrySize;
+    list->size--;
+    cl_changed(list);
+    if((list = mem_realloc(list, list->bytes + entrySize, list->bytes)) == NULL){
+        panic("CompactList remove: realloc failed\n");
+    }
+    cl_offsets_onRemove(list, offsets, idx, entrySize);
+    return list;
+}
+
+/**
+ * A value encoded the way an entry holding it starts, so entries
+ * match by bytes alone: head is the encoding byte and length field
+ * or integer data, data the string bytes following it.
+ */
+typedef struct {
+    char head[CL_ENC_BYTES + 8];
+    uint32_t headLen;
+    char *data;
+    uint32_t dataLen;
+    int isInt; //int runs are searched by value
+    int64_t intVal;
+} CompactListNeedle;
+
+static void cl_needle_int(CompactListNeedle *needle, int64_t val) {
+    uint8_t bytes;
+    needle->isInt = 1;
+    needle->intVal = val;
+    needle->head[0] = (char) cl_intEncoding(val, &bytes);
+    if (bytes > 0) {
+        int_setValueByType(needle->head + CL_ENC_BYTES, val, bytes);
+    }
+    needle->headLen = CL_ENC_BYTES + bytes;
+    needle->data = needle->head; //nothing follows, memcmp still wants a valid pointer
+    needle->dataLen = 0;
+}
+
+static void cl_needle_str(CompactListNeedle *needle, char *str, size_t len) {
+    uint8_t sizeofLen;
+    needle->isInt = 0;
+    needle->head[0] = (char) cl_strEncoding((uint32_t) len, &sizeofLen);
+    if (sizeofLen > 0) {
+        cl_setStrLen(needle->head + CL_ENC_BYTES, (uint32_t) len, sizeofLen);
+    }
+    needle->headLen = CL_ENC_BYTES + sizeofLen;
+    needle->data = str;
+    needle->dataLen = (uint32_t) len;
+}
+
+//classify data the way insert stores it
+static void cl_needle_init(CompactListNeedle *needle, char *data, size_t len) {
+    int64_t val;
+    if (string2int(data, len, &val) == 1) {
+        cl_needle_int(needle, val);
+    } else {
+        cl_needle_str(needle, data, len);
+    }
+}
+
+//first entry holding the needle and its index, NULL if there is none
+static char *cl_find(CompactList *list, CompactListNeedle *needle, int64_t *idx) {
+    char *ele = (char *) list + cl_headerBytes();
+    uint64_t walked = 0; //entries, a run counts once
+    for (uint32_t i = 0; i < list->size; i++, walked++) {
+        if (cl_isRunEntry(ele)) {
+            CompactListRun run;
+            cl_runDecode(ele, &run);
+            int64_t val = run.base;
+            for (uint32_t k = 0; needle->isInt && k < run.count; k++) {
+                if (val == needle->intVal) {
+                    STATS_ADD(STATS_CL_WALKED, walked);
+                    *idx = i + k;
+                    return ele;
+                }
+                if (k + 1 < run.count) val = cl_runNext(&run, val, k);
+            }
+            i += run.count - 1;
+        } else if (ele[0] == needle->head[0]
+            && memcmp(ele + 1, needle->head + 1, needle->headLen - 1) == 0
+            && memcmp(ele + needle->headLen, needle->data, needle->dataLen) == 0) {
+            STATS_ADD(STATS_CL_WALKED, walked);
+            *idx = i;
+            return ele;
+        }
+        ele += cl_getEntrySize(ele);
+    }
+    STATS_ADD(STATS_CL_WALKED, walked);
+    return NULL;
+}
+
+static int64_t cl_findIndex(CompactList *list, CompactListNeedle *needle) {
+    int64_t idx;
+    return cl_find(list, needle, &idx) ? idx : -1;
+}
+
+int64_t CompactListFindInt(CompactList *list, int64_t val) {
+    STATS_LATENCY(STATS_CALL_CL_FIND);
+    CompactListNeedle needle;
+    cl_needle_int(&needle, val);
+    return cl_findIndex(list, &needle);
+}
+
+int64_t CompactListFindStr(CompactList *list, char *str, size_t len) {
+    STATS_LATENCY(STATS_CALL_CL_FIND);
+    CompactListNeedle needle;
+    cl_needle_init(&needle, str, len);
+    return cl_findIndex(list, &needle);
+}
+
+int64_t CompactListIndexOf(CompactList *list, char *data, size_t len){
+    return CompactListFindStr(list, data, len);
+}
+
+CompactList *CompactListRemoveWithOffsets(CompactList *list, CompactListOffsets *offsets,
+                                          char *data, size_t len, int *ret) {
+    STATS_LATENCY(STATS_CALL_CL_REMOVE);
+    CompactListNeedle needle;
+    int64_t idx;
+    char *tar;
+    cl_needle_init(&needle, data, len);
+    if ((tar = cl_find(list, &needle, &idx)) == NULL) {
+        if(ret) *ret = 0;
+        return list;
+    }
+
+    if(ret) *ret = 1;
+    if (cl_isRunEntry(tar)) {
+        list = cl_isolate(list, offsets, idx, &tar);
+    }
+    return cl_deleteEntry(list, offsets, tar, idx);
+}
+
+CompactList *CompactListRemove(CompactList *list, char *data, size_t len, int *ret) {
+    return CompactListRemoveWithOffsets(list, NULL, data, len, ret);
+}
+
+CompactList *CompactListRemoveAt(CompactList *list, int64_t idx) {
+    STATS_LATENCY(STATS_CALL_CL_REMOVE_AT);
+    if (idx < 0 || idx >= list->size) {
+        panic("CompactList index out of range: %ld\n", idx);
+    }
+    char *tar;
+    list = cl_isolate(list, NULL, idx, &tar);
+    return cl_deleteEntry(list, NULL, tar, idx);
+}
+
+//resolve negative indexes and clamp, return 0 for an empty range
+static int cl_normalizeRange(CompactList *list, int64_t *start, int64_t *stop) {
+    int64_t size = list->size;
+    if (*start < 0) *start += size;
+    if (*stop < 0) *stop += size;
+    if (*start < 0) *start = 0;
+    if (*stop >= size) *stop = size - 1;
+    return *start <= *stop;
+}
+
+/*
+ * Bytes of the entries holding elements start to stop, first is the
+ * one holding start. Runs across the edges hold before elements
+ * ahead of start and after elements past stop.
+ */
+static uint64_t cl_rangeBytes(CompactList *list, int64_t start, int64_t stop, char **first,
+                              uint32_t *before, uint32_t *after) {
+    char *ele = *first = cl_seek(list, NULL, start, before);
+    *after = 0;
+    if (stop == list->size - 1) {
+        return (uint64_t) (cl_getEndOfList(list) - ele);
+    }
+    int64_t i = start - *before; //first element of ele
+    while (i + cl_entryCount(ele) <= stop) {
+        i += cl_entryCount(ele);
+        ele += cl_getEntrySize(ele);
+    }
+    *after = (uint32_t) (i + cl_entryCount(ele) - 1 - stop);
+    ele += cl_getEntrySize(ele);
+    return (uint64_t) (ele - *first);
+}
+
+CompactList *CompactListDeleteRange(CompactList *list, int64_t start, int64_t stop) {
+    if (!cl_normalizeRange(list, &start, &stop)) {
+        return list;
+    }
+    //cut runs across the edges, the range then covers whole entries
+    uint64_t at, end, oldBytes;
+    list = cl_splitRunAt(list, NULL, stop + 1, &end);
+    oldBytes = list->bytes;
+    list = cl_splitRunAt(list, NULL, start, &at);
+    end += list->bytes - oldBytes;
+    char *first = (char *) list + at;
+    uint64_t bytes = end - at;
+    memmove(first, first + bytes, (size_t) (cl_getEndOfList(list) - (first + bytes) + 1));
+    STATS_ADD(STATS_CL_MOVED_BYTES, cl_getEndOfList(list) - (first + bytes) + 1);
+    STATS_ADD(STATS_CL_REALLOCS, 1);
+    STATS_ADD(STATS_CL_REALLOC_BYTES, list->bytes - bytes);
+
+    list->bytes -= bytes;
+    list->size -= (uint32_t) (stop - start + 1);
+    cl_changed(list);
+    if ((list = mem_realloc(list, list->bytes + bytes, list->bytes)) == NULL) {
+        panic("CompactList delete range: realloc failed\n");
+    }
+    return list;
+}
+
+CompactList *CompactListGetRange(CompactList *list, int64_t start, int64_t stop) {
+    if (!cl_normalizeRange(list, &start, &stop)) {
+        return CompactListNew();
+    }
+    char *first;
+    uint32_t before, after;
+    uint64_t bytes = cl_rangeBytes(list, start, stop, &first, &before, &after);
+    CompactList *range;
+    if ((range = mem_malloc(cl_sizeofEmptyList() + bytes)) == NULL) {
+        panic("CompactList get range: malloc failed\n");
+    }
+    range->bytes = cl_sizeofEmptyList() + bytes;
+    range->size = (uint32_t) (stop - start + 1) + before + after;
+    range->generation = 0;
+    memcpy((char *) range + cl_headerBytes(), first, bytes);
+    *cl_getEndOfList(range) = (char) CL_END;
+    //runs across the edges came whole, drop what they hold outside the range
+    if (after > 0) {
+        range = CompactListDeleteRange(range, -(int64_t) after, -1);
+    }
+    if (before > 0) {
+        range = CompactListDeleteRange(range, 0, before - 1);
+    }
+    return range;
+}
+
+CompactList *CompactListSplit(CompactList *list, int64_t idx, CompactList **tail) {
+    if (idx < 0 || idx > list->size) {
+        panic("CompactList split index out of range: %ld\n", idx);
+    }
+    //entries hold no absolute offsets, so they move as plain bytes
+    uint64_t at;
+    list = cl_splitRunAt(list, NULL, idx, &at);
+    uint64_t moved = list->bytes - CL_END_BYTES - at;
+    CompactList *rest;
+    if ((rest = mem_malloc(cl_sizeofEmptyList() + moved)) == NULL) {
+        panic("CompactList split: malloc failed\n");
+    }
+    rest->bytes = cl_sizeofEmptyList() + moved;
+    rest->size = list->size - (uint32_t) idx;
+    rest->generation = 0;
+    memcpy((char *) rest + cl_headerBytes(), (char *) list + at, moved);
+    *cl_getEndOfList(rest) = (char) CL_END;
+
+    uint64_t oldBytes = list->bytes;
+    ((char *) list)[at] = (char) CL_END;
+    list->bytes = at + CL_END_BYTES;
+    list->size = (uint32_t) idx;
+    cl_changed(list);
+    if ((list = mem_realloc(list, oldBytes, list->bytes)) == NULL) {
+        panic("CompactList split: realloc failed\n");
+    }
+    *tail = rest;
+    return list;
+}
+
+CompactList *CompactListMerge(CompactList *list, CompactList *other) {
+    if (other->size > UINT32_MAX - list->size) {
+        panic("CompactList list is full\n");
+    }
+    uint64_t moved = other->bytes - cl_sizeofEmptyList();
+    uint64_t at = list->bytes - CL_END_BYTES;
+    if ((list = mem_realloc(list, list->bytes, list->bytes + moved)) == NULL) {
+        panic("CompactList merge: realloc failed\n");
+    }
+    memcpy((char *) list + at, (char *) other + cl_headerBytes(), moved);
+    list->bytes += moved;
+    list->size += other->size;
+    cl_changed(list);
+    *cl_getEndOfList(list) = (char) CL_END;
+    CompactListFree(other);
+    return list;
+}
+
+CompactList *CompactListInsert(CompactList *list, char *data, size_t dataLen, int64_t idx) {
+    return CompactListInsertWithOffsets(list, NULL, data, dataLen, idx);
+}
+
+int CompactListSave(CompactList *list, const char *path) {
+    return blob_save(path, BLOB_TYPE_COMPACT_LIST, list, list->bytes, NULL, 0);
+}
+
+static CompactList *cl_view(const void *addr, size_t len, int verify) {
+    uint64_t bytes;
+    CompactList *list = (CompactList *) blob_view(addr, len, BLOB_TYPE_COMPACT_LIST, verify, &bytes);
+    if (list == NULL || bytes < cl_sizeofEmptyList() || list->bytes != bytes
+        || !cl_isEndOfList(cl_getEndOfList(list))) {
+        return NULL;
+    }
+    return list;
+}
+
+CompactList *CompactListViewFromMmap(const void *addr, size_t len, int verify) {
+    return cl_view(addr, len, verify);
+}
+
+CompactListCompressed *CompactListCompress(CompactList *list) {
+    STATS_LATENCY(STATS_CALL_CL_COMPRESS);
+    uint64_t entryBytes = list->bytes - cl_headerBytes();
+    uint64_t limit = entryBytes - list->bytes / CL_COMPRESS_MIN_SAVING;
+    if (list->bytes > UINT32_MAX || limit == 0 || limit > entryBytes) {
+        STATS_ADD(STATS_CL_COMPRESS_SKIPPED, 1);
+        return NULL;
+    }
+    CompactListCompressed *compressed;
+    if ((compressed = mem_malloc(sizeof(*compressed) + limit)) == NULL) {
+        panic("CompactList compress: malloc failed\n");
+    }
+    uint32_t packed = lzf_compress((char *) list + cl_headerBytes(), (uint32_t) entryBytes,
+                                   compressed->data, (uint32_t) limit);
+    if (packed == 0) {
+        mem_free(compressed, sizeof(*compressed) + limit);
+        STATS_ADD(STATS_CL_COMPRESS_SKIPPED, 1);
+        return NULL;
+    }
+    compressed = mem_realloc(compressed, sizeof(*compressed) + limit, sizeof(*compressed) + packed);
+    if (compressed == NULL) {
+        panic("CompactList compress: realloc failed\n");
+    }
+    compressed->bytes = list->bytes;
+    compressed->size = list->size;
+    compressed->generation = list->generation;
+    compressed->packedBytes = packed;
+    STATS_ADD(STATS_CL_COMPRESSED, 1);
+    STATS_ADD(STATS_CL_COMPRESS_IN_BYTES, list->bytes);
+    STATS_ADD(STATS_CL_COMPRESS_OUT_BYTES, sizeof(*compressed) + packed);
+    return compressed;
+}
+
+CompactList *CompactListDecompress(CompactListCompressed *compressed) {
+    STATS_LATENCY(STATS_CALL_CL_DECOMPRESS);
+    CompactList *list;
+    if ((list = mem_malloc(compressed->bytes)) == NULL) {
+        panic("CompactList decompress: malloc failed\n");
+    }
+    uint64_t entryBytes = compressed->bytes - cl_headerBytes();
+    if (lzf_decompress(compressed->data, compressed->packedBytes, (char *) list + cl_headerBytes(),
+                       (uint32_t) entryBytes) != entryBytes) {
+        panic("CompactList decompress: damaged data\n");
+    }
+    list->bytes = compressed->bytes;
+    list->size = compressed->size;
+    list->generation = compressed->generation;
+    STATS_ADD(STATS_CL_DECOMPRESSED, 1);
+    STATS_ADD(STATS_CL_DECOMPRESS_BYTES, list->bytes);
+    return list;
+}
+
+inline uint64_t CompactListCompressedBytes(CompactListCompressed *compressed) {
+    return sizeof(*compressed) + compressed->packedBytes;
+}
+
+void CompactListCompressedFree(CompactListCompressed *compressed) {
+    mem_free(compressed, CompactListCompressedBytes(compressed));
+}
+
+static int cl_memEncoding(unsigned char enc) {
+    switch (enc >> 4) {
+        case CL_STR4 >> 4:
+            return CL_MEM_STR4;
+        case CL_STR8 >> 4:
+            return CL_MEM_STR8;
+        case CL_STR16 >> 4:
+            return CL_MEM_STR16;
+        case CL_STR32 >> 4:
+            return CL_MEM_STR32;
+        case CL_INT4 >> 4:
+            return CL_MEM_INT4;
+        case CL_INT8 >> 4:
+            return CL_MEM_INT8;
+        case CL_INT16 >> 4:
+            return CL_MEM_INT16;
+        case CL_INT32 >> 4:
+            return enc == CL_INT64 ? CL_MEM_INT64 : CL_MEM_INT32;
+        case CL_INTRUN >> 4:
+            return CL_MEM_INTRUN;
+        default:
+            panic("CompactList memory usage: unknown entry encoding 0x%x\n", enc);
+    }
+}
+
+void CompactListMemoryUsage(CompactList *list, CompactListMemory *usage) {
+    memset(usage, 0, sizeof(*usage));
+    usage->logicalBytes = list->bytes;
+    usage->usableBytes = mem_usableSize(list, list->bytes);
+    usage->headerBytes = cl_sizeofEmptyList();
+
+    char *ele = (char *) list + cl_headerBytes();
+    for (uint32_t i = 0; i < list->size; i += cl_entryCount(ele), ele += cl_getEntrySize(ele)) {
+        uint32_t entrySize = cl_getEntrySize(ele), dataSize = cl_getDataSize(ele);
+        int enc = cl_memEncoding((unsigned char) ele[0]);
+        if (enc == CL_MEM_INTRUN) usage->runElements += cl_entryCount(ele);
+        usage->entries[enc]++;
+        usage->entryBytes[enc] += entrySize;
+        usage->dataBytes += dataSize;
+        usage->overheadBytes += entrySize - dataSize;
+    }
+}
+
+CompactList *CompactListLoad(const char *path) {
+    size_t len;
+    const void *addr = BlobFileMap(path, &len);
+    CompactList *view = cl_view(addr, len, 1), *list = NULL;
+    if (view) {
+        if ((list = mem_malloc(view->bytes)) == NULL) {
+            panic("CompactList load: malloc failed\n");
+        }
+        memcpy(list, view, view->bytes);
+    }
+    if (addr) BlobFileUnmap(addr, len);
+    return list;
+}
+
+/*
+ * Make room for bytes at idx, found through offsets. Return the
+ * list, and the offset of the room in at.
+ */
+static CompactList *cl_openGap(CompactList *list, CompactListOffsets *offsets, int64_t idx,
+                               uint64_t bytes, uint64_t *at) {
+    //find the slot before realloc moves the list, a run there is cut first
+    list = cl_splitRunAt(list, offsets, idx, at);
+
+    //resize
+    STATS_ADD(STATS_CL_REALLOCS, 1);
+    STATS_ADD(STATS_CL_REALLOC_BYTES, list->bytes);
+    if ((list = mem_realloc(list, list->bytes, list->bytes + bytes)) == NULL) {
+        panic("CompactList realloc failed\n");
+    }
+
+    //shift right, the end byte included
+    char *ele = (char *) list + *at;
+    char *end = cl_getEndOfList(list);
+    memmove(ele + bytes, ele, end - ele + 1);
+    STATS_ADD(STATS_CL_MOVED_BYTES, end - ele + 1);
+    list->bytes += bytes;
+    cl_changed(list);
+    return list;
+}
+
+uint32_t CompactListEntrySize(char *data, size_t dataLen) {
+    CompactListNode node;
+    cl_node_build(&node, data, dataLen);
+    return cl_node_size(&node);
+}
+
+CompactList *CompactListInsertWithOffsets(CompactList *list, CompactListOffsets *offsets,
+                                          char *data, size_t dataLen, int64_t idx) {
+    STATS_LATENCY(STATS_CALL_CL_INSERT);
+    if (list->size == UINT32_MAX) {
+        panic("CompactList list is full\n");
+    } else if (idx > list->size) {
+        panic("index too big, max index is list size\n");
+    }
+    CompactListNode node;
+    cl_node_build(&node, data, dataLen);
+
+    uint64_t at;
+    list = cl_openGap(list, offsets, idx, cl_node_size(&node), &at);
+    list->size++;
+    cl_offsets_onInsert(list, offsets, idx, at, cl_node_size(&node));
+
+    cl_node_write(&node, (char *) list + at);
+    if (node.type == CL_TYPE_INT && idx == list->size - 1) {
+        list = cl_packTail(list, offsets);
+    }
+    return list;
+}
+
+CompactList *CompactListInsertMany(CompactList *list, const CompactListEntry *entries, uint32_t n, int64_t idx) {
+    STATS_LATENCY(STATS_CALL_CL_INSERT_MANY);
+    if (n > UINT32_MAX - list->size) {
+        panic("CompactList list is full\n");
+    } else if (idx > list->size) {
+        panic("index too big, max index is list size\n");
+    } else if (n == 0) {
+        return list;
+    }
+
+    //encode and pack everything first to know the room needed
+    CompactListNode *nodes;
+    if ((nodes = malloc(n * sizeof(*nodes))) == NULL) {
+        panic("CompactList insert many: malloc failed\n");
+    }
+    uint64_t bytes = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        cl_node_build(nodes + i, entries[i].data, entries[i].len);
+        bytes += cl_node_size(nodes + i);
+    }
+    char *batch;
+    if ((batch = malloc(bytes)) == NULL) {
+        panic("CompactList insert many: malloc failed\n");
+    }
+    char *ele = batch;
+    for (uint32_t i = 0; i < n; i++) {
+        ele = cl_node_write(nodes + i, ele);
+    }
+    free(nodes);
+    uint64_t ints = cl_countInts(batch, batch + bytes);
+    if (ints >= CL_RUN_MIN) {
+        int64_t *vals;
+        char *packed;
+        if ((vals = malloc(ints * sizeof(int64_t))) == NULL
+            || (packed = malloc(bytes + ints * CL_INT_ENTRY_MAX)) == NULL) {
+            panic("CompactList insert many: malloc failed\n");
+        }
+        bytes = cl_packEntries(batch, batch + bytes, vals, packed);
+        free(vals);
+        free(batch);
+        batch = packed;
+    }
+
+    uint64_t at;
+    list = cl_openGap(list, NULL, idx, bytes, &at);
+    list->size += n;
+    memcpy((char *) list + at, batch, bytes);
+    free(batch);
+    return list;
+}
+
+
+//#define COMPACT_LIST_TEST
+#ifdef COMPACT_LIST_TEST
+
+//every way of reading a list of integers sees expect
+static void cl_checkInts(CompactList *list, CompactListOffsets *offsets, const int64_t *expect, int64_t n) {
+    CompactListCursor cursor;
+    CompactListValue value;
+    int64_t intVal;
+    assert(CompactListSize(list) == n);
+    CompactListCursorInit(&cursor, list, CL_CURSOR_FORWARD);
+    for (int64_t i = 0; i < n; i++) {
+        assert(CompactListCursorNext(&cursor, &value) && cursor.idx == i);
+        assert(value.type == CL_TYPE_INT && value.intVal == expect[i]);
+    }
+    assert(!CompactListCursorNext(&cursor, &value));
+    CompactListCursorInit(&cursor, list, CL_CURSOR_REVERSE);
+    for (int64_t i = n - 1; i >= 0; i--) {
+        assert(CompactListCursorNext(&cursor, &value) && value.intVal == expect[i]);
+    }
+    assert(!CompactListCursorNext(&cursor, &value));
+    for (int64_t i = 0; i < n; i += 1 + i % 7) {
+        assert(CompactListValueAt(list, offsets, i, &intVal, NULL) == -1 && intVal == expect[i]);
+        assert(CompactListValueAt(list, NULL, i, &intVal, NULL) == -1 && intVal == expect[i]);
+    }
+}
+
+int main() {
+    CompactList *list = CompactListNew();
+
+    char *strVal;
+    int64_t intVal, ret;
+    int rmRet;
+
+    list = CompactListInsert(list, "hello", 5, 0);
+    ret = cl_valueAt(list, 0, &intVal, &strVal);
+    assert(ret == 5);
+    assert(strncmp(strVal, "hello", (size_t) ret) == 0);
+
+
+    list = CompactListInsert(list, "world", 5, 0);
+    ret = cl_valueAt(list, 0, &intVal, &strVal);
+    assert(ret >= 0);
+    assert(strncmp(strVal, "world", (size_t) ret) == 0);
+
+    list = CompactListInsert(list, "12345", 5, 1);
+    ret = cl_valueAt(list, 1, &intVal, &strVal);
+    assert(ret == -1);
+    assert(intVal == 12345);
 
     list = CompactListInsert(list, "9223372036854775807", 19, 2);
     ret = cl_valueAt(list, 2, &intVal, &strVal);
@@ -509,12 +1772,391 @@ int main() {
     assert(strncmp(strVal, str, strlen(str)) == 0);
 
 
+#ifdef COMPACT_LIST_DEBUG
     show_bytes(list);
+#endif
     list = CompactListRemove(list, "12345", 5, &rmRet);
     assert(rmRet == 1);
+#ifdef COMPACT_LIST_DEBUG
     show_bytes(list);
+#endif
 
     CompactListFree(list);
+
+    //seek through the offset index while it is patched and rebuilt
+    char buf[32];
+    int64_t expect[3000];
+    int n = 0, len;
+    CompactListOffsets *offsets = CompactListOffsetsNew(8);
+    list = CompactListNew();
+    for (int i = 0; i < 3000; i++) {
+        int64_t idx = i % 3 == 0 ? n : (i * 7) % (n + 1);
+        len = sprintf(buf, i % 2 ? "%d" : "s%d", i);
+        list = CompactListInsertWithOffsets(list, offsets, buf, (size_t) len, idx);
+        memmove(expect + idx + 1, expect + idx, (n - idx) * sizeof(int64_t));
+        expect[idx] = i;
+        n++;
+        if (i % 500 == 0) {
+            //changed behind the index, noticed and rebuilt
+            list = CompactListInsert(list, "x", 1, n);
+            list = CompactListRemove(list, "x", 1, &rmRet);
+        }
+        if (i % 5 == 4) {
+            int victim = (i * 13) % n;
+            len = sprintf(buf, expect[victim] % 2 ? "%ld" : "s%ld", expect[victim]);
+            list = CompactListRemoveWithOffsets(list, offsets, buf, (size_t) len, &rmRet);
+            assert(rmRet == 1);
+            memmove(expect + victim, expect + victim + 1, (n - victim - 1) * sizeof(int64_t));
+            n--;
+        }
+    }
+    assert(CompactListSize(list) == n);
+    for (int i = 0; i < n; i++) {
+        int64_t idx = (i * 7919) % n;
+        ret = CompactListValueAt(list, offsets, idx, &intVal, &strVal);
+        if (expect[idx] % 2) {
+            assert(ret == -1 && intVal == expect[idx]);
+        } else {
+            int len = sprintf(buf, "s%ld", expect[idx]);
+            assert(ret == len && strncmp(strVal, buf, (size_t) len) == 0);
+        }
+        assert(CompactListValueAt(list, NULL, idx, &intVal, &strVal) == ret);
+    }
+    CompactListOffsetsFree(offsets);
+    CompactListFree(list);
+
+    //a change behind the index that keeps bytes and size is noticed too
+    offsets = CompactListOffsetsNew(4);
+    list = CompactListNew();
+    for (int i = 0; i < 40; i++) {
+        len = sprintf(buf, "s%03d", i);
+        list = CompactListInsert(list, buf, (size_t) len, i);
+    }
+    list = CompactListInsert(list, "zzzzzzzzzzz", 11, 40);
+    CompactListValueAt(list, offsets, 39, &intVal, &strVal);
+    uint64_t bytesBefore = list->bytes;
+    list = CompactListInsert(list, "abcdefghijk", 11, 0);
+    list = CompactListRemove(list, "zzzzzzzzzzz", 11, &rmRet);
+    assert(rmRet == 1 && list->bytes == bytesBefore && CompactListSize(list) == 41);
+    for (int i = 0; i < 40; i++) {
+        len = sprintf(buf, "s%03d", i);
+        ret = CompactListValueAt(list, offsets, i + 1, &intVal, &strVal);
+        assert(ret == len && strncmp(strVal, buf, (size_t) len) == 0);
+    }
+    CompactListOffsetsFree(offsets);
+    CompactListFree(list);
+
+    //walk both ways, with every string length encoding and negative ints
+    size_t lens[] = {3, 200, 1000, 70000};
+    char *big = malloc(70000);
+    memset(big, 'b', 70000);
+    list = CompactListNew();
+    for (int i = 0; i < 4; i++) {
+        list = CompactListInsert(list, big, lens[i], CompactListSize(list));
+        len = sprintf(buf, "%d", -1000 * i - 7);
+        list = CompactListInsert(list, buf, (size_t) len, CompactListSize(list));
+    }
+    CompactListCursor cursor;
+    CompactListValue value;
+    CompactListCursorInit(&cursor, list, CL_CURSOR_FORWARD);
+    for (int i = 0; i < 8; i++) {
+        assert(CompactListCursorNext(&cursor, &value) && cursor.idx == i);
+        if (i % 2) {
+            assert(value.type == CL_TYPE_INT && value.intVal == -1000 * (i / 2) - 7);
+        } else {
+            assert(value.type == CL_TYPE_STR && value.len == lens[i / 2]);
+            assert(memcmp(value.strVal, big, value.len) == 0);
+        }
+    }
+    assert(!CompactListCursorNext(&cursor, &value));
+    CompactListCursorInit(&cursor, list, CL_CURSOR_REVERSE);
+    for (int i = 7; i >= 0; i--) {
+        assert(CompactListCursorNext(&cursor, &value) && cursor.idx == i);
+        assert(value.type == (i % 2 ? CL_TYPE_INT : CL_TYPE_STR));
+    }
+    assert(!CompactListCursorNext(&cursor, NULL));
+    assert(CompactListIndexOf(list, big, 1000) == 4);
+    assert(CompactListIndexOf(list, "-3007", 5) == 7);
+    list = CompactListRemove(list, big, 200, &rmRet);
+    assert(rmRet == 1 && CompactListIndexOf(list, big, 1000) == 3);
+    free(big);
+    CompactListFree(list);
+
+    //typed lookups on a mixed list, equal values of other widths and types must not match
+    list = CompactListNew();
+    int64_t ints[] = {3, -3, 200, -200, 70000, INT64_MIN};
+    for (int i = 0; i < 6; i++) {
+        len = sprintf(buf, "%ld", ints[i]);
+        list = CompactListInsert(list, "pad", 3, CompactListSize(list));
+        list = CompactListInsert(list, buf, (size_t) len, CompactListSize(list));
+    }
+    list = CompactListInsert(list, "70000x", 6, CompactListSize(list));
+    for (int i = 0; i < 6; i++) {
+        assert(CompactListFindInt(list, ints[i]) == 2 * i + 1);
+        len = sprintf(buf, "%ld", ints[i]);
+        assert(CompactListFindStr(list, buf, (size_t) len) == 2 * i + 1);
+    }
+    assert(CompactListFindInt(list, 4) == -1 && CompactListFindInt(list, 70001) == -1);
+    assert(CompactListFindStr(list, "pad", 3) == 0);
+    assert(CompactListFindStr(list, "70000x", 6) == 12);
+    assert(CompactListFindStr(list, "70000y", 6) == -1);
+    assert(CompactListFindStr(list, "pa", 2) == -1);
+    CompactListFree(list);
+
+    //a batch lays out the same bytes as inserting one by one
+    char words[300][16];
+    CompactListEntry entries[300];
+    CompactList *one = CompactListNew();
+    list = CompactListNew();
+    list = CompactListInsert(list, "head", 4, 0);
+    list = CompactListInsert(list, "tail", 4, 1);
+    one = CompactListInsert(one, "head", 4, 0);
+    for (int i = 0; i < 300; i++) {
+        len = sprintf(words[i], i % 3 ? "%d" : "w%d", (i - 150) * 997);
+        entries[i].data = words[i];
+        entries[i].len = (size_t) len;
+        one = CompactListInsert(one, words[i], (size_t) len, i + 1);
+    }
+    one = CompactListInsert(one, "tail", 4, 301);
+    list = CompactListInsertMany(list, entries, 300, 1);
+    list = CompactListInsertMany(list, entries, 0, 0);
+    //generations differ, the layout past the header doesn't
+    assert(list->bytes == one->bytes && list->size == one->size);
+    assert(memcmp((char *) list + sizeof(CompactList), (char *) one + sizeof(CompactList),
+                  one->bytes - sizeof(CompactList)) == 0);
+    assert(CompactListFindStr(list, "tail", 4) == 301);
+    CompactListFree(one);
+    CompactListFree(list);
+
+    //request scoped lists in an arena, dropped at once
+    Allocator *arena = AllocatorArenaNew(0);
+    AllocatorUse(arena);
+    for (int round = 0; round < 3; round++) {
+        list = CompactListNew();
+        list = CompactListInsertMany(list, entries, 300, 0);
+        for (int i = 0; i < 300; i += 3) {
+            list = CompactListRemove(list, words[i], entries[i].len, &rmRet);
+            assert(rmRet == 1);
+        }
+        assert(CompactListSize(list) == 200 && CompactListFindStr(list, words[299], entries[299].len) == 199);
+        AllocatorArenaReset(arena);
+    }
+    assert(AllocatorGetStats(arena).bytesInUse == 0);
+    AllocatorUse(NULL);
+    AllocatorFree(arena);
+
+    //ranges match the entries they came from, as seen through a cursor
+    list = CompactListInsertMany(CompactListNew(), entries, 300, 0);
+    CompactList *range = CompactListGetRange(list, -100, -51);
+    assert(CompactListSize(range) == 50);
+    CompactListCursorInit(&cursor, range, CL_CURSOR_REVERSE);
+    for (int i = 249; i >= 200; i--) {
+        assert(CompactListCursorNext(&cursor, NULL));
+        assert(CompactListIndexOf(range, words[i], entries[i].len) == i - 200);
+    }
+    CompactListFree(range);
+    range = CompactListGetRange(list, 10, 5);
+    assert(CompactListSize(range) == 0 && range->bytes == sizeof(CompactList) + CL_END_BYTES);
+    CompactListFree(range);
+
+    list = CompactListDeleteRange(list, 100, -101);
+    assert(CompactListSize(list) == 200);
+    assert(CompactListIndexOf(list, words[99], entries[99].len) == 99);
+    assert(CompactListIndexOf(list, words[200], entries[200].len) == 100);
+    assert(CompactListIndexOf(list, words[150], entries[150].len) == -1);
+    list = CompactListDeleteRange(list, -50, 1000);
+    assert(CompactListSize(list) == 150 && CompactListIndexOf(list, words[249], entries[249].len) == 149);
+    CompactListCursorInit(&cursor, list, CL_CURSOR_REVERSE);
+    for (int i = 0; i < 150; i++) assert(CompactListCursorNext(&cursor, &value));
+    list = CompactListDeleteRange(list, 0, -1);
+    assert(CompactListSize(list) == 0 && list->bytes == sizeof(CompactList) + CL_END_BYTES);
+    CompactListFree(list);
+
+    //saved, loaded and mapped back
+    const char *path = "/tmp/compact_list_test.bin";
+    list = CompactListInsertMany(CompactListNew(), entries, 300, 0);
+    assert(CompactListSave(list, path));
+    CompactList *loaded = CompactListLoad(path);
+    assert(loaded && loaded->bytes == list->bytes && memcmp(loaded, list, list->bytes) == 0);
+    loaded = CompactListInsert(loaded, "more", 4, 0);
+    CompactListFree(loaded);
+    size_t mapped;
+    const void *addr = BlobFileMap(path, &mapped);
+    CompactList *view = CompactListViewFromMmap(addr, mapped, 1);
+    assert(view && CompactListFindStr(view, words[123], entries[123].len) == 123);
+    CompactListCursorInit(&cursor, view, CL_CURSOR_REVERSE);
+    for (int i = 299; CompactListCursorNext(&cursor, &value); i--) {
+        assert(cursor.idx == i);
+    }
+    assert(CompactListViewFromMmap(addr, mapped - 1, 0) == NULL);
+    BlobFileUnmap(addr, mapped);
+    CompactListFree(list);
+    remove(path);
+    assert(CompactListLoad(path) == NULL);
+
+    //entries and bytes per encoding
+    CompactListMemory usage;
+    char *mix[] = {"7", "-100", "1000", "100000", "10000000000", "short", "a string over 15 bytes"};
+    list = CompactListNew();
+    for (int i = 0; i < 7; i++) {
+        list = CompactListInsert(list, mix[i], strlen(mix[i]), i);
+    }
+    list = CompactListInsert(list, "7", 1, 0);
+    CompactListMemoryUsage(list, &usage);
+    assert(usage.logicalBytes == list->bytes && usage.usableBytes >= list->bytes);
+    assert(usage.entries[CL_MEM_INT4] == 2 && usage.entryBytes[CL_MEM_INT4] == 4);
+    assert(usage.entries[CL_MEM_INT8] == 1 && usage.entries[CL_MEM_INT16] == 1);
+    assert(usage.entries[CL_MEM_INT32] == 1 && usage.entries[CL_MEM_INT64] == 1);
+    assert(usage.entries[CL_MEM_STR4] == 1 && usage.entries[CL_MEM_STR8] == 1);
+    assert(usage.entries[CL_MEM_STR16] == 0 && usage.entries[CL_MEM_STR32] == 0);
+    assert(usage.dataBytes == 1 + 2 + 4 + 8 + 5 + 22);
+    assert(usage.headerBytes + usage.dataBytes + usage.overheadBytes == list->bytes);
+    CompactListFree(list);
+
+    //appended counters and timestamps are packed into runs a block at a time
+    int64_t *seq = malloc(8192 * sizeof(int64_t));
+    uint64_t plainBytes = 0;
+    list = CompactListNew();
+    for (n = 0; n < 2048; n++) {
+        seq[n] = n < 1024 ? 1000000 + n : 1700000000000 + (n - 1024) * 1000 + (n * 7919) % 1000;
+        len = sprintf(buf, "%ld", seq[n]);
+        plainBytes += CompactListEntrySize(buf, (size_t) len);
+        list = CompactListInsert(list, buf, (size_t) len, n);
+    }
+    CompactListMemoryUsage(list, &usage);
+    assert(usage.runElements == 2048 && usage.entries[CL_MEM_INTRUN] == 2048 / CL_RUN_BLOCK);
+    assert(usage.headerBytes + usage.dataBytes + usage.overheadBytes == list->bytes);
+    assert(plainBytes >= 5 * (list->bytes - usage.headerBytes));
+    cl_checkInts(list, NULL, seq, n);
+    for (int i = 0; i < n; i += 37) {
+        len = sprintf(buf, "%ld", seq[i]);
+        assert(CompactListIndexOf(list, buf, (size_t) len) == i && CompactListFindInt(list, seq[i]) == i);
+    }
+    assert(CompactListFindInt(list, 999999) == -1 && CompactListIndexOf(list, "01000005", 8) == -1);
+
+    //a run is cut where it is changed, and packed again on request
+    offsets = CompactListOffsetsNew(16);
+    for (int i = 0; i < 3000; i++) {
+        int64_t idx = (i * 7919) % (n + 1);
+        if (i % 2 == 0) {
+            len = sprintf(buf, "%ld", idx > 0 ? seq[idx - 1] + 1 : -5);
+            list = CompactListInsertWithOffsets(list, offsets, buf, (size_t) len, idx);
+            memmove(seq + idx + 1, seq + idx, (n - idx) * sizeof(int64_t));
+            seq[idx] = idx > 0 ? seq[idx - 1] + 1 : -5;
+            n++;
+        } else if (idx < n) {
+            if (i % 4 == 1) {
+                list = CompactListRemoveAt(list, idx);
+            } else {
+                len = sprintf(buf, "%ld", seq[idx]);
+                int64_t first = CompactListFindInt(list, seq[idx]);
+                list = CompactListRemoveWithOffsets(list, offsets, buf, (size_t) len, &rmRet);
+                assert(rmRet == 1);
+                idx = first;
+            }
+            memmove(seq + idx, seq + idx + 1, (n - idx - 1) * sizeof(int64_t));
+            n--;
+        }
+        if (i % 1000 == 999) {
+            cl_checkInts(list, offsets, seq, n);
+            uint64_t before = list->bytes;
+            list = CompactListPackRuns(list);
+            assert(list->bytes <= before);
+            cl_checkInts(list, offsets, seq, n);
+        }
+    }
+
+    //ranges and splits through the middle of runs
+    range = CompactListGetRange(list, 45, 1000);
+    cl_checkInts(range, NULL, seq + 45, 956);
+    CompactListFree(range);
+    range = CompactListGetRange(list, 3, 5);
+    cl_checkInts(range, NULL, seq + 3, 3);
+    CompactListFree(range);
+    CompactList *rest;
+    list = CompactListSplit(list, 1001, &rest);
+    cl_checkInts(list, NULL, seq, 1001);
+    cl_checkInts(rest, NULL, seq + 1001, n - 1001);
+    list = CompactListMerge(list, rest);
+    list = CompactListDeleteRange(list, 70, 1490);
+    memmove(seq + 70, seq + 1491, (n - 1491) * sizeof(int64_t));
+    n -= 1421;
+    cl_checkInts(list, offsets, seq, n);
+
+    //saved and loaded with its runs
+    assert(CompactListSave(list, path));
+    loaded = CompactListLoad(path);
+    assert(loaded && loaded->bytes == list->bytes && memcmp(loaded, list, list->bytes) == 0);
+    CompactListFree(loaded);
+    remove(path);
+    CompactListOffsetsFree(offsets);
+    CompactListFree(list);
+
+    //a batch is packed too: wrapping deltas, 64 bit deltas and strings between
+    char texts[600][24];
+    for (n = 0; n < 600; n++) {
+        if (n < 200) seq[n] = n % 2 ? INT64_MAX : INT64_MIN;
+        else if (n < 400) seq[n] = (int64_t) ((uint64_t) n * 0x9E3779B97F4A7C15ULL);
+        else seq[n] = n * 3;
+        entries[n % 300].data = texts[n];
+        entries[n % 300].len = (size_t) sprintf(texts[n], "%ld", seq[n]);
+        if (n % 300 == 299 && n < 300) {
+            list = CompactListInsertMany(CompactListNew(), entries, 300, 0);
+        } else if (n % 300 == 299) {
+            uint64_t reallocs = AllocatorGetStats(AllocatorDefault()).reallocs;
+            list = CompactListInsertMany(list, entries, 300, 300);
+            assert(AllocatorGetStats(AllocatorDefault()).reallocs == reallocs + 1);
+        }
+    }
+    cl_checkInts(list, NULL, seq, n);
+    CompactListMemoryUsage(list, &usage);
+    assert(usage.runElements >= 400 && usage.entries[CL_MEM_INTRUN] > 0);
+    list = CompactListInsertMany(list, (CompactListEntry[]) {{"str", 3}, {"12", 2}}, 2, 250);
+    assert(CompactListFindStr(list, "str", 3) == 250 && CompactListFindInt(list, 12) == 251);
+    assert(CompactListFindInt(list, 412 * 3) == 414);
+    if (StatsEnabled()) {
+        //a miss steps over every entry, a run counts once
+        StatsSnapshot before, after;
+        uint64_t entryCount = 0;
+        CompactListMemoryUsage(list, &usage);
+        for (int i = 0; i < CL_MEM_ENCODINGS; i++) entryCount += usage.entries[i];
+        StatsGet(&before);
+        assert(CompactListFindStr(list, "absent", 6) == -1);
+        StatsGet(&after);
+        assert(after.counters[STATS_CL_WALKED] - before.counters[STATS_CL_WALKED] == entryCount);
+        assert(entryCount < (uint64_t) CompactListSize(list));
+    }
+    CompactListFree(list);
+
+    //compressed copies expand to the same bytes, random ones aren't kept
+    list = CompactListNew();
+    for (int i = 0; i < 2000; i++) {
+        char word[32];
+        int len = sprintf(word, "user:%d:name", i % 50);
+        list = CompactListInsert(list, word, (size_t) len, i);
+    }
+    CompactListCompressed *compressed = CompactListCompress(list);
+    assert(compressed && compressed->size == 2000 && compressed->bytes == list->bytes);
+    assert(CompactListCompressedBytes(compressed) < list->bytes / 4);
+    CompactList *expanded = CompactListDecompress(compressed);
+    assert(expanded->bytes == list->bytes && memcmp(expanded, list, list->bytes) == 0);
+    assert(CompactListFindStr(expanded, "user:49:name", 12) == 49);
+    expanded = CompactListInsert(expanded, "more", 4, 0);
+    CompactListFree(expanded);
+    CompactListCompressedFree(compressed);
+    CompactListFree(list);
+    list = CompactListNew();
+    for (int i = 0; i < 500; i++) {
+        char word[8];
+        for (int j = 0; j < 8; j++) word[j] = (char) ('a' + rand() % 26);
+        list = CompactListInsert(list, word, 8, i);
+    }
+    assert(CompactListCompress(list) == NULL);
+    CompactListFree(list);
+    list = CompactListNew();
+    assert(CompactListCompress(list) == NULL);
+    CompactListFree(list);
+    free(seq);
     return 0;
 }
 
@@ -8,12 +8,13 @@
 /**
  * Compact list.
  *
- * [cl-bytes] [size] [entry] ... [entry] [cl-end]
+ * [cl-bytes] [size] [generation] [entry] ... [entry] [cl-end]
  * entry: [encoding & data-len] [data] [entry-bytes]
  */
 typedef struct __attribute__((__packed__)){
     uint64_t bytes; //bytes used of the list and entries
     uint32_t size; //element count
+    uint32_t generation; //bumped by every change, see CompactListOffsets
 } CompactList;
 
 #define CL_ENC_BYTES 1
@@ -33,6 +34,8 @@ typedef struct __attribute__((__packed__)){
 #define CL_STR16 0x20
 #define CL_STR32 0x34
 
+#define CL_TYPE_RUN 2
+#define CL_INTRUN 0x80
 
 /**
  * Encoding:
@@ -50,6 +53,14 @@ typedef struct __attribute__((__packed__)){
  * [01 0 00100] [data] * 4 int32
  * [01 0 01000] [data] * 8 int64
  *
+ * [10 000000] [len] [count] [width] [base] [step] [deltas] int run
+ *
+ * An int run holds count integers in one entry: base is the first,
+ * every next one adds step plus a delta of width bits. base and
+ * step are zigzag varints, deltas are packed from the low bit of
+ * the first byte on, len is the bytes from count to the last delta.
+ * Runs are still count elements to every call taking an index.
+ *
  * total: this pattern is used for prevElement(),
  * we calculate entry size directly when calling next()
  *
@@ -70,6 +81,243 @@ CompactList *CompactListInsert(CompactList *list, char *data, size_t dataLen, in
 
 CompactList *CompactListRemove(CompactList *list, char *data, size_t len, int *ret);
 
+/**
+ * Remove the entry at idx.
+ */
+CompactList *CompactListRemoveAt(CompactList *list, int64_t idx);
+
+/**
+ * Ranges are inclusive, a negative index counts from the end, -1
+ * being the last entry. Out of range indexes are clamped and a
+ * range with start after stop is empty.
+ *
+ * DeleteRange seeks start once, walks to stop, then shifts the
+ * tail and resizes once. GetRange copies the entries into a new
+ * list as they are.
+ */
+CompactList *CompactListDeleteRange(CompactList *list, int64_t start, int64_t stop);
+CompactList *CompactListGetRange(CompactList *list, int64_t start, int64_t stop);
+
+/**
+ * Move the entries from idx on into a new list stored in tail.
+ */
+CompactList *CompactListSplit(CompactList *list, int64_t idx, CompactList **tail);
+
+/**
+ * Append the entries of other and free it.
+ */
+CompactList *CompactListMerge(CompactList *list, CompactList *other);
+
+/**
+ * Pack stretches of integers into int runs where that is smaller.
+ * Appends pack the tail on their own, a block of integers at a
+ * time, and InsertMany packs its batch. Inserting or removing
+ * inside a run cuts it, this packs such a list again.
+ */
+CompactList *CompactListPackRuns(CompactList *list);
+
+/**
+ * Bytes an entry holding data would take.
+ */
+uint32_t CompactListEntrySize(char *data, size_t dataLen);
+
+typedef struct {
+    char *data;
+    size_t len;
+} CompactListEntry;
+
+/**
+ * Write the list to a file, see blob_file.h. Return 1 on success.
+ */
+int CompactListSave(CompactList *list, const char *path);
+
+/**
+ * Read a saved list into memory, NULL if the file is missing,
+ * damaged or of another kind.
+ */
+CompactList *CompactListLoad(const char *path);
+
+/**
+ * List inside a mapped file (BlobFileMap), used in place without
+ * copying. Only pass it to calls that read, it lives in read only
+ * memory and must not be freed. NULL if the region doesn't hold a
+ * list, the checksum is only checked when verify is set.
+ */
+CompactList *CompactListViewFromMmap(const void *addr, size_t len, int verify);
+
+/**
+ * A list compressed with lzf, see lzf.h, for lists that are kept
+ * but rarely read. The header is left uncompressed, so the size
+ * can be read without expanding.
+ */
+typedef struct __attribute__((__packed__)) {
+    uint64_t bytes; //of the expanded list
+    uint32_t size; //element count
+    uint32_t generation; //of the list, kept so an index stays valid across
+    uint32_t packedBytes; //compressed entries in data
+    unsigned char data[];
+} CompactListCompressed;
+
+//smallest share of its bytes compressing must save to be kept, 1/8
+#define CL_COMPRESS_MIN_SAVING 8
+
+/**
+ * Compress the entries of a list, return NULL if that doesn't save
+ * at least 1/CL_COMPRESS_MIN_SAVING of its bytes. The list is left
+ * alone either way.
+ */
+CompactListCompressed *CompactListCompress(CompactList *list);
+
+/**
+ * Expand into a new list, the compressed copy is left alone.
+ */
+CompactList *CompactListDecompress(CompactListCompressed *compressed);
+void CompactListCompressedFree(CompactListCompressed *compressed);
+uint64_t CompactListCompressedBytes(CompactListCompressed *compressed);
+
+//entry encodings, as indexes of CompactListMemory
+#define CL_MEM_INT4 0
+#define CL_MEM_INT8 1
+#define CL_MEM_INT16 2
+#define CL_MEM_INT32 3
+#define CL_MEM_INT64 4
+#define CL_MEM_STR4 5
+#define CL_MEM_STR8 6
+#define CL_MEM_STR16 7
+#define CL_MEM_STR32 8
+#define CL_MEM_INTRUN 9
+#define CL_MEM_ENCODINGS 10
+
+/**
+ * Memory held by a list, entries and bytes per encoding come from a
+ * walk over the entries. Overhead is what entries spend besides
+ * their data: encoding byte, length field and backlink.
+ */
+typedef struct {
+    uint64_t logicalBytes; //same as list->bytes
+    uint64_t usableBytes; //what the allocator really handed out
+    uint64_t headerBytes; //list header and end byte
+    uint64_t overheadBytes;
+    uint64_t dataBytes;
+    uint32_t entries[CL_MEM_ENCODINGS];
+    uint64_t entryBytes[CL_MEM_ENCODINGS];
+    uint32_t runElements; //integers held by int runs
+} CompactListMemory;
+
+/**
+ * Call under the allocator the list was made with, not on a view.
+ */
+void CompactListMemoryUsage(CompactList *list, CompactListMemory *usage);
+
+/**
+ * Insert n entries in order before idx. The list is resized and
+ * its tail shifted once for the whole batch.
+ */
+CompactList *CompactListInsertMany(CompactList *list, const CompactListEntry *entries, uint32_t n, int64_t idx);
+
 int64_t CompactListIndexOf(CompactList *list, char *data, size_t len);
 
+/**
+ * Index of the first entry equal to the value, -1 if there is none.
+ * The needle is encoded once and entries are compared by their
+ * encoded bytes, other types and sizes are skipped by encoding.
+ * FindStr treats a string holding an integer as that integer,
+ * the same way insert stores it.
+ */
+int64_t CompactListFindInt(CompactList *list, int64_t val);
+int64_t CompactListFindStr(CompactList *list, char *str, size_t len);
+
+/**
+ * Cursor over the entries, declared on the stack:
+ *
+ * CompactListCursor cursor;
+ * CompactListValue value;
+ * CompactListCursorInit(&cursor, list, CL_CURSOR_FORWARD);
+ * while (CompactListCursorNext(&cursor, &value)) { ... }
+ *
+ * Each step moves one element, so a full walk is linear. Strings
+ * point into the list and are not copied, they are valid until
+ * the list is changed.
+ */
+#define CL_CURSOR_FORWARD 0
+#define CL_CURSOR_REVERSE 1
+
+/**
+ * Decoded header of an int run entry.
+ */
+typedef struct {
+    uint32_t count;
+    uint8_t width;
+    int64_t base;
+    int64_t step;
+    const unsigned char *deltas;
+} CompactListRun;
+
+typedef struct {
+    int type; //CL_TYPE_INT or CL_TYPE_STR
+    int64_t intVal;
+    char *strVal; //not NUL terminated
+    uint32_t len; //string length
+} CompactListValue;
+
+typedef struct {
+    CompactList *list;
+    char *entry; //entry last returned
+    int64_t idx; //index of the element, -1 or size before the first step
+    int direction;
+    uint32_t runPos; //position inside entry when it is an int run
+    int64_t runVal; //value at runPos
+    CompactListRun run; //header of that run
+} CompactListCursor;
+
+void CompactListCursorInit(CompactListCursor *cursor, CompactList *list, int direction);
+
+/**
+ * Move to the next entry and decode it into value, which may be
+ * NULL. Return 0 once the cursor walked past the last entry.
+ */
+int CompactListCursorNext(CompactListCursor *cursor, CompactListValue *value);
+
+/**
+ * Sparse offset index, kept beside a list to seek entries in
+ * O(log n) instead of walking from an end.
+ *
+ * It holds the byte offset of an entry roughly every stride elements.
+ * The *WithOffsets calls patch it as they insert and remove.
+ * Any other change to the list bumps its generation, the index
+ * sees it differ from the one recorded here on the next lookup
+ * and is rebuilt lazily then.
+ */
+typedef struct {
+    uint32_t idx; //index of the first element of the entry
+    uint64_t offset; //entry offset from the list start
+} CompactListCheckpoint;
+
+typedef struct {
+    uint32_t stride;
+    int valid;
+    uint32_t generation; //list generation when last updated
+    uint32_t count;
+    uint32_t capacity;
+    CompactListCheckpoint *checkpoints;
+} CompactListOffsets;
+
+#define CL_OFFSETS_DEFAULT_STRIDE 32
+
+CompactListOffsets *CompactListOffsetsNew(uint32_t stride);
+void CompactListOffsetsFree(CompactListOffsets *offsets);
+
+/**
+ * Read the entry at idx, offsets may be NULL.
+ * Return -1 for an integer, stored in intVal, otherwise
+ * the string length with strVal pointing at its bytes.
+ */
+int64_t CompactListValueAt(CompactList *list, CompactListOffsets *offsets, int64_t idx,
+                           int64_t *intVal, char **strVal);
+
+CompactList *CompactListInsertWithOffsets(CompactList *list, CompactListOffsets *offsets,
+                                          char *data, size_t dataLen, int64_t idx);
+CompactList *CompactListRemoveWithOffsets(CompactList *list, CompactListOffsets *offsets,
+                                          char *data, size_t len, int *ret);
+
 #endif //COMPACT_LIST_H
@@ -0,0 +1,552 @@
+#include "hybrid_set.h"
+#include "panic.h"
+#include "integer.h"
+#include "allocator.h"
+#include <string.h>
+
+#define HS_BIAS 32768
+#define HS_CHUNK_VALUES 65536
+#define HS_BITMAP_BYTES (HYBRID_BITMAP_WORDS * sizeof(uint64_t))
+//a bitmap only turns back into an array well under the limit,
+//so a chunk hovering around it doesn't convert on every call
+#define HS_BITMAP_TO_ARRAY (HYBRID_ARRAY_MAX * 3 / 4)
+
+static inline int64_t hs_keyOf(int64_t val) {
+    return val >> 16;
+}
+
+static inline int64_t hs_lowOf(int64_t val) {
+    return val & 0xFFFF;
+}
+
+static inline int64_t hs_valueOf(int64_t key, int64_t low) {
+    return (int64_t) ((uint64_t) key << 16) | low;
+}
+
+static inline uint32_t hs_runCount(HybridChunk *chunk) {
+    return IntVectorSize(chunk->vector) / 2;
+}
+
+//bytes of payload each container type would take
+static uint8_t hs_bestType(uint32_t cardinality, uint32_t runs) {
+    uint64_t array = cardinality <= HYBRID_ARRAY_MAX ? (uint64_t) cardinality * INT16_BYTES : UINT64_MAX;
+    uint64_t bitmap = HS_BITMAP_BYTES;
+    uint64_t run = (uint64_t) runs * 2 * INT16_BYTES;
+
+    if (run < array && run < bitmap) {
+        return HYBRID_RUN;
+    }
+    return array <= bitmap ? HYBRID_ARRAY : HYBRID_BITMAP;
+}
+
+static uint32_t hs_countRuns(HybridChunk *chunk) {
+    uint32_t runs = 0;
+    if (chunk->type == HYBRID_RUN) {
+        return hs_runCount(chunk);
+    } else if (chunk->type == HYBRID_ARRAY) {
+        int64_t prev = INT64_MIN;
+        for (uint32_t i = 0; i < IntVectorSize(chunk->vector); i++) {
+            int64_t b = IntVectorValueAt(chunk->vector, i);
+            if (prev == INT64_MIN || b != prev + 1) runs++;
+            prev = b;
+        }
+    } else {
+        uint64_t carry = 0;
+        for (int w = 0; w < HYBRID_BITMAP_WORDS; w++) {
+            uint64_t word = chunk->bitmap[w];
+            //a run starts at every set bit whose lower neighbour is clear
+            runs += __builtin_popcountll(word & ~((word << 1) | carry));
+            carry = word >> 63;
+        }
+    }
+    return runs;
+}
+
+//biased low values of a chunk in ascending order
+static int64_t *hs_chunkValues(HybridChunk *chunk) {
+    int64_t *vals, n = 0;
+    if ((vals = malloc((chunk->cardinality + 1) * sizeof(int64_t))) == NULL) {
+        panic("HybridSet malloc failed\n");
+    }
+    if (chunk->type == HYBRID_ARRAY) {
+        for (uint32_t i = 0; i < IntVectorSize(chunk->vector); i++) {
+            vals[n++] = IntVectorValueAt(chunk->vector, i);
+        }
+    } else if (chunk->type == HYBRID_BITMAP) {
+        for (int w = 0; w < HYBRID_BITMAP_WORDS; w++) {
+            uint64_t word = chunk->bitmap[w];
+            while (word) {
+                vals[n++] = w * 64 + __builtin_ctzll(word) - HS_BIAS;
+                word &= word - 1;
+            }
+        }
+    } else {
+        for (uint32_t i = 0; i < IntVectorSize(chunk->vector); i += 2) {
+            int64_t last = IntVectorValueAt(chunk->vector, i + 1);
+            for (int64_t b = IntVectorValueAt(chunk->vector, i); b <= last; b++) {
+                vals[n++] = b;
+            }
+        }
+    }
+    return vals;
+}
+
+static void hs_freeContainer(HybridChunk *chunk) {
+    if (chunk->type == HYBRID_BITMAP) {
+        mem_free(chunk->bitmap, HS_BITMAP_BYTES);
+    } else {
+        IntVectorFree(chunk->vector);
+    }
+}
+
+static void hs_convert(HybridChunk *chunk, uint8_t type) {
+    if (chunk->type == type) {
+        return;
+    }
+    uint32_t n = chunk->cardinality;
+    int64_t *vals = hs_chunkValues(chunk);
+    hs_freeContainer(chunk);
+    chunk->type = type;
+
+    if (type == HYBRID_ARRAY) {
+        chunk->vector = IntVectorNewWithMode(INT_VECTOR_GROWABLE);
+        chunk->vector = IntVectorAppendMany(chunk->vector, vals, n);
+    } else if (type == HYBRID_BITMAP) {
+        if ((chunk->bitmap = mem_calloc(HS_BITMAP_BYTES)) == NULL) {
+            panic("HybridSet bitmap calloc failed\n");
+        }
+        for (uint32_t i = 0; i < n; i++) {
+            int64_t low = vals[i] + HS_BIAS;
+            chunk->bitmap[low >> 6] |= (uint64_t) 1 << (low & 63);
+        }
+    } else {
+        chunk->vector = IntVectorNewWithMode(INT_VECTOR_GROWABLE);
+        for (uint32_t i = 0; i < n;) {
+            uint32_t j = i;
+            while (j + 1 < n && vals[j + 1] == vals[j] + 1) j++;
+            chunk->vector = IntVectorAppend(chunk->vector, vals[i]);
+            chunk->vector = IntVectorAppend(chunk->vector, vals[j]);
+            i = j + 1;
+        }
+    }
+    free(vals);
+}
+
+//runs fall back as soon as another container is smaller
+static void hs_checkRuns(HybridChunk *chunk) {
+    uint8_t best = hs_bestType(chunk->cardinality, hs_runCount(chunk));
+    if (best != HYBRID_RUN) {
+        hs_convert(chunk, best);
+    }
+}
+
+static int hs_runContains(IntVector *runs, int64_t b) {
+    int64_t idx = IntVectorLowerBound(runs, b);
+    if (idx == IntVectorSize(runs)) {
+        return 0;
+    }
+    //odd idx: b lies after a start and not past its last
+    return (idx & 1) || IntVectorValueAt(runs, idx) == b;
+}
+
+static IntVector *hs_runAdd(IntVector *runs, int64_t b) {
+    int64_t idx = IntVectorLowerBound(runs, b), size = IntVectorSize(runs);
+    int joinPrev = idx > 0 && IntVectorValueAt(runs, idx - 1) == b - 1;
+    int joinNext = idx < size && IntVectorValueAt(runs, idx) == b + 1;
+
+    if (joinPrev && joinNext) {
+        runs = IntVectorRemoveAt(runs, idx);
+        runs = IntVectorRemoveAt(runs, idx - 1);
+    } else if (joinPrev) {
+        runs = IntVectorSetValueAt(runs, b, idx - 1);
+    } else if (joinNext) {
+        runs = IntVectorSetValueAt(runs, b, idx);
+    } else {
+        runs = IntVectorInsert(runs, b, idx);
+        runs = IntVectorInsert(runs, b, idx);
+    }
+    return runs;
+}
+
+static IntVector *hs_runRemove(IntVector *runs, int64_t b) {
+    int64_t idx = IntVectorLowerBound(runs, b);
+    if ((idx & 1) == 0) {
+        //b starts a run
+        if (IntVectorValueAt(runs, idx + 1) == b) {
+            runs = IntVectorRemoveAt(runs, idx);
+            runs = IntVectorRemoveAt(runs, idx);
+        } else {
+            runs = IntVectorSetValueAt(runs, b + 1, idx);
+        }
+    } else {
+        int64_t last = IntVectorValueAt(runs, idx);
+        runs = IntVectorSetValueAt(runs, b - 1, idx);
+        if (last != b) {
+            runs = IntVectorInsert(runs, b + 1, idx + 1);
+            runs = IntVectorInsert(runs, last, idx + 2);
+        }
+    }
+    return runs;
+}
+
+static int hs_chunkContains(HybridChunk *chunk, int64_t low) {
+    int64_t b = low - HS_BIAS;
+    switch (chunk->type) {
+        case HYBRID_ARRAY:
+            return IntVectorBinarySearch(chunk->vector, b) != -1;
+        case HYBRID_BITMAP:
+            return (int) ((chunk->bitmap[low >> 6] >> (low & 63)) & 1);
+        case HYBRID_RUN:
+            return hs_runContains(chunk->vector, b);
+        default:
+            panic("HybridSet unknown container: %d\n", chunk->type);
+    }
+}
+
+static int hs_chunkAdd(HybridChunk *chunk, int64_t low) {
+    int64_t b = low - HS_BIAS;
+    if (chunk->type == HYBRID_ARRAY) {
+        int64_t idx = IntVectorLowerBound(chunk->vector, b);
+        if (idx < IntVectorSize(chunk->vector) && IntVectorValueAt(chunk->vector, idx) == b) {
+            return 0;
+        }
+        if (chunk->cardinality < HYBRID_ARRAY_MAX) {
+            chunk->vector = IntVectorInsert(chunk->vector, b, idx);
+            chunk->cardinality++;
+            return 1;
+        }
+        //full, a dense array becomes runs, otherwise a bitmap
+        uint8_t best = hs_bestType(chunk->cardinality + 1, hs_countRuns(chunk) + 1);
+        hs_convert(chunk, best == HYBRID_RUN ? HYBRID_RUN : HYBRID_BITMAP);
+    }
+
+    if (chunk->type == HYBRID_BITMAP) {
+        uint64_t bit = (uint64_t) 1 << (low & 63);
+        if (chunk->bitmap[low >> 6] & bit) {
+            return 0;
+        }
+        chunk->bitmap[low >> 6] |= bit;
+        chunk->cardinality++;
+        return 1;
+    }
+
+    if (hs_runContains(chunk->vector, b)) {
+        return 0;
+    }
+    chunk->vector = hs_runAdd(chunk->vector, b);
+    chunk->cardinality++;
+    hs_checkRuns(chunk);
+    return 1;
+}
+
+static int hs_chunkRemove(HybridChunk *chunk, int64_t low) {
+    int64_t b = low - HS_BIAS;
+    if (chunk->type == HYBRID_ARRAY) {
+        int64_t idx = IntVectorBinarySearch(chunk->vector, b);
+        if (idx == -1) {
+            return 0;
+        }
+        chunk->vector = IntVectorRemoveAt(chunk->vector, idx);
+    } else if (chunk->type == HYBRID_BITMAP) {
+        uint64_t bit = (uint64_t) 1 << (low & 63);
+        if (!(chunk->bitmap[low >> 6] & bit)) {
+            return 0;
+        }
+        chunk->bitmap[low >> 6] &= ~bit;
+    } else {
+        if (!hs_runContains(chunk->vector, b)) {
+            return 0;
+        }
+        chunk->vector = hs_runRemove(chunk->vector, b);
+    }
+    chunk->cardinality--;
+
+    if (chunk->type == HYBRID_BITMAP && chunk->cardinality <= HS_BITMAP_TO_ARRAY) {
+        hs_convert(chunk, HYBRID_ARRAY);
+    } else if (chunk->type == HYBRID_RUN) {
+        hs_checkRuns(chunk);
+    }
+    return 1;
+}
+
+//index of the first chunk with key not less than key
+static uint32_t hs_findChunk(HybridSet *set, int64_t key) {
+    uint32_t lf = 0, len = set->count;
+    while (len > 0) {
+        uint32_t half = len / 2;
+        if (set->chunks[lf + half].key < key) {
+            lf += half + 1;
+            len -= half + 1;
+        } else {
+            len = half;
+        }
+    }
+    return lf;
+}
+
+static HybridChunk *hs_insertChunk(HybridSet *set, uint32_t idx, int64_t key) {
+    if (set->count == set->capacity) {
+        uint32_t capacity = set->capacity < 4 ? 4 : set->capacity * 2;
+        HybridChunk *chunks;
+        if ((chunks = mem_realloc(set->chunks, set->capacity * sizeof(HybridChunk),
+                                  capacity * sizeof(HybridChunk))) == NULL) {
+            panic("HybridSet realloc failed\n");
+        }
+        set->chunks = chunks;
+        set->capacity = capacity;
+    }
+    memmove(set->chunks + idx + 1, set->chunks + idx, (set->count - idx) * sizeof(HybridChunk));
+    set->count++;
+
+    HybridChunk *chunk = set->chunks + idx;
+    chunk->key = key;
+    chunk->type = HYBRID_ARRAY;
+    chunk->cardinality = 0;
+    chunk->vector = IntVectorNewWithMode(INT_VECTOR_GROWABLE);
+    return chunk;
+}
+
+static void hs_removeChunk(HybridSet *set, uint32_t idx) {
+    hs_freeContainer(set->chunks + idx);
+    memmove(set->chunks + idx, set->chunks + idx + 1, (set->count - idx - 1) * sizeof(HybridChunk));
+    set->count--;
+}
+
+HybridSet *HybridSetNew() {
+    HybridSet *set;
+    if ((set = mem_malloc(sizeof(*set))) == NULL) {
+        panic("HybridSet malloc failed\n");
+    }
+    set->size = 0;
+    set->count = 0;
+    set->capacity = 0;
+    set->chunks = NULL;
+    return set;
+}
+
+void HybridSetFree(HybridSet *set) {
+    for (uint32_t i = 0; i < set->count; i++) {
+        hs_freeContainer(set->chunks + i);
+    }
+    mem_free(set->chunks, set->capacity * sizeof(HybridChunk));
+    mem_free(set, sizeof(*set));
+}
+
+inline uint64_t HybridSetSize(HybridSet *set) {
+    return set->size;
+}
+
+inline int HybridSetIsEmpty(HybridSet *set) {
+    return set->size == 0;
+}
+
+HybridSet *HybridSetPut(HybridSet *set, int64_t val, int *ret) {
+    int64_t key = hs_keyOf(val);
+    uint32_t idx = hs_findChunk(set, key);
+    HybridChunk *chunk;
+    if (idx == set->count || set->chunks[idx].key != key) {
+        chunk = hs_insertChunk(set, idx, key);
+    } else {
+        chunk = set->chunks + idx;
+    }
+
+    int added = hs_chunkAdd(chunk, hs_lowOf(val));
+    set->size += added;
+    if (ret) *ret = added;
+    return set;
+}
+
+int HybridSetContains(HybridSet *set, int64_t val) {
+    int64_t key = hs_keyOf(val);
+    uint32_t idx = hs_findChunk(set, key);
+    if (idx == set->count || set->chunks[idx].key != key) {
+        return 0;
+    }
+    return hs_chunkContains(set->chunks + idx, hs_lowOf(val));
+}
+
+HybridSet *HybridSetRemove(HybridSet *set, int64_t val, int *ret) {
+    int64_t key = hs_keyOf(val);
+    uint32_t idx = hs_findChunk(set, key);
+    int removed = 0;
+    if (idx < set->count && set->chunks[idx].key == key) {
+        removed = hs_chunkRemove(set->chunks + idx, hs_lowOf(val));
+        if (set->chunks[idx].cardinality == 0) {
+            hs_removeChunk(set, idx);
+        }
+    }
+    set->size -= removed;
+    if (ret) *ret = removed;
+    return set;
+}
+
+HybridSet *HybridSetOptimize(HybridSet *set) {
+    for (uint32_t i = 0; i < set->count; i++) {
+        HybridChunk *chunk = set->chunks + i;
+        hs_convert(chunk, hs_bestType(chunk->cardinality, hs_countRuns(chunk)));
+        if (chunk->type != HYBRID_BITMAP) {
+            chunk->vector = IntVectorShrinkToFit(chunk->vector);
+        }
+    }
+    if (set->capacity > set->count) {
+        if (set->count == 0) {
+            mem_free(set->chunks, set->capacity * sizeof(HybridChunk));
+            set->chunks = NULL;
+        } else if ((set->chunks = mem_realloc(set->chunks, set->capacity * sizeof(HybridChunk),
+                                              set->count * sizeof(HybridChunk))) == NULL) {
+            panic("HybridSet realloc failed\n");
+        }
+        set->capacity = set->count;
+    }
+    return set;
+}
+
+//find the value after the iterator position, clear hasNext at the end
+static void hs_iterAdvance(HybridSetIterator *iter) {
+    HybridSet *set = iter->set;
+    while (iter->chunk < set->count) {
+        HybridChunk *chunk = set->chunks + iter->chunk;
+        if (chunk->type == HYBRID_ARRAY) {
+            if (iter->pos < IntVectorSize(chunk->vector)) {
+                int64_t b = IntVectorValueAt(chunk->vector, iter->pos++);
+                iter->next = hs_valueOf(chunk->key, b + HS_BIAS);
+                return;
+            }
+        } else if (chunk->type == HYBRID_BITMAP) {
+            if (iter->pos < HS_CHUNK_VALUES) {
+                int64_t w = iter->pos >> 6;
+                uint64_t word = chunk->bitmap[w] & (~(uint64_t) 0 << (iter->pos & 63));
+                while (word == 0 && ++w < HYBRID_BITMAP_WORDS) {
+                    word = chunk->bitmap[w];
+                }
+                if (word) {
+                    int64_t low = w * 64 + __builtin_ctzll(word);
+                    iter->pos = low + 1;
+                    iter->next = hs_valueOf(chunk->key, low);
+                    return;
+                }
+            }
+        } else {
+            if (iter->run < hs_runCount(chunk)) {
+                int64_t start = IntVectorValueAt(chunk->vector, 2 * iter->run) + HS_BIAS;
+                int64_t last = IntVectorValueAt(chunk->vector, 2 * iter->run + 1) + HS_BIAS;
+                if (iter->pos < start) iter->pos = start;
+                iter->next = hs_valueOf(chunk->key, iter->pos);
+                if (iter->pos++ == last) iter->run++;
+                return;
+            }
+        }
+        iter->chunk++;
+        iter->run = 0;
+        iter->pos = 0;
+    }
+    iter->hasNext = 0;
+}
+
+HybridSetIterator *HybridSetIteratorNew(HybridSet *set) {
+    HybridSetIterator *iter;
+    if ((iter = mem_malloc(sizeof(*iter))) == NULL) {
+        panic("HybridSet Iterator malloc failed\n");
+    }
+    iter->set = set;
+    iter->chunk = 0;
+    iter->run = 0;
+    iter->pos = 0;
+    iter->hasNext = 1;
+    hs_iterAdvance(iter);
+    return iter;
+}
+
+void HybridSetIteratorFree(HybridSetIterator *iter) {
+    mem_free(iter, sizeof(*iter));
+}
+
+int HybridSetIteratorHasNext(HybridSetIterator *iter) {
+    return iter->hasNext;
+}
+
+int64_t HybridSetIteratorNext(HybridSetIterator *iter) {
+    if (!iter->hasNext) {
+        panic("HybridSet iterator has no next value\n");
+    }
+    int64_t val = iter->next;
+    hs_iterAdvance(iter);
+    return val;
+}
+
+//#define HYBRID_SET_TEST
+#ifdef HYBRID_SET_TEST
+
+#include <assert.h>
+#include "int_set.h"
+
+int main() {
+    HybridSet *set = HybridSetNew();
+    IntSet *ref = IntSetNew();
+    int ret, refRet;
+
+    //sparse, dense ranges and negative keys, enough to use every container
+    uint64_t seed = 7;
+    for (int i = 0; i < 200000; i++) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        int64_t val;
+        switch (i % 4) {
+            case 0: val = (int64_t) (seed >> 40) - (1 << 23); break;
+            case 1: val = i / 4; break;
+            case 2: val = 200000 + (int64_t) (seed >> 50) * 3; break;
+            default: val = -70000 - (int64_t) (seed >> 52); break;
+        }
+        if (seed >> 62 == 0 && i % 4 != 1) {
+            set = HybridSetRemove(set, val, &ret);
+            ref = IntSetRemove(ref, val, &refRet);
+        } else {
+            set = HybridSetPut(set, val, &ret);
+            ref = IntSetPut(ref, val, &refRet);
+        }
+        assert(ret == refRet);
+    }
+    assert(HybridSetSize(set) == IntSetSize(ref));
+
+    int types[3] = {0};
+    for (uint32_t i = 0; i < set->count; i++) types[set->chunks[i].type]++;
+    assert(types[HYBRID_ARRAY] && types[HYBRID_BITMAP] && types[HYBRID_RUN]);
+
+    for (int pass = 0; pass < 2; pass++) {
+        HybridSetIterator *iter = HybridSetIteratorNew(set);
+        IntSetIterator *refIter = IntSetIteratorNew(ref);
+        while (IntSetIteratorHasNext(refIter)) {
+            assert(HybridSetIteratorHasNext(iter));
+            int64_t val = IntSetIteratorNext(refIter);
+            assert(HybridSetIteratorNext(iter) == val);
+            assert(HybridSetContains(set, val));
+            assert(!HybridSetContains(set, val + 1) == !IntSetContains(ref, val + 1));
+        }
+        assert(!HybridSetIteratorHasNext(iter));
+        HybridSetIteratorFree(iter);
+        IntSetIteratorFree(refIter);
+        set = HybridSetOptimize(set);
+    }
+
+    //a full range is one run, clearing it leaves nothing behind
+    HybridSet *range = HybridSetNew();
+    for (int64_t i = 0; i < 3 * 65536; i++) {
+        range = HybridSetPut(range, i, &ret);
+    }
+    assert(range->count == 3 && range->chunks[1].type == HYBRID_RUN);
+    assert(IntVectorSize(range->chunks[1].vector) == 2);
+    for (int64_t i = 0; i < 3 * 65536; i += 2) {
+        range = HybridSetRemove(range, i, &ret);
+        assert(ret == 1);
+    }
+    assert(range->chunks[1].type == HYBRID_BITMAP);
+    for (int64_t i = 1; i < 3 * 65536; i += 2) {
+        range = HybridSetRemove(range, i, &ret);
+    }
+    assert(HybridSetIsEmpty(range) && range->count == 0);
+
+    HybridSetFree(range);
+    HybridSetFree(set);
+    IntSetFree(ref);
+    return 0;
+}
+#endif
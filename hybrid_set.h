@@ -0,0 +1,79 @@
+#ifndef HYBRID_SET_H
+#define HYBRID_SET_H
+
+#include "int_vector.h"
+
+/**
+ * Integer set for large cardinalities, in the style of Roaring
+ * bitmaps.
+ *
+ * Values are split by their high 48 bits into chunks of 65536
+ * values, kept ordered by key. Each chunk stores the low 16 bits
+ * in whichever container is smallest:
+ *
+ * array: sorted IntVector, low bits biased by -32768 so they fit
+ *        2 bytes, used up to HYBRID_ARRAY_MAX values
+ * bitmap: 65536 bits, 8KB no matter how many values
+ * run: IntVector of [start, last] pairs for dense ranges
+ *
+ * Array and bitmap convert into each other as a chunk fills up
+ * or drains. A full array that is mostly ranges becomes runs, and
+ * runs fall back once they stop paying off. HybridSetOptimize
+ * re-picks every container and gives back spare capacity.
+ *
+ * The API mirrors IntSet.
+ */
+
+#define HYBRID_ARRAY 0
+#define HYBRID_BITMAP 1
+#define HYBRID_RUN 2
+
+#define HYBRID_ARRAY_MAX 4096
+#define HYBRID_BITMAP_WORDS 1024
+
+typedef struct {
+    int64_t key; // value >> 16
+    uint8_t type; // HYBRID_ARRAY, HYBRID_BITMAP or HYBRID_RUN
+    uint32_t cardinality;
+    union {
+        IntVector *vector; // array and run
+        uint64_t *bitmap;
+    };
+} HybridChunk;
+
+typedef struct {
+    uint64_t size; // element count
+    uint32_t count; // chunk count
+    uint32_t capacity; // chunk slots allocated
+    HybridChunk *chunks;
+} HybridSet;
+
+HybridSet *HybridSetNew();
+void HybridSetFree(HybridSet *set);
+
+uint64_t HybridSetSize(HybridSet *set);
+int HybridSetIsEmpty(HybridSet *set);
+HybridSet *HybridSetPut(HybridSet *set, int64_t val, int *ret);
+int HybridSetContains(HybridSet *set, int64_t val);
+HybridSet *HybridSetRemove(HybridSet *set, int64_t val, int *ret);
+
+/**
+ * Convert every chunk to its smallest container.
+ */
+HybridSet *HybridSetOptimize(HybridSet *set);
+
+typedef struct {
+    HybridSet *set;
+    uint32_t chunk;
+    uint32_t run;
+    int64_t pos;
+    int hasNext;
+    int64_t next;
+} HybridSetIterator;
+
+HybridSetIterator *HybridSetIteratorNew(HybridSet *set);
+int HybridSetIteratorHasNext(HybridSetIterator *iter);
+int64_t HybridSetIteratorNext(HybridSetIterator *iter);
+void HybridSetIteratorFree(HybridSetIterator *iter);
+
+#endif //HYBRID_SET_H
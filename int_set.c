@@ -1,5 +1,12 @@
 
 #include "int_set.h"
+#include "int_vector_kernel.h"
+#include "panic.h"
+#include "stats.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
 
 inline IntSet *IntSetNew(){
     return IntVectorNew();
@@ -17,41 +24,738 @@ inline int IntSetIsEmpty(IntSet *set){
     return IntVectorIsEmpty(set);
 }
 
+/**
+ * Up to this many bytes of elements a vectorized scan beats
+ * the unpredictable branches of a binary search.
+ */
+#define INT_SET_SCAN_THRESHOLD 512
+
 int IntSetContains(IntSet *set, int64_t val){
-    return IntVectorIndexOf(set, val) != -1;
+    STATS_LATENCY(STATS_CALL_INTSET_CONTAINS);
+    if(!IntVectorIsPacked(set) && (uint64_t) IntSetSize(set) * set->encoding <= INT_SET_SCAN_THRESHOLD){
+        return IntVectorIndexOf(set, val) != -1;
+    }
+    return IntVectorBinarySearch(set, val) != -1;
+}
+
+//keys searched side by side, so their cache misses overlap
+#define INTSET_BATCH 16
+
+/*
+ * Branchless binary searches run in lock step for a group of keys.
+ * Each step depends only on the set size, so the probes of all keys
+ * in a group are independent loads and the next probe of every key
+ * is prefetched a whole group ahead of its use.
+ *
+ * Sorted keys instead gallop forward from the previous match.
+ */
+#define INTSET_DEFINE_CONTAINS_MANY(bits)                                           \
+static uint32_t intset_containsBatch##bits(const char *elements, int64_t size,     \
+                                           const int64_t *keys, uint32_t n,        \
+                                           uint8_t *found) {                       \
+    uint32_t hits = 0;                                                              \
+    for (uint32_t start = 0; start < n; start += INTSET_BATCH) {                    \
+        uint32_t group = n - start < INTSET_BATCH ? n - start : INTSET_BATCH;       \
+        int64_t base[INTSET_BATCH] = {0};                                           \
+        int64_t len = size;                                                         \
+        while (len > 1) {                                                           \
+            int64_t half = len / 2;                                                 \
+            for (uint32_t k = 0; k < group; k++) {                                  \
+                int64_t probe = ivk_get##bits(elements, base[k] + half);            \
+                base[k] = probe < keys[start + k] ? base[k] + half : base[k];       \
+                __builtin_prefetch(elements + (base[k] + (len - half) / 2)          \
+                                   * (int64_t) sizeof(int##bits##_t));              \
+            }                                                                       \
+            len -= half;                                                            \
+        }                                                                           \
+        for (uint32_t k = 0; k < group; k++) {                                      \
+            int64_t idx = base[k] + (ivk_get##bits(elements, base[k]) < keys[start + k]); \
+            if (idx < size && ivk_get##bits(elements, idx) == keys[start + k]) {    \
+                found[(start + k) / 8] |= (uint8_t) (1 << ((start + k) % 8));       \
+                hits++;                                                             \
+            }                                                                       \
+        }                                                                           \
+    }                                                                               \
+    return hits;                                                                    \
+}                                                                                   \
+                                                                                    \
+static uint32_t intset_containsSorted##bits(const char *elements, int64_t size,    \
+                                            const int64_t *keys, uint32_t n,       \
+                                            uint8_t *found) {                      \
+    uint32_t hits = 0;                                                              \
+    int64_t pos = 0;                                                                \
+    for (uint32_t i = 0; i < n && pos < size; i++) {                                \
+        int64_t step = 1;                                                           \
+        while (pos + step < size && ivk_get##bits(elements, pos + step) < keys[i]) {\
+            step *= 2;                                                              \
+        }                                                                           \
+        int64_t lf = pos + step / 2;                                                \
+        int64_t rt = pos + step < size ? pos + step + 1 : size;                     \
+        pos = lf + ivk_lowerBound##bits(elements + lf * (int64_t) sizeof(int##bits##_t), \
+                                        rt - lf, keys[i]);                          \
+        if (pos < size && ivk_get##bits(elements, pos) == keys[i]) {                \
+            found[i / 8] |= (uint8_t) (1 << (i % 8));                               \
+            hits++;                                                                 \
+        }                                                                           \
+    }                                                                               \
+    return hits;                                                                    \
 }
 
-static inline IntSet *intset_insertByOrder(IntSet *set, int64_t val){
-    int64_t i = 0;
-    while (i < set->size && IntVectorValueAt(set, i) < val) {
-        i++;
+INTSET_DEFINE_CONTAINS_MANY(8)
+INTSET_DEFINE_CONTAINS_MANY(16)
+INTSET_DEFINE_CONTAINS_MANY(32)
+INTSET_DEFINE_CONTAINS_MANY(64)
+
+uint32_t IntSetContainsMany(IntSet *set, const int64_t *keys, uint32_t n, uint8_t *found){
+    memset(found, 0, (n + 7) / 8);
+    if(n == 0 || IntSetIsEmpty(set)){
+        return 0;
     }
-    set = IntVectorInsert(set, val, i);
-    return set;
+
+    if(IntVectorIsPacked(set)){
+        uint32_t hits = 0;
+        for(uint32_t i = 0; i < n; i++){
+            if(IntVectorBinarySearch(set, keys[i]) != -1){
+                found[i / 8] |= (uint8_t) (1 << (i % 8));
+                hits++;
+            }
+        }
+        return hits;
+    }
+
+    int sorted = 1;
+    for(uint32_t i = 1; i < n && sorted; i++){
+        sorted = keys[i - 1] <= keys[i];
+    }
+    if(sorted){
+        IVK_DISPATCH(set->encoding, return, intset_containsSorted, set->elements, set->size, keys, n, found);
+    }
+    IVK_DISPATCH(set->encoding, return, intset_containsBatch, set->elements, set->size, keys, n, found);
 }
 
 IntSet *IntSetPut(IntSet *set, int64_t val, int *ret){
-    int64_t idx = IntVectorBinarySearch(set, val);
-    if(idx != -1){
+    STATS_LATENCY(STATS_CALL_INTSET_PUT);
+    int64_t idx = IntVectorLowerBound(set, val);
+    if(idx < IntSetSize(set) && IntVectorValueAt(set, idx) == val){
         if(ret) *ret = 0;
     }else{
         if(ret) *ret = 1;
-        set = intset_insertByOrder(set, val);
+        set = IntVectorInsert(set, val, idx);
     }
     return set;
 }
 
+//min and max are the widest values of a sorted set, so only
+//removing either of them can let the encoding shrink
+static IntSet *intset_compactIfNarrower(IntSet *set){
+    if(IntVectorIsPacked(set)){
+        uint8_t width = 1;
+        if(!IntSetIsEmpty(set)){
+            uint64_t range = (uint64_t) IntVectorValueAt(set, IntSetSize(set) - 1) - (uint64_t) IntVectorValueAt(set, 0);
+            width = ivk_widthFor(range);
+        }
+        return width < (set->encoding & ~INT_VECTOR_PACKED) ? IntVectorPack(set) : set;
+    }
+    if(set->encoding == INT8_BYTES){
+        return set;
+    }
+    uint8_t enc = INT8_BYTES;
+    if(!IntSetIsEmpty(set)){
+        uint8_t minEnc = bytesForInt(IntVectorValueAt(set, 0));
+        uint8_t maxEnc = bytesForInt(IntVectorValueAt(set, IntSetSize(set) - 1));
+        enc = minEnc > maxEnc ? minEnc : maxEnc;
+    }
+    return enc < set->encoding ? IntVectorCompact(set) : set;
+}
+
 IntSet *IntSetRemove(IntSet *set, int64_t val, int *ret){
+    STATS_LATENCY(STATS_CALL_INTSET_REMOVE);
     int64_t idx = IntVectorBinarySearch(set, val);
     if(idx != -1){
         if(ret) *ret = 1;
+        int end = idx == 0 || idx == IntSetSize(set) - 1;
         set = IntVectorRemoveAt(set, idx);
+        if(end) set = intset_compactIfNarrower(set);
     }else{
         if(ret) *ret = 0;
     }
     return set;
 }
 
+#define INTSET_RADIX_BITS 8
+#define INTSET_RADIX_BUCKETS (1 << INTSET_RADIX_BITS)
+#define INTSET_RADIX_MIN_VALUES 64
+
+static int intset_compare(const void *a, const void *b) {
+    int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+//LSD radix sort, keys are flipped at the sign bit so they sort as unsigned
+static void intset_radixSort(int64_t *vals, uint32_t n) {
+    if (n < INTSET_RADIX_MIN_VALUES) {
+        qsort(vals, n, sizeof(int64_t), intset_compare);
+        return;
+    }
+    uint64_t *keys = (uint64_t *) vals, *buf;
+    if ((buf = malloc(n * sizeof(uint64_t))) == NULL) {
+        panic("IntSet radix sort malloc failed\n");
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        keys[i] ^= (uint64_t) 1 << 63;
+    }
+
+    uint64_t *src = keys, *dst = buf;
+    for (int shift = 0; shift < 64; shift += INTSET_RADIX_BITS) {
+        uint32_t count[INTSET_RADIX_BUCKETS] = {0};
+        for (uint32_t i = 0; i < n; i++) {
+            count[(src[i] >> shift) & (INTSET_RADIX_BUCKETS - 1)]++;
+        }
+        //every key has the same digit, this pass would be a plain copy
+        if (count[(src[0] >> shift) & (INTSET_RADIX_BUCKETS - 1)] == n) {
+            continue;
+        }
+        uint32_t offset = 0;
+        for (int b = 0; b < INTSET_RADIX_BUCKETS; b++) {
+            uint32_t c = count[b];
+            count[b] = offset;
+            offset += c;
+        }
+        for (uint32_t i = 0; i < n; i++) {
+            dst[count[(src[i] >> shift) & (INTSET_RADIX_BUCKETS - 1)]++] = src[i];
+        }
+        uint64_t *tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+    if (src != keys) {
+        memcpy(keys, src, n * sizeof(uint64_t));
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        keys[i] ^= (uint64_t) 1 << 63;
+    }
+    free(buf);
+}
+
+//sort and drop duplicates in place, return count of distinct values
+static uint32_t intset_sortUnique(int64_t *vals, uint32_t n) {
+    if (n == 0) {
+        return 0;
+    }
+    intset_radixSort(vals, n);
+    uint32_t distinct = 1;
+    for (uint32_t i = 1; i < n; i++) {
+        if (vals[i] != vals[distinct - 1]) {
+            vals[distinct++] = vals[i];
+        }
+    }
+    return distinct;
+}
+
+IntSet *IntSetPutMany(IntSet *set, const int64_t *vals, uint32_t n, uint32_t *added) {
+    if (n == 0) {
+        if (added) *added = 0;
+        return set;
+    }
+    int64_t *sorted;
+    if ((sorted = malloc(n * sizeof(int64_t))) == NULL) {
+        panic("IntSet put many malloc failed\n");
+    }
+    memcpy(sorted, vals, n * sizeof(int64_t));
+    uint32_t distinct = intset_sortUnique(sorted, n);
+    set = IntVectorMergeSorted(set, sorted, distinct, added);
+    free(sorted);
+    return set;
+}
+
+IntSet *IntSetFromArray(const int64_t *vals, uint32_t n) {
+    return IntSetPutMany(IntSetNew(), vals, n, NULL);
+}
+
+//fewer values per thread are not worth a thread
+#define INTSET_BUILD_MIN_PER_THREAD (64 * 1024)
+#define INTSET_BUILD_MAX_THREADS 256
+
+typedef struct intset_builder intset_builder;
+
+//one per thread, works on vals[lo, hi) of every pass
+typedef struct {
+    intset_builder *builder;
+    uint32_t id, lo, hi;
+    uint64_t diff; //bits where some key differs from the first key
+    int64_t min, max;
+    uint32_t distinct;
+    int dupFirst; //first key of the chunk equals the key before it
+    uint32_t count[INTSET_RADIX_BUCKETS];
+} intset_buildTask;
+
+struct intset_builder {
+    const int64_t *vals;
+    uint32_t n, threads;
+    uint64_t *keys, *buf;
+    pthread_barrier_t barrier;
+    intset_buildTask *tasks;
+    IntSet *set;
+};
+
+static void *intset_buildWork(void *arg) {
+    intset_buildTask *task = arg;
+    intset_builder *b = task->builder;
+    uint32_t lo = task->lo, hi = task->hi;
+
+    //copy, flip the sign bit and find which digits need a pass
+    uint64_t first = (uint64_t) b->vals[0] ^ (uint64_t) 1 << 63, diff = 0;
+    int64_t min = INT64_MAX, max = INT64_MIN;
+    for (uint32_t i = lo; i < hi; i++) {
+        int64_t v = b->vals[i];
+        if (v < min) min = v;
+        if (v > max) max = v;
+        b->keys[i] = (uint64_t) v ^ (uint64_t) 1 << 63;
+        diff |= b->keys[i] ^ first;
+    }
+    task->diff = diff;
+    task->min = min;
+    task->max = max;
+    pthread_barrier_wait(&b->barrier);
+    for (uint32_t t = 0; t < b->threads; t++) {
+        diff |= b->tasks[t].diff;
+    }
+
+    uint64_t *src = b->keys, *dst = b->buf;
+    for (int shift = 0; shift < 64; shift += INTSET_RADIX_BITS) {
+        if (((diff >> shift) & (INTSET_RADIX_BUCKETS - 1)) == 0) {
+            continue;
+        }
+        memset(task->count, 0, sizeof(task->count));
+        for (uint32_t i = lo; i < hi; i++) {
+            task->count[(src[i] >> shift) & (INTSET_RADIX_BUCKETS - 1)]++;
+        }
+        pthread_barrier_wait(&b->barrier);
+
+        //bucket d of this thread goes after all smaller digits,
+        //then after digit d of the threads before it
+        uint32_t offset[INTSET_RADIX_BUCKETS], base = 0;
+        for (int d = 0; d < INTSET_RADIX_BUCKETS; d++) {
+            for (uint32_t t = 0; t < b->threads; t++) {
+                if (t == task->id) offset[d] = base;
+                base += b->tasks[t].count[d];
+            }
+        }
+        for (uint32_t i = lo; i < hi; i++) {
+            dst[offset[(src[i] >> shift) & (INTSET_RADIX_BUCKETS - 1)]++] = src[i];
+        }
+        pthread_barrier_wait(&b->barrier);
+        uint64_t *tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+
+    //count the distinct keys of the chunk, a run crossing chunks is
+    //counted by the chunk it starts in
+    uint32_t distinct = 0;
+    task->dupFirst = lo > 0 && lo < hi && src[lo] == src[lo - 1];
+    for (uint32_t i = lo; i < hi; i++) {
+        distinct += i == lo ? !task->dupFirst : src[i] != src[i - 1];
+    }
+    task->distinct = distinct;
+    pthread_barrier_wait(&b->barrier);
+
+    uint32_t start = 0, total = 0;
+    for (uint32_t t = 0; t < b->threads; t++) {
+        if (t == task->id) start = total;
+        total += b->tasks[t].distinct;
+        min = b->tasks[t].min < min ? b->tasks[t].min : min;
+        max = b->tasks[t].max > max ? b->tasks[t].max : max;
+    }
+    //the caller's thread allocates, so the set comes from its allocator
+    if (task->id == 0) {
+        uint8_t minEnc = bytesForInt(min), maxEnc = bytesForInt(max);
+        b->set = IntVectorNewWithEncoding(minEnc > maxEnc ? minEnc : maxEnc, total);
+        b->set->size = total;
+    }
+
+    //squeeze the chunk's distinct values to its front while the set
+    //is allocated, chunks are private so this needs no barrier
+    int64_t *out = (int64_t *) src + lo;
+    uint32_t k = 0;
+    uint64_t prev = 0;
+    for (uint32_t i = lo; i < hi; i++) {
+        uint64_t key = src[i];
+        if (i == lo ? !task->dupFirst : key != prev) {
+            out[k++] = (int64_t) (key ^ (uint64_t) 1 << 63);
+        }
+        prev = key;
+    }
+    pthread_barrier_wait(&b->barrier);
+    IVK_DISPATCH(b->set->encoding, , ivk_encode, b->set->elements, start, out, k);
+    return NULL;
+}
+
+IntSet *IntSetBuild(const int64_t *vals, uint32_t n, uint32_t threads) {
+    if (n == 0) {
+        return IntSetNew();
+    }
+    if (threads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (uint32_t) cpus : 1;
+    }
+    if (threads > n / INTSET_BUILD_MIN_PER_THREAD) threads = n / INTSET_BUILD_MIN_PER_THREAD;
+    if (threads > INTSET_BUILD_MAX_THREADS) threads = INTSET_BUILD_MAX_THREADS;
+    if (threads == 0) threads = 1;
+
+    intset_builder b = {.vals = vals, .n = n, .threads = threads};
+    pthread_t tids[INTSET_BUILD_MAX_THREADS];
+    if ((b.keys = malloc(n * sizeof(uint64_t))) == NULL
+        || (b.buf = malloc(n * sizeof(uint64_t))) == NULL
+        || (b.tasks = malloc(threads * sizeof(intset_buildTask))) == NULL) {
+        panic("IntSet build malloc failed\n");
+    }
+    pthread_barrier_init(&b.barrier, NULL, threads);
+    for (uint32_t t = 0; t < threads; t++) {
+        b.tasks[t].builder = &b;
+        b.tasks[t].id = t;
+        b.tasks[t].lo = (uint32_t) ((uint64_t) n * t / threads);
+        b.tasks[t].hi = (uint32_t) ((uint64_t) n * (t + 1) / threads);
+    }
+    for (uint32_t t = 1; t < threads; t++) {
+        if (pthread_create(&tids[t], NULL, intset_buildWork, &b.tasks[t]) != 0) {
+            panic("IntSet build thread create failed\n");
+        }
+    }
+    intset_buildWork(&b.tasks[0]);
+    for (uint32_t t = 1; t < threads; t++) {
+        pthread_join(tids[t], NULL);
+    }
+    pthread_barrier_destroy(&b.barrier);
+    free(b.keys);
+    free(b.buf);
+    free(b.tasks);
+    return b.set;
+}
+
+#define INTSET_EMIT_A 1 //values only in a
+#define INTSET_EMIT_B 2 //values only in b
+#define INTSET_EMIT_BOTH 4 //values in both
+
+#define INTSET_UNION (INTSET_EMIT_A | INTSET_EMIT_B | INTSET_EMIT_BOTH)
+#define INTSET_INTERSECT INTSET_EMIT_BOTH
+#define INTSET_DIFFERENCE INTSET_EMIT_A
+
+//one set at least this many times larger is searched, not scanned
+#define INTSET_GALLOP_RATIO 32
+#define INTSET_BLOCK 256
+
+//collects result values, out is NULL when only counting
+typedef struct {
+    IntSet *out;
+    uint64_t count;
+    uint32_t n;
+    int64_t buf[INTSET_BLOCK];
+} intset_sink;
+
+static void intset_sinkFlush(intset_sink *sink) {
+    if (sink->out && sink->n > 0) {
+        sink->out = IntVectorAppendMany(sink->out, sink->buf, sink->n);
+    }
+    sink->n = 0;
+}
+
+static inline void intset_emit(intset_sink *sink, int64_t val) {
+    sink->count++;
+    if (sink->out) {
+        sink->buf[sink->n++] = val;
+        if (sink->n == INTSET_BLOCK) intset_sinkFlush(sink);
+    }
+}
+
+//emit elements [from, to) of set
+static void intset_emitRange(intset_sink *sink, IntSet *set, int64_t from, int64_t to) {
+    if (from >= to) return;
+    sink->count += to - from;
+    if (sink->out) {
+        intset_sinkFlush(sink);
+        sink->out = IntVectorAppendRange(sink->out, set, from, to - from);
+    }
+}
+
+//linear merge from (*pi, *pj) until either side runs out
+#define INTSET_DEFINE_MERGE(ba, bb)                                                 \
+static void intset_merge##ba##_##bb(const char *a, int64_t na, const char *b,      \
+                                    int64_t nb, int op, intset_sink *sink,          \
+                                    int64_t *pi, int64_t *pj) {                     \
+    int64_t i = *pi, j = *pj;                                                       \
+    while (i < na && j < nb) {                                                      \
+        int64_t x = ivk_get##ba(a, i), y = ivk_get##bb(b, j);                       \
+        if (x < y) {                                                                \
+            if (op & INTSET_EMIT_A) intset_emit(sink, x);                           \
+            i++;                                                                    \
+        } else if (x > y) {                                                         \
+            if (op & INTSET_EMIT_B) intset_emit(sink, y);                           \
+            j++;                                                                    \
+        } else {                                                                    \
+            if (op & INTSET_EMIT_BOTH) intset_emit(sink, x);                        \
+            i++;                                                                    \
+            j++;                                                                    \
+        }                                                                           \
+    }                                                                               \
+    *pi = i;                                                                        \
+    *pj = j;                                                                        \
+}
+
+#define INTSET_DEFINE_MERGE_FROM(ba) \
+    INTSET_DEFINE_MERGE(ba, 8) INTSET_DEFINE_MERGE(ba, 16) INTSET_DEFINE_MERGE(ba, 32) INTSET_DEFINE_MERGE(ba, 64)
+
+INTSET_DEFINE_MERGE_FROM(8)
+INTSET_DEFINE_MERGE_FROM(16)
+INTSET_DEFINE_MERGE_FROM(32)
+INTSET_DEFINE_MERGE_FROM(64)
+
+static void intset_merge(IntSet *a, IntSet *b, int op, intset_sink *sink, int64_t *pi, int64_t *pj) {
+#define INTSET_MERGE_CASE(ba, bb)                                                   \
+    case INT##ba##_BYTES << 4 | INT##bb##_BYTES:                                    \
+        intset_merge##ba##_##bb(a->elements, a->size, b->elements, b->size, op, sink, pi, pj); \
+        break;
+#define INTSET_MERGE_CASES_FROM(ba) \
+    INTSET_MERGE_CASE(ba, 8) INTSET_MERGE_CASE(ba, 16) INTSET_MERGE_CASE(ba, 32) INTSET_MERGE_CASE(ba, 64)
+
+    switch (a->encoding << 4 | b->encoding) {
+        INTSET_MERGE_CASES_FROM(8)
+        INTSET_MERGE_CASES_FROM(16)
+        INTSET_MERGE_CASES_FROM(32)
+        INTSET_MERGE_CASES_FROM(64)
+        default:
+            panic("IntSet unknown encodings: %d %d\n", a->encoding, b->encoding);
+    }
+#undef INTSET_MERGE_CASES_FROM
+#undef INTSET_MERGE_CASE
+}
+
+//lower bound of key at or after pos, found is set if it equals key
+typedef int64_t (*intset_gallopFn)(const char *elements, int64_t n, int64_t pos, int64_t key, int *found);
+
+#define INTSET_DEFINE_GALLOP(bits)                                                  \
+static int64_t intset_gallop##bits(const char *elements, int64_t n, int64_t pos,   \
+                                   int64_t key, int *found) {                      \
+    int64_t step = 1;                                                               \
+    while (pos + step < n && ivk_get##bits(elements, pos + step) < key) {           \
+        step *= 2;                                                                  \
+    }                                                                               \
+    int64_t lf = pos + step / 2;                                                    \
+    int64_t rt = pos + step < n ? pos + step + 1 : n;                               \
+    if (lf > rt) lf = rt;                                                           \
+    pos = lf + ivk_lowerBound##bits(elements + lf * (int64_t) sizeof(int##bits##_t),\
+                                    rt - lf, key);                                  \
+    *found = pos < n && ivk_get##bits(elements, pos) == key;                        \
+    return pos;                                                                     \
+}
+
+INTSET_DEFINE_GALLOP(8)
+INTSET_DEFINE_GALLOP(16)
+INTSET_DEFINE_GALLOP(32)
+INTSET_DEFINE_GALLOP(64)
+
+static void intset_gallopCombine(IntSet *a, IntSet *b, int op, intset_sink *sink) {
+    IntSet *small = a, *large = b;
+    int smallOnly = op & INTSET_EMIT_A, largeOnly = op & INTSET_EMIT_B;
+    if (a->size > b->size) {
+        small = b;
+        large = a;
+        smallOnly = op & INTSET_EMIT_B;
+        largeOnly = op & INTSET_EMIT_A;
+    }
+
+    intset_gallopFn gallop;
+    switch (large->encoding) {
+        case INT8_BYTES: gallop = intset_gallop8; break;
+        case INT16_BYTES: gallop = intset_gallop16; break;
+        case INT32_BYTES: gallop = intset_gallop32; break;
+        default: gallop = intset_gallop64; break;
+    }
+
+    int64_t pos = 0, nl = large->size, block[INTSET_BLOCK];
+    for (int64_t i = 0; i < small->size; i += INTSET_BLOCK) {
+        int64_t len = small->size - i < INTSET_BLOCK ? small->size - i : INTSET_BLOCK;
+        IVK_DISPATCH(small->encoding, , ivk_decode, small->elements, i, len, block);
+        for (int64_t k = 0; k < len; k++) {
+            int found;
+            int64_t lb = gallop(large->elements, nl, pos, block[k], &found);
+            if (largeOnly) intset_emitRange(sink, large, pos, lb);
+            if (found) {
+                if (op & INTSET_EMIT_BOTH) intset_emit(sink, block[k]);
+                pos = lb + 1;
+            } else {
+                if (smallOnly) intset_emit(sink, block[k]);
+                pos = lb;
+            }
+        }
+    }
+    if (largeOnly) intset_emitRange(sink, large, pos, nl);
+}
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+
+/*
+ * Block intersection: a register of a is compared with every
+ * rotation of a register of b, then the block with the smaller
+ * maximum is advanced. Matches are always taken from a.
+ */
+static void intset_intersectSimd32(const char *a, int64_t na, const char *b, int64_t nb,
+                                   intset_sink *sink, int64_t *pi, int64_t *pj) {
+    int64_t i = 0, j = 0;
+    while (i + 4 <= na && j + 4 <= nb) {
+        __m128i va = _mm_loadu_si128((const __m128i *) (a + i * 4));
+        __m128i vb = _mm_loadu_si128((const __m128i *) (b + j * 4));
+        __m128i eq = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi32(va, vb),
+                             _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(0, 3, 2, 1)))),
+                _mm_or_si128(_mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(1, 0, 3, 2))),
+                             _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(2, 1, 0, 3)))));
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(eq));
+        while (mask) {
+            intset_emit(sink, ivk_get32(a, i + __builtin_ctz(mask)));
+            mask &= mask - 1;
+        }
+        int64_t amax = ivk_get32(a, i + 3), bmax = ivk_get32(b, j + 3);
+        if (amax <= bmax) i += 4;
+        if (bmax <= amax) j += 4;
+    }
+    *pi = i;
+    *pj = j;
+}
+
+#define INTSET_ROTATE16(v, r) _mm_or_si128(_mm_srli_si128(v, 2 * (r)), _mm_slli_si128(v, 16 - 2 * (r)))
+
+static void intset_intersectSimd16(const char *a, int64_t na, const char *b, int64_t nb,
+                                   intset_sink *sink, int64_t *pi, int64_t *pj) {
+    int64_t i = 0, j = 0;
+    while (i + 8 <= na && j + 8 <= nb) {
+        __m128i va = _mm_loadu_si128((const __m128i *) (a + i * 2));
+        __m128i vb = _mm_loadu_si128((const __m128i *) (b + j * 2));
+        __m128i eq = _mm_or_si128(
+                _mm_or_si128(
+                        _mm_or_si128(_mm_cmpeq_epi16(va, vb),
+                                     _mm_cmpeq_epi16(va, INTSET_ROTATE16(vb, 1))),
+                        _mm_or_si128(_mm_cmpeq_epi16(va, INTSET_ROTATE16(vb, 2)),
+                                     _mm_cmpeq_epi16(va, INTSET_ROTATE16(vb, 3)))),
+                _mm_or_si128(
+                        _mm_or_si128(_mm_cmpeq_epi16(va, INTSET_ROTATE16(vb, 4)),
+                                     _mm_cmpeq_epi16(va, INTSET_ROTATE16(vb, 5))),
+                        _mm_or_si128(_mm_cmpeq_epi16(va, INTSET_ROTATE16(vb, 6)),
+                                     _mm_cmpeq_epi16(va, INTSET_ROTATE16(vb, 7)))));
+        //two mask bits per lane, keep the low one
+        int mask = _mm_movemask_epi8(eq) & 0x5555;
+        while (mask) {
+            intset_emit(sink, ivk_get16(a, i + __builtin_ctz(mask) / 2));
+            mask &= mask - 1;
+        }
+        int64_t amax = ivk_get16(a, i + 7), bmax = ivk_get16(b, j + 7);
+        if (amax <= bmax) i += 8;
+        if (bmax <= amax) j += 8;
+    }
+    *pi = i;
+    *pj = j;
+}
+
+#endif
+
+static void intset_combine(IntSet *a, IntSet *b, int op, intset_sink *sink) {
+    int64_t na = a->size, nb = b->size, i = 0, j = 0;
+
+    if (na > 0 && nb > 0 && (na / nb >= INTSET_GALLOP_RATIO || nb / na >= INTSET_GALLOP_RATIO)) {
+        intset_gallopCombine(a, b, op, sink);
+        return;
+    }
+#if defined(__SSE2__)
+    if (op == INTSET_INTERSECT && a->encoding == b->encoding) {
+        if (a->encoding == INT32_BYTES) {
+            intset_intersectSimd32(a->elements, na, b->elements, nb, sink, &i, &j);
+        } else if (a->encoding == INT16_BYTES) {
+            intset_intersectSimd16(a->elements, na, b->elements, nb, sink, &i, &j);
+        }
+    }
+#endif
+    intset_merge(a, b, op, sink, &i, &j);
+    if (op & INTSET_EMIT_A) intset_emitRange(sink, a, i, na);
+    if (op & INTSET_EMIT_B) intset_emitRange(sink, b, j, nb);
+}
+
+//the kernels above read byte encodings, a packed set is unpacked into a copy
+static IntSet *intset_unpacked(IntSet *set) {
+    return IntVectorIsPacked(set) ? IntVectorUnpack(IntVectorSlice(set, 0, -1)) : set;
+}
+
+static void intset_freeUnpacked(IntSet *copy, IntSet *set) {
+    if (copy != set) IntSetFree(copy);
+}
+
+static IntSet *intset_algebra(IntSet *pa, IntSet *pb, int op) {
+    IntSet *a = intset_unpacked(pa), *b = intset_unpacked(pb);
+    //every result value fits the encoding picked here
+    uint8_t enc;
+    uint64_t capacity;
+    if (op == INTSET_UNION) {
+        enc = a->encoding > b->encoding ? a->encoding : b->encoding;
+        capacity = (uint64_t) a->size + b->size;
+        if (capacity > INT_VECTOR_MAX_SIZE) capacity = INT_VECTOR_MAX_SIZE;
+    } else if (op == INTSET_INTERSECT) {
+        enc = a->encoding < b->encoding ? a->encoding : b->encoding;
+        capacity = a->size < b->size ? a->size : b->size;
+    } else {
+        enc = a->encoding;
+        capacity = a->size;
+    }
+
+    intset_sink sink;
+    sink.out = IntVectorNewWithEncoding(enc, (uint32_t) capacity);
+    sink.count = 0;
+    sink.n = 0;
+    intset_combine(a, b, op, &sink);
+    intset_sinkFlush(&sink);
+    //the result is packed if an input was
+    int packed = a != pa || b != pb;
+    intset_freeUnpacked(a, pa);
+    intset_freeUnpacked(b, pb);
+    sink.out = IntVectorShrinkToFit(sink.out);
+    return packed ? IntVectorPack(sink.out) : intset_compactIfNarrower(sink.out);
+}
+
+static uint64_t intset_algebraSize(IntSet *pa, IntSet *pb, int op) {
+    IntSet *a = intset_unpacked(pa), *b = intset_unpacked(pb);
+    intset_sink sink;
+    sink.out = NULL;
+    sink.count = 0;
+    sink.n = 0;
+    intset_combine(a, b, op, &sink);
+    intset_freeUnpacked(a, pa);
+    intset_freeUnpacked(b, pb);
+    return sink.count;
+}
+
+IntSet *IntSetUnion(IntSet *a, IntSet *b) {
+    return intset_algebra(a, b, INTSET_UNION);
+}
+
+IntSet *IntSetIntersect(IntSet *a, IntSet *b) {
+    return intset_algebra(a, b, INTSET_INTERSECT);
+}
+
+IntSet *IntSetDifference(IntSet *a, IntSet *b) {
+    return intset_algebra(a, b, INTSET_DIFFERENCE);
+}
+
+uint64_t IntSetUnionSize(IntSet *a, IntSet *b) {
+    return intset_algebraSize(a, b, INTSET_UNION);
+}
+
+uint64_t IntSetIntersectSize(IntSet *a, IntSet *b) {
+    return intset_algebraSize(a, b, INTSET_INTERSECT);
+}
+
+uint64_t IntSetDifferenceSize(IntSet *a, IntSet *b) {
+    return intset_algebraSize(a, b, INTSET_DIFFERENCE);
+}
+
 inline IntSetIterator *IntSetIteratorNew(IntSet *set){
     return IntVectorIteratorNew(set);
 }
@@ -62,10 +766,31 @@ inline int64_t IntSetIteratorNext(IntSetIterator *iter){
     return IntVectorIteratorNext(iter);
 }
 
+inline void IntSetIteratorFree(IntSetIterator *iter){
+    IntVectorIteratorFree(iter);
+}
+
+inline int IntSetSave(IntSet *set, const char *path){
+    return IntVectorSave(set, path);
+}
+
+inline IntSet *IntSetLoad(const char *path){
+    return IntVectorLoad(path);
+}
+
+inline IntSet *IntSetViewFromMmap(const void *addr, size_t len, int verify){
+    return IntVectorViewFromMmap(addr, len, verify);
+}
+
+inline void IntSetMemoryUsage(IntSet *set, IntVectorMemory *usage){
+    IntVectorMemoryUsage(set, usage);
+}
+
 //#define INT_SET_TEST
 #ifdef INT_SET_TEST
 #include <assert.h>
 #include <stdio.h>
+#include "blob_file.h"
 
 int main(){
     IntSet *set = IntSetNew();
@@ -90,6 +815,177 @@ int main(){
         assert(1 == ret);
     }
     assert(IntVectorIsEmpty(set));
+
+    int64_t vals[1000];
+    uint32_t added;
+    for (int i = 0; i < 1000; i++) {
+        vals[i] = (i * 7919) % 500 - 250;
+    }
+    set = IntSetPutMany(set, vals, 1000, &added);
+    assert(added == 500 && IntSetSize(set) == 500);
+    iter = IntSetIteratorNew(set);
+    correct = -250;
+    while (IntSetIteratorHasNext(iter)) {
+        assert(correct == IntSetIteratorNext(iter));
+        correct++;
+    }
+    IntSetIteratorFree(iter);
+
+    int64_t wide[] = {INT64_MAX, -1000, 0, INT64_MIN, 100000};
+    set = IntSetPutMany(set, wide, 5, &added);
+    assert(added == 4 && IntSetSize(set) == 504);
+    assert(IntVectorValueAt(set, 0) == INT64_MIN);
+    assert(IntVectorValueAt(set, 1) == -1000);
+    assert(IntVectorValueAt(set, 2) == -250);
+    assert(IntVectorValueAt(set, 502) == 100000);
+    assert(IntVectorValueAt(set, 503) == INT64_MAX);
+    int64_t keys[2000];
+    uint8_t found[250];
+    for (int i = 0; i < 2000; i++) {
+        keys[i] = (i * 7919) % 1200 - 600;
+    }
+    uint32_t hits = IntSetContainsMany(set, keys, 2000, found);
+    for (int i = 0; i < 2000; i++) {
+        assert(((found[i / 8] >> (i % 8)) & 1) == IntSetContains(set, keys[i]));
+        hits -= IntSetContains(set, keys[i]);
+    }
+    assert(hits == 0);
+    for (int i = 0; i < 2000; i++) {
+        keys[i] = i - 1000;
+    }
+    keys[1999] = INT64_MAX;
+    assert(IntSetContainsMany(set, keys, 2000, found) == 502);
+    for (int i = 0; i < 2000; i++) {
+        assert(((found[i / 8] >> (i % 8)) & 1) == IntSetContains(set, keys[i]));
+    }
+    IntSetFree(set);
+
+    //set algebra over every strategy: merge, SIMD blocks and galloping
+    int64_t scales[] = {1, 100, 100000, (int64_t) 1 << 40};
+    uint32_t sizes[] = {0, 7, 300, 20000};
+    int64_t *va = malloc(20000 * sizeof(int64_t)), *vb = malloc(20000 * sizeof(int64_t));
+    for (int sa = 0; sa < 4; sa++) {
+        for (int sb = 0; sb < 4; sb++) {
+            for (int na = 0; na < 4; na++) {
+                for (int nb = 0; nb < 4; nb++) {
+                    for (uint32_t i = 0; i < sizes[na]; i++) va[i] = (int64_t) (i * 3 % 1000) * scales[sa] / 10;
+                    for (uint32_t i = 0; i < sizes[nb]; i++) vb[i] = (int64_t) (i * 7 % 1500) * scales[sb] / 10;
+                    IntSet *a = IntSetFromArray(va, sizes[na]), *b = IntSetFromArray(vb, sizes[nb]);
+                    IntSet *u = IntSetUnion(a, b), *in = IntSetIntersect(a, b), *d = IntSetDifference(a, b);
+                    assert(IntSetUnionSize(a, b) == IntSetSize(u));
+                    assert(IntSetIntersectSize(a, b) == IntSetSize(in));
+                    assert(IntSetDifferenceSize(a, b) == IntSetSize(d));
+                    assert(IntSetSize(u) + IntSetSize(in) == IntSetSize(a) + IntSetSize(b));
+                    assert(IntSetSize(d) + IntSetSize(in) == IntSetSize(a));
+                    for (uint32_t i = 0; i < IntSetSize(a); i++) {
+                        int64_t x = IntVectorValueAt(a, i);
+                        assert(IntSetContains(u, x));
+                        assert(IntSetContains(in, x) == IntSetContains(b, x));
+                        assert(IntSetContains(d, x) == !IntSetContains(b, x));
+                    }
+                    for (uint32_t i = 1; i < IntSetSize(u); i++) {
+                        assert(IntVectorValueAt(u, i - 1) < IntVectorValueAt(u, i));
+                    }
+                    IntSetFree(a);
+                    IntSetFree(b);
+                    IntSetFree(u);
+                    IntSetFree(in);
+                    IntSetFree(d);
+                }
+            }
+        }
+    }
+    free(va);
+    free(vb);
+
+    set = IntSetFromArray(wide, 5);
+    set = IntSetRemove(set, INT64_MAX, &ret);
+    assert(set->encoding == INT64_BYTES);
+    set = IntSetRemove(set, INT64_MIN, &ret);
+    assert(set->encoding == INT32_BYTES);
+    set = IntSetRemove(set, 100000, &ret);
+    assert(set->encoding == INT16_BYTES);
+    assert(IntVectorValueAt(set, 0) == -1000 && IntVectorValueAt(set, 1) == 0);
+    IntSetFree(set);
+
+    set = IntSetFromArray(wide, 5);
+    assert(IntSetSize(set) == 5 && IntSetContains(set, 100000));
+    IntSetFree(set);
+
+    //a mapped set answers lookups in place
+    set = IntSetNew();
+    for (int i = 0; i < 5000; i++) {
+        set = IntSetPut(set, (int64_t) i * i, &ret);
+    }
+    assert(IntSetSave(set, "/tmp/int_set_test.bin"));
+    size_t len;
+    const void *addr = BlobFileMap("/tmp/int_set_test.bin", &len);
+    IntSet *view = IntSetViewFromMmap(addr, len, 0);
+    uint8_t mapped[1];
+    int64_t probes[3] = {49, 50, 4999 * 4999};
+    assert(view && IntSetContains(view, 4096) && !IntSetContains(view, 4097));
+    assert(IntSetContainsMany(view, probes, 3, mapped) == 2 && mapped[0] == 0x5);
+    BlobFileUnmap(addr, len);
+    unlink("/tmp/int_set_test.bin");
+    IntSetFree(set);
+
+    //parallel build matches the sequential one, duplicates straddle chunks
+    uint32_t nb = 300000;
+    int64_t *dump = malloc(nb * sizeof(int64_t));
+    for (int64_t bits = 8; bits <= 64; bits += 28) {
+        for (uint32_t i = 0; i < nb; i++) {
+            uint64_t r = (uint64_t) rand() << 40 ^ (uint64_t) rand() << 20 ^ (uint64_t) rand();
+            dump[i] = bits == 64 ? (int64_t) r : (int64_t) (r % ((uint64_t) 1 << (bits - 1))) - i % 2 * 100;
+        }
+        for (uint32_t i = nb / 2 - 1000; i < nb / 2 + 1000; i++) {
+            dump[i] = 7;
+        }
+        IntSet *expect = IntSetFromArray(dump, nb);
+        for (uint32_t threads = 1; threads <= 4; threads++) {
+            set = IntSetBuild(dump, nb, threads);
+            assert(set->encoding == expect->encoding && IntSetSize(set) == IntSetSize(expect));
+            assert(memcmp(set->elements, expect->elements, (size_t) IntSetSize(set) * set->encoding) == 0);
+            IntSetFree(set);
+        }
+        IntSetFree(expect);
+    }
+    free(dump);
+    set = IntSetBuild(wide, 5, 0);
+    assert(IntSetSize(set) == 5 && set->encoding == INT64_BYTES && IntVectorValueAt(set, 0) == INT64_MIN);
+    IntSetFree(set);
+    set = IntSetBuild(wide, 0, 0);
+    assert(IntSetIsEmpty(set));
+    IntSetFree(set);
+
+    //packed sets of narrow ids, through puts, removes and algebra
+    IntSet *ids = IntVectorPack(IntSetNew()), *odd = IntSetNew();
+    for (int i = 0; i < 3000; i++) {
+        ids = IntSetPut(ids, 5000000 + (int64_t) i * 7 % 3000 * 3, &ret);
+        odd = IntSetPut(odd, 5000000 + (int64_t) i * 2 + 1, &ret);
+    }
+    assert(IntVectorIsPacked(ids) && IntSetSize(ids) == 3000 && ids->encoding == (INT_VECTOR_PACKED | 14));
+    assert(IntSetContains(ids, 5000000 + 2999 * 3) && !IntSetContains(ids, 5000001));
+    for (int i = 0; i < 2000; i++) {
+        keys[i] = 4999000 + i * 5;
+    }
+    hits = IntSetContainsMany(ids, keys, 2000, found);
+    for (int i = 0; i < 2000; i++) {
+        assert(((found[i / 8] >> (i % 8)) & 1) == IntSetContains(ids, keys[i]));
+        hits -= IntSetContains(ids, keys[i]);
+    }
+    assert(hits == 0);
+    IntSet *in = IntSetIntersect(ids, odd), *u = IntSetUnion(odd, ids);
+    assert(IntVectorIsPacked(in) && IntSetSize(in) == 1000 && IntSetContains(in, 5000003));
+    assert(IntVectorIsPacked(u) && IntSetUnionSize(ids, odd) == IntSetSize(u) && IntSetSize(u) == 5000);
+    IntSetFree(in);
+    IntSetFree(u);
+    for (int i = 1000; i < 3000; i++) {
+        ids = IntSetRemove(ids, 5000000 + (int64_t) i * 3, &ret);
+        assert(ret == 1);
+    }
+    assert(IntSetSize(ids) == 1000 && ids->encoding == (INT_VECTOR_PACKED | 12));
+    IntSetFree(ids);
+    IntSetFree(odd);
     return 0;
 }
 #endif
\ No newline at end of file
@@ -16,12 +16,65 @@ uint32_t IntSetSize(IntSet *set);
 int IntSetIsEmpty(IntSet *set);
 IntSet *IntSetPut(IntSet *set, int64_t val, int *ret);
 int IntSetContains(IntSet *set, int64_t val);
+
+/**
+ * Probe n keys at once. Bit i of found (n / 8 rounded up bytes)
+ * is set if keys[i] is in the set. Return how many were found.
+ * Keys sorted ascending are matched in a single merge pass.
+ */
+uint32_t IntSetContainsMany(IntSet *set, const int64_t *keys, uint32_t n, uint8_t *found);
 IntSet *IntSetRemove(IntSet *set, int64_t val, int *ret);
 
+/**
+ * Put n values in any order, duplicates allowed. The values
+ * are sorted once and merged into the set in one pass.
+ */
+IntSet *IntSetPutMany(IntSet *set, const int64_t *vals, uint32_t n, uint32_t *added);
+IntSet *IntSetFromArray(const int64_t *vals, uint32_t n);
+
+/**
+ * Build a set from n values in any order, duplicates allowed, on
+ * threads threads (0 means one per online CPU). The values are
+ * radix sorted in parallel, skipping digits all values share, and
+ * written once into a set of the narrowest encoding.
+ */
+IntSet *IntSetBuild(const int64_t *vals, uint32_t n, uint32_t threads);
+
+/**
+ * Set algebra, each call returns a new set. The *Size variants
+ * only count the result without building it.
+ *
+ * Sets of similar size are merged linearly, or intersected in
+ * SIMD blocks when both share a 2 or 4 byte encoding. When one set
+ * is much smaller, its elements gallop through the larger one.
+ * Packed sets (IntVectorPack) are unpacked into a copy first and
+ * give a packed result.
+ */
+IntSet *IntSetUnion(IntSet *a, IntSet *b);
+IntSet *IntSetIntersect(IntSet *a, IntSet *b);
+IntSet *IntSetDifference(IntSet *a, IntSet *b);
+uint64_t IntSetUnionSize(IntSet *a, IntSet *b);
+uint64_t IntSetIntersectSize(IntSet *a, IntSet *b);
+uint64_t IntSetDifferenceSize(IntSet *a, IntSet *b);
+
+/**
+ * Sets are saved as their vector, see IntVectorSave. A mapped view
+ * serves IntSetContains and iteration in place.
+ */
+int IntSetSave(IntSet *set, const char *path);
+IntSet *IntSetLoad(const char *path);
+IntSet *IntSetViewFromMmap(const void *addr, size_t len, int verify);
+
+/**
+ * Same as IntVectorMemoryUsage.
+ */
+void IntSetMemoryUsage(IntSet *set, IntVectorMemory *usage);
+
 typedef IntVectorIterator IntSetIterator;
 
 IntSetIterator *IntSetIteratorNew(IntSet *set);
 int IntSetIteratorHasNext(IntSetIterator *iter);
 int64_t IntSetIteratorNext(IntSetIterator *iter);
+void IntSetIteratorFree(IntSetIterator *iter);
 
 #endif //INTSET_INT_SET_H
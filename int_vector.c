@@ -1,6 +1,11 @@
 #include "int_vector.h"
 #include "panic.h"
 #include "integer.h"
+#include "int_vector_kernel.h"
+#include "simd_scan.h"
+#include "allocator.h"
+#include "blob_file.h"
+#include "stats.h"
 #include <string.h>
 
 static inline size_t iv_headerBytes() {
@@ -16,6 +21,18 @@ static inline void iv_setSize(IntVector *vector, uint32_t size) {
     vector->size = size;
 }
 
+inline uint32_t IntVectorCapacity(IntVector *vector) {
+    return vector->capacity;
+}
+
+static inline void iv_setCapacity(IntVector *vector, uint32_t capacity) {
+    vector->capacity = capacity;
+}
+
+static inline uint8_t iv_getMode(IntVector *vector) {
+    return vector->mode;
+}
+
 inline int IntVectorIsFull(IntVector *vector) {
     return IntVectorSize(vector) == INT_VECTOR_MAX_SIZE;
 }
@@ -32,8 +49,22 @@ static inline void iv_setEncoding(IntVector *vector, uint8_t enc) {
     vector->encoding = enc;
 }
 
-static inline size_t iv_totalBytes(IntVector *vector) {
-    return iv_headerBytes() + IntVectorSize(vector) * iv_getEncoding(vector);
+static inline int iv_isPacked(IntVector *vector) {
+    return (iv_getEncoding(vector) & INT_VECTOR_PACKED) != 0;
+}
+
+//bits of one element of a packed vector
+static inline uint8_t iv_width(IntVector *vector) {
+    return iv_getEncoding(vector) & ~INT_VECTOR_PACKED;
+}
+
+static inline size_t iv_bytesFor(uint32_t capacity, uint8_t encoding) {
+    if (encoding & INT_VECTOR_PACKED) {
+        //base, bits and the pad the kernels read past the last element
+        uint64_t bits = (uint64_t) capacity * (encoding & ~INT_VECTOR_PACKED);
+        return iv_headerBytes() + sizeof(int64_t) + (size_t) ((bits + 7) / 8) + IVK_PACK_PAD;
+    }
+    return iv_headerBytes() + (size_t) capacity * encoding;
 }
 
 
@@ -45,6 +76,30 @@ static inline char *iv_firstElement(IntVector *vector) {
     return vector->elements;
 }
 
+/*
+ * A packed vector keeps its base in the first 8 bytes of elements,
+ * ahead of the bits, so saving and mapping see it as element data.
+ */
+static inline int64_t iv_base(IntVector *vector) {
+    int64_t base;
+    memcpy(&base, iv_firstElement(vector), sizeof(base));
+    return base;
+}
+
+static inline void iv_setBase(IntVector *vector, int64_t base) {
+    memcpy(iv_firstElement(vector), &base, sizeof(base));
+}
+
+static inline char *iv_bits(IntVector *vector) {
+    return iv_firstElement(vector) + sizeof(int64_t);
+}
+
+//largest value a packed vector holds without widening
+static inline int64_t iv_top(IntVector *vector) {
+    uint64_t mask = ivk_mask(iv_width(vector)), room = (uint64_t) INT64_MAX - (uint64_t) iv_base(vector);
+    return mask >= room ? INT64_MAX : (int64_t) ((uint64_t) iv_base(vector) + mask);
+}
+
 static inline char *iv_elementAtIdxByType(IntVector *vector, int64_t idx, uint8_t encoding) {
     return iv_firstElement(vector) + idx * encoding;
 }
@@ -64,78 +119,226 @@ static inline int64_t iv_lastIdx(IntVector *vector) {
     return (int64_t) IntVectorSize(vector) - 1;
 }
 
-static inline int64_t iv_valueAtIdxByEncoding(IntVector *vector, int64_t idx, uint8_t encoding) {
-    iv_validIndex(vector, idx);
-    char *ele = iv_elementAtIdxByType(vector, idx, encoding);
-    return int_getValue(ele, encoding);
+//callers check idx
+static inline int64_t iv_valueAt(IntVector *vector, int64_t idx) {
+    if (iv_isPacked(vector)) {
+        return (int64_t) ((uint64_t) iv_base(vector) + ivk_unpack(iv_bits(vector), iv_width(vector), idx));
+    }
+    IVK_DISPATCH(iv_getEncoding(vector), return, ivk_get, iv_firstElement(vector), idx);
 }
 
-static inline int64_t iv_valueAt(IntVector *vector, int64_t idx) {
-    return iv_valueAtIdxByEncoding(vector, idx, iv_getEncoding(vector));
+//callers check idx and that val fits
+static inline void iv_setValueAt(IntVector *vector, int64_t idx, int64_t val) {
+    if (iv_isPacked(vector)) {
+        ivk_pack(iv_bits(vector), iv_width(vector), idx, (uint64_t) val - (uint64_t) iv_base(vector));
+        return;
+    }
+    IVK_DISPATCH(iv_getEncoding(vector), , ivk_set, iv_firstElement(vector), idx, val);
 }
 
+//set n elements starting at start to 0, which must fit
+static inline void iv_zero(IntVector *vector, int64_t start, int64_t n) {
+    if (iv_isPacked(vector)) {
+        for (int64_t i = start; i < start + n; i++) iv_setValueAt(vector, i, 0);
+        return;
+    }
+    memset(iv_elementAt(vector, start), 0, (size_t) n * iv_getEncoding(vector));
+}
 
-static inline void iv_setValueAt(IntVector *vector, int64_t idx, int64_t val) {
-    char *ele = iv_elementAt(vector, idx);
-    int_setValue(ele, val);
+//decode n elements starting at start
+static inline void iv_decode(IntVector *vector, int64_t start, int64_t n, int64_t *out) {
+    if (iv_isPacked(vector)) {
+        ivk_unpackMany(iv_bits(vector), iv_width(vector), iv_base(vector), start, n, out);
+        return;
+    }
+    IVK_DISPATCH(iv_getEncoding(vector), , ivk_decode, iv_firstElement(vector), start, n, out);
 }
 
-static IntVector *iv_resize(IntVector *vector, size_t size) {
-    if ((vector = realloc(vector, size)) == NULL) {
+//move n elements starting at from to start at to, ranges may overlap
+static inline void iv_moveElements(IntVector *vector, int64_t from, int64_t to, int64_t n) {
+    STATS_ADD(STATS_IV_SHIFTED, n);
+    if (iv_isPacked(vector)) {
+        uint8_t width = iv_width(vector);
+        STATS_ADD(STATS_IV_SHIFTED_BYTES, n * width / 8);
+        ivk_moveBits(iv_bits(vector), (uint64_t) to * width, (uint64_t) from * width, (uint64_t) n * width);
+        return;
+    }
+    STATS_ADD(STATS_IV_SHIFTED_BYTES, n * iv_getEncoding(vector));
+    memmove(iv_elementAt(vector, to), iv_elementAt(vector, from), (size_t) n * iv_getEncoding(vector));
+}
+
+//realloc to exactly capacity slots of encoding, elements are not converted
+static IntVector *iv_realloc(IntVector *vector, uint32_t capacity, uint8_t encoding) {
+    size_t oldBytes = iv_bytesFor(IntVectorCapacity(vector), iv_getEncoding(vector));
+    size_t newBytes = iv_bytesFor(capacity, encoding);
+    STATS_ADD(STATS_IV_REALLOCS, 1);
+    STATS_ADD(STATS_IV_REALLOC_BYTES, oldBytes < newBytes ? oldBytes : newBytes);
+    if ((vector = mem_realloc(vector, oldBytes, newBytes)) == NULL) {
         panic("IntVector realloc failed\n");
     }
+    iv_setCapacity(vector, capacity);
+    iv_setEncoding(vector, encoding);
+    return vector;
+}
+
+//realloc to exactly capacity slots of the current encoding
+static IntVector *iv_resize(IntVector *vector, uint32_t capacity) {
+    return iv_realloc(vector, capacity, iv_getEncoding(vector));
+}
+
+#define IV_MIN_GROWABLE_CAPACITY 8
+
+//make sure there are slots for need elements
+static IntVector *iv_grow(IntVector *vector, uint64_t need) {
+    if (need > INT_VECTOR_MAX_SIZE) {
+        panic("IntVector is full\n");
+    }
+    if (need <= IntVectorCapacity(vector)) {
+        return vector;
+    }
+    if (iv_getMode(vector) == INT_VECTOR_COMPACT) {
+        return iv_resize(vector, (uint32_t) need);
+    }
+
+    uint64_t capacity = IntVectorCapacity(vector);
+    capacity = capacity < IV_MIN_GROWABLE_CAPACITY ? IV_MIN_GROWABLE_CAPACITY : capacity * 2;
+    if (capacity < need) capacity = need;
+    if (capacity > INT_VECTOR_MAX_SIZE) capacity = INT_VECTOR_MAX_SIZE;
+    return iv_resize(vector, (uint32_t) capacity);
+}
+
+//give back unused slots after elements were removed
+static IntVector *iv_shrink(IntVector *vector) {
+    uint32_t size = IntVectorSize(vector), capacity = IntVectorCapacity(vector);
+    if (iv_getMode(vector) == INT_VECTOR_COMPACT) {
+        return capacity > size ? iv_resize(vector, size) : vector;
+    }
+    //halve only when under a quarter full, so alternating
+    //append and remove at the boundary doesn't thrash
+    if (capacity > IV_MIN_GROWABLE_CAPACITY && size < capacity / 4) {
+        return iv_resize(vector, capacity / 2);
+    }
     return vector;
 }
 
 static IntVector *iv_makeRoom(IntVector *vector, int64_t n) {
-    return iv_resize(vector, iv_totalBytes(vector) + n * iv_getEncoding(vector));
+    return iv_grow(vector, (uint64_t) IntVectorSize(vector) + n);
 }
 
 static IntVector *iv_upgradeIfNeeded(IntVector *vector, uint8_t valEnc) {
     uint8_t curEnc = iv_getEncoding(vector);
     if (valEnc > curEnc) {
-        iv_setEncoding(vector, valEnc);
-        vector = iv_resize(vector, iv_totalBytes(vector));
-
-        int64_t idx = iv_lastIdx(vector);
-        while (idx >= 0) {
-            int64_t val = iv_valueAtIdxByEncoding(vector, idx, curEnc);
-            iv_setValueAt(vector, idx, val);
-            idx--;
-        }
+        STATS_ADD(STATS_IV_UPGRADES, 1);
+        vector = iv_realloc(vector, IntVectorCapacity(vector), valEnc);
+        ivk_convert(iv_firstElement(vector), IntVectorSize(vector), curEnc, valEnc);
     }
     return vector;
 }
 
-IntVector *IntVectorNew() {
+//re-pack in place to width and base, every element must fit them
+static IntVector *iv_repack(IntVector *vector, uint8_t width, int64_t base) {
+    uint8_t curWidth = iv_width(vector), enc = INT_VECTOR_PACKED | width;
+    int64_t curBase = iv_base(vector);
+    STATS_ADD(STATS_IV_UPGRADES, 1);
+    if (width > curWidth) {
+        vector = iv_realloc(vector, IntVectorCapacity(vector), enc);
+    }
+    ivk_repack(iv_bits(vector), IntVectorSize(vector), curWidth, curBase, width, base);
+    iv_setBase(vector, base);
+    return width < curWidth ? iv_realloc(vector, IntVectorCapacity(vector), enc) : vector;
+}
+
+/*
+ * Widen a packed vector to hold lo to hi. Values above keep the
+ * base, values below anchor the new range at its top, so the base
+ * drops by the width it gains and repeated prepends only re-pack
+ * once per doubling.
+ */
+static IntVector *iv_fitPacked(IntVector *vector, int64_t lo, int64_t hi) {
+    int64_t base = iv_base(vector), top = iv_top(vector);
+    uint8_t width = iv_width(vector);
+    if (IntVectorIsEmpty(vector)) {
+        if (lo == base && hi <= top) {
+            return vector;
+        }
+        uint8_t need = ivk_widthFor((uint64_t) hi - (uint64_t) lo);
+        return iv_repack(vector, need > width ? need : width, lo);
+    }
+    if (lo >= base && hi <= top) {
+        return vector;
+    }
+    if (lo >= base) {
+        return iv_repack(vector, ivk_widthFor((uint64_t) hi - (uint64_t) base), base);
+    }
+    if (hi < top) hi = top;
+    width = ivk_widthFor((uint64_t) hi - (uint64_t) lo);
+    uint64_t mask = ivk_mask(width);
+    base = (uint64_t) hi - (uint64_t) INT64_MIN <= mask ? INT64_MIN : (int64_t) ((uint64_t) hi - mask);
+    return iv_repack(vector, width, base);
+}
+
+//make sure every value from lo to hi can be stored
+static IntVector *iv_fit(IntVector *vector, int64_t lo, int64_t hi) {
+    if (iv_isPacked(vector)) {
+        return iv_fitPacked(vector, lo, hi);
+    }
+    uint8_t loEnc = iv_encodingOf(lo), hiEnc = iv_encodingOf(hi);
+    return iv_upgradeIfNeeded(vector, loEnc > hiEnc ? loEnc : hiEnc);
+}
+
+//an empty vector with capacity slots of encoding, in one allocation
+static IntVector *iv_new(uint8_t mode, uint8_t encoding, uint32_t capacity) {
     IntVector *vector;
-    if ((vector = malloc(iv_headerBytes())) == NULL) {
+    if ((vector = mem_malloc(iv_bytesFor(capacity, encoding))) == NULL) {
         panic("IntVector malloc failed");
     }
     iv_setSize(vector, 0);
-    iv_setEncoding(vector, INT8_BYTES);
+    iv_setCapacity(vector, capacity);
+    iv_setEncoding(vector, encoding);
+    vector->mode = mode;
     return vector;
 }
 
+IntVector *IntVectorNewWithMode(uint8_t mode) {
+    if (mode != INT_VECTOR_COMPACT && mode != INT_VECTOR_GROWABLE) {
+        panic("IntVector unknown mode: %d\n", mode);
+    }
+    return iv_new(mode, INT8_BYTES, 0);
+}
+
+IntVector *IntVectorNew() {
+    return IntVectorNewWithMode(INT_VECTOR_COMPACT);
+}
+
+IntVector *IntVectorNewWithEncoding(uint8_t encoding, uint32_t capacity) {
+    if (encoding != INT8_BYTES && encoding != INT16_BYTES && encoding != INT32_BYTES && encoding != INT64_BYTES) {
+        panic("IntVector unknown encoding: %d\n", encoding);
+    }
+    return iv_new(INT_VECTOR_COMPACT, encoding, capacity);
+}
+
 inline void IntVectorFree(IntVector *vector){
-    free(vector);
+    mem_free(vector, iv_bytesFor(IntVectorCapacity(vector), iv_getEncoding(vector)));
 }
 
 IntVector *IntVectorSetValueAt(IntVector *vector, int64_t val, int64_t idx) {
+    STATS_LATENCY(STATS_CALL_IV_SET);
     if (idx < 0 || idx >= INT_VECTOR_MAX_SIZE - 1) {
         panic("idx is negative or greater than capacity: %ld\n", idx);
     }
-    vector = iv_upgradeIfNeeded(vector, iv_encodingOf(val));
-    if (idx <= iv_lastIdx(vector)) {
+    int64_t i = iv_lastIdx(vector) + 1;
+    if (idx > i) {
+        //the gap is filled with zeros
+        vector = iv_fit(vector, val < 0 ? val : 0, val > 0 ? val : 0);
+    } else {
+        vector = iv_fit(vector, val, val);
+    }
+    if (idx < i) {
         iv_setValueAt(vector, idx, val);
     } else {
-        int64_t i = iv_lastIdx(vector) + 1;
+        vector = iv_grow(vector, (uint64_t) idx + 1);
         iv_setSize(vector, (uint32_t) (idx + 1));
-        vector = iv_resize(vector, iv_totalBytes(vector));
-        while (i < idx) {
-            iv_setValueAt(vector, i, 0);
-            i++;
-        }
+        iv_zero(vector, i, idx - i);
         iv_setValueAt(vector, idx, val);
     }
     return vector;
@@ -151,33 +354,18 @@ int64_t IntVectorValueAt(IntVector *vector, int64_t idx) {
 }
 
 int64_t IntVectorIndexOf(IntVector *vector, int64_t val) {
-    if (IntVectorSize(vector) == 0) {
-        return -1;
-    }
-    for (int i = 0; i < IntVectorSize(vector); i++) {
-        if (iv_valueAt(vector, i) == val) {
-            return i;
+    if (iv_isPacked(vector)) {
+        if (val < iv_base(vector) || val > iv_top(vector)) {
+            return -1;
         }
+        return ivk_indexOfPacked(iv_bits(vector), iv_width(vector), IntVectorSize(vector),
+                                 (uint64_t) val - (uint64_t) iv_base(vector));
     }
-    return -1;
-}
-
-static inline void iv_shiftOneStepAtRight(IntVector *vector, int64_t start, int64_t end) {
-    iv_validIndex(vector, start);
-    iv_validIndex(vector, end);
-
-    int64_t i = end;
-    if (end + 1 >= IntVectorSize(vector)) {
-        panic("No extra space for shifting right: start %ld end %ld size %ld\n", start, end, IntVectorSize(vector));
-    }
-    while (i >= start) {
-        int64_t val = IntVectorValueAt(vector, i);
-        IntVectorSetValueAt(vector, val, i + 1);
-        i--;
-    }
+    return scan_indexOf(iv_firstElement(vector), IntVectorSize(vector), iv_getEncoding(vector), val);
 }
 
 IntVector *IntVectorInsert(IntVector *vector, int64_t val, int64_t idx) {
+    STATS_LATENCY(STATS_CALL_IV_INSERT);
     if (idx < 0 || idx >= INT_VECTOR_MAX_SIZE - 1) {
         panic("idx is negative or greater than capacity: %ld\n", idx);
     } else if (IntVectorIsFull(vector)) {
@@ -187,10 +375,10 @@ IntVector *IntVectorInsert(IntVector *vector, int64_t val, int64_t idx) {
     if (idx > iv_lastIdx(vector)) {
         return IntVectorSetValueAt(vector, val, idx);
     } else {
+        vector = iv_fit(vector, val, val);
         vector = iv_makeRoom(vector, 1);
-        int64_t tail = iv_lastIdx(vector);
+        iv_moveElements(vector, idx, idx + 1, IntVectorSize(vector) - idx);
         iv_setSize(vector, IntVectorSize(vector) + 1);
-        iv_shiftOneStepAtRight(vector, idx, tail);
         iv_setValueAt(vector, idx, val);
         return vector;
     }
@@ -200,22 +388,101 @@ IntVector *IntVectorPrepend(IntVector *vector, int64_t val) {
     return IntVectorInsert(vector, val, 0);
 }
 
-static inline void iv_shiftOneStepLeft(IntVector *vector, int64_t start, int64_t end) {
-    iv_validIndex(vector, start);
-    iv_validIndex(vector, end);
+IntVector *IntVectorAppendMany(IntVector *vector, const int64_t *vals, uint32_t n) {
+    if (n == 0) {
+        return vector;
+    }
+    int64_t min = vals[0], max = vals[0];
+    for (uint32_t i = 1; i < n; i++) {
+        if (vals[i] < min) min = vals[i];
+        if (vals[i] > max) max = vals[i];
+    }
+    vector = iv_fit(vector, min, max);
+    vector = iv_makeRoom(vector, n);
+    if (iv_isPacked(vector)) {
+        ivk_packMany(iv_bits(vector), iv_width(vector), iv_base(vector), IntVectorSize(vector), vals, n);
+    } else {
+        IVK_DISPATCH(iv_getEncoding(vector), , ivk_encode, iv_firstElement(vector), IntVectorSize(vector), vals, n);
+    }
+    iv_setSize(vector, IntVectorSize(vector) + n);
+    return vector;
+}
+
+#define IV_BLOCK 256
+
+IntVector *IntVectorAppendRange(IntVector *vector, IntVector *src, int64_t start, int64_t n) {
+    if (n == 0) {
+        return vector;
+    }
+    iv_validIndex(src, start);
+    iv_validIndex(src, start + n - 1);
+
+    uint8_t srcEnc = iv_getEncoding(src);
+    if (srcEnc == iv_getEncoding(vector) && !iv_isPacked(src)) {
+        vector = iv_makeRoom(vector, n);
+        memcpy(iv_elementAt(vector, IntVectorSize(vector)), iv_elementAt(src, start), (size_t) n * srcEnc);
+        iv_setSize(vector, (uint32_t) (IntVectorSize(vector) + n));
+        return vector;
+    }
 
-    size_t bytes = (end - start + 1) * (size_t) iv_getEncoding(vector);
-    memcpy(iv_elementAt(vector, start - 1), iv_elementAt(vector, start), bytes);
+    //re-encode a block at a time, widening only if values need it
+    vector = iv_makeRoom(vector, n);
+    int64_t block[IV_BLOCK];
+    for (int64_t i = 0; i < n; i += IV_BLOCK) {
+        int64_t len = n - i < IV_BLOCK ? n - i : IV_BLOCK;
+        iv_decode(src, start + i, len, block);
+        vector = IntVectorAppendMany(vector, block, (uint32_t) len);
+    }
+    return vector;
 }
 
 IntVector *IntVectorRemoveAt(IntVector *vector, int64_t idx) {
+    STATS_LATENCY(STATS_CALL_IV_REMOVE_AT);
     iv_validIndex(vector, idx);
 
     if (idx < iv_lastIdx(vector)) {
-        iv_shiftOneStepLeft(vector, idx + 1, iv_lastIdx(vector));
+        iv_moveElements(vector, idx + 1, idx, iv_lastIdx(vector) - idx);
     }
     iv_setSize(vector, IntVectorSize(vector) - 1);
-    return iv_resize(vector, iv_totalBytes(vector));
+    return iv_shrink(vector);
+}
+
+//resolve negative indexes and clamp, return 0 for an empty range
+static int iv_normalizeRange(IntVector *vector, int64_t *start, int64_t *stop) {
+    int64_t size = IntVectorSize(vector);
+    if (*start < 0) *start += size;
+    if (*stop < 0) *stop += size;
+    if (*start < 0) *start = 0;
+    if (*stop >= size) *stop = size - 1;
+    return *start <= *stop;
+}
+
+IntVector *IntVectorRemoveRange(IntVector *vector, int64_t start, int64_t stop) {
+    if (!iv_normalizeRange(vector, &start, &stop)) {
+        return vector;
+    }
+    iv_moveElements(vector, stop + 1, start, iv_lastIdx(vector) - stop);
+    iv_setSize(vector, IntVectorSize(vector) - (uint32_t) (stop - start + 1));
+    return iv_shrink(vector);
+}
+
+IntVector *IntVectorSlice(IntVector *vector, int64_t start, int64_t stop) {
+    uint8_t enc = iv_getEncoding(vector);
+    IntVector *slice = IntVectorNewWithMode(iv_getMode(vector));
+    if (!iv_normalizeRange(vector, &start, &stop)) {
+        return slice;
+    }
+    uint32_t n = (uint32_t) (stop - start + 1);
+    slice = iv_realloc(slice, n, enc);
+    if (iv_isPacked(vector)) {
+        uint8_t width = iv_width(vector);
+        iv_setBase(slice, iv_base(vector));
+        ivk_copyBits(iv_bits(slice), 0, iv_bits(vector), (uint64_t) start * width, (uint64_t) n * width);
+    } else {
+        memcpy(iv_firstElement(slice), iv_elementAt(vector, start), (size_t) n * enc);
+    }
+    iv_setSize(slice, n);
+    return slice;
 }
 
 IntVector *IntVectorRemove(IntVector *vector, int64_t val, int *success) {
@@ -245,31 +512,226 @@ IntVector *IntVectorRemoveTail(IntVector *vector, int64_t *val) {
     return IntVectorRemoveAt(vector, iv_lastIdx(vector));
 }
 
+int64_t IntVectorLowerBound(IntVector *vector, int64_t x) {
+    if (iv_isPacked(vector)) {
+        //every element lies between base and top
+        if (x <= iv_base(vector)) {
+            return 0;
+        } else if (x > iv_top(vector)) {
+            return IntVectorSize(vector);
+        }
+        return ivk_lowerBoundPacked(iv_bits(vector), iv_width(vector), IntVectorSize(vector),
+                                    (uint64_t) x - (uint64_t) iv_base(vector));
+    }
+    IVK_DISPATCH(iv_getEncoding(vector), return, ivk_lowerBound, iv_firstElement(vector), IntVectorSize(vector), x);
+}
+
 int64_t IntVectorBinarySearch(IntVector *vector, int64_t x) {
-    if (IntVectorIsEmpty(vector)) {
-        return -1;
+    int64_t idx = IntVectorLowerBound(vector, x);
+    if (idx < IntVectorSize(vector) && iv_valueAt(vector, idx) == x) {
+        return idx;
     }
+    return -1;
+}
+
+IntVector *IntVectorMergeSorted(IntVector *vector, const int64_t *vals, uint32_t n, uint32_t *added) {
+    int64_t size = IntVectorSize(vector), common;
 
-    int64_t lf = 0, rt = iv_lastIdx(vector);
+    //count values already present, so the vector grows exactly once
+    if (iv_isPacked(vector)) {
+        common = ivk_countCommonPacked(iv_bits(vector), iv_width(vector), iv_base(vector), size, vals, n);
+    } else {
+        IVK_DISPATCH(iv_getEncoding(vector), common =, ivk_countCommon, iv_firstElement(vector), size, vals, n);
+    }
+    uint32_t fresh = (uint32_t) (n - common);
+    if (added) *added = fresh;
+    if (fresh == 0) {
+        return vector;
+    }
 
-    while (lf <= rt) {
-        if (lf == rt) {
-            int64_t val = iv_valueAt(vector, lf);
-            return val == x ? lf : -1;
+    //values are sorted, so the widest one is at either end
+    vector = iv_fit(vector, vals[0], vals[n - 1]);
+    vector = iv_makeRoom(vector, fresh);
+    iv_setSize(vector, (uint32_t) (size + fresh));
+
+    if (iv_isPacked(vector)) {
+        ivk_mergeBackwardPacked(iv_bits(vector), iv_width(vector), iv_base(vector), size, vals, n, fresh);
+    } else {
+        IVK_DISPATCH(iv_getEncoding(vector), , ivk_mergeBackward, iv_firstElement(vector), size, vals, n, fresh);
+    }
+    return vector;
+}
+
+//callers check the vector is not empty
+static void iv_minMax(IntVector *vector, int64_t *min, int64_t *max) {
+    if (!iv_isPacked(vector)) {
+        IVK_DISPATCH(iv_getEncoding(vector), , ivk_minMax, iv_firstElement(vector), IntVectorSize(vector), min, max);
+        return;
+    }
+    int64_t size = IntVectorSize(vector), block[IV_BLOCK];
+    *min = INT64_MAX;
+    *max = INT64_MIN;
+    for (int64_t i = 0; i < size; i += IV_BLOCK) {
+        int64_t len = size - i < IV_BLOCK ? size - i : IV_BLOCK;
+        iv_decode(vector, i, len, block);
+        for (int64_t k = 0; k < len; k++) {
+            if (block[k] < *min) *min = block[k];
+            if (block[k] > *max) *max = block[k];
+        }
+    }
+}
+
+//copy every element into a new vector of encoding, then free vector
+static IntVector *iv_recode(IntVector *vector, uint8_t encoding, int64_t base) {
+    int64_t size = IntVectorSize(vector), block[IV_BLOCK];
+    IntVector *out = iv_realloc(IntVectorNewWithMode(iv_getMode(vector)), IntVectorCapacity(vector), encoding);
+    if (encoding & INT_VECTOR_PACKED) {
+        iv_setBase(out, base);
+    }
+    for (int64_t i = 0; i < size; i += IV_BLOCK) {
+        int64_t len = size - i < IV_BLOCK ? size - i : IV_BLOCK;
+        iv_decode(vector, i, len, block);
+        if (encoding & INT_VECTOR_PACKED) {
+            ivk_packMany(iv_bits(out), iv_width(out), base, i, block, len);
         } else {
-            int64_t mid = (lf + rt) / 2;
-
-            int64_t midVal = iv_valueAt(vector, mid);
-            if (x > midVal) {
-                lf = mid + 1;
-            } else if (x < midVal) {
-                rt = mid - 1;
-            } else {
-                return mid;
-            }
+            IVK_DISPATCH(encoding, , ivk_encode, iv_firstElement(out), i, block, len);
         }
     }
-    return -1;
+    iv_setSize(out, (uint32_t) size);
+    IntVectorFree(vector);
+    return out;
+}
+
+IntVector *IntVectorCompact(IntVector *vector) {
+    if (iv_isPacked(vector)) {
+        return IntVectorPack(vector);
+    }
+    uint8_t curEnc = iv_getEncoding(vector), enc = INT8_BYTES;
+    if (!IntVectorIsEmpty(vector)) {
+        int64_t min, max;
+        iv_minMax(vector, &min, &max);
+        uint8_t minEnc = iv_encodingOf(min), maxEnc = iv_encodingOf(max);
+        enc = minEnc > maxEnc ? minEnc : maxEnc;
+    }
+    if (enc >= curEnc) {
+        return vector;
+    }
+    //narrow in place first, the tail of the old block is then released
+    ivk_convert(iv_firstElement(vector), IntVectorSize(vector), curEnc, enc);
+    return iv_realloc(vector, IntVectorCapacity(vector), enc);
+}
+
+IntVector *IntVectorPack(IntVector *vector) {
+    int64_t min = 0, max = 0;
+    if (!IntVectorIsEmpty(vector)) {
+        iv_minMax(vector, &min, &max);
+    }
+    uint8_t width = ivk_widthFor((uint64_t) max - (uint64_t) min);
+    if (!iv_isPacked(vector)) {
+        //the base goes ahead of the elements, so they are copied out
+        return iv_recode(vector, INT_VECTOR_PACKED | width, min);
+    }
+    if (width == iv_width(vector) && min == iv_base(vector)) {
+        return vector;
+    }
+    return iv_repack(vector, width, min);
+}
+
+IntVector *IntVectorUnpack(IntVector *vector) {
+    if (!iv_isPacked(vector)) {
+        return vector;
+    }
+    uint8_t enc = INT8_BYTES;
+    if (!IntVectorIsEmpty(vector)) {
+        int64_t min, max;
+        iv_minMax(vector, &min, &max);
+        uint8_t minEnc = iv_encodingOf(min), maxEnc = iv_encodingOf(max);
+        enc = minEnc > maxEnc ? minEnc : maxEnc;
+    }
+    return iv_recode(vector, enc, 0);
+}
+
+int IntVectorIsPacked(IntVector *vector) {
+    return iv_isPacked(vector);
+}
+
+IntVector *IntVectorReserve(IntVector *vector, uint32_t capacity) {
+    if (capacity <= IntVectorCapacity(vector)) {
+        return vector;
+    }
+    return iv_resize(vector, capacity);
+}
+
+IntVector *IntVectorShrinkToFit(IntVector *vector) {
+    if (IntVectorCapacity(vector) == IntVectorSize(vector)) {
+        return vector;
+    }
+    return iv_resize(vector, IntVectorSize(vector));
+}
+
+int IntVectorSave(IntVector *vector, const char *path) {
+    //spare capacity is not saved
+    IntVector header = *vector;
+    header.capacity = header.size;
+    return blob_save(path, BLOB_TYPE_INT_VECTOR, &header, iv_headerBytes(), iv_firstElement(vector),
+                     iv_bytesFor(IntVectorSize(vector), iv_getEncoding(vector)) - iv_headerBytes());
+}
+
+static IntVector *iv_view(const void *addr, size_t len, int verify) {
+    uint64_t bytes;
+    IntVector *vector = (IntVector *) blob_view(addr, len, BLOB_TYPE_INT_VECTOR, verify, &bytes);
+    if (vector == NULL || bytes < iv_headerBytes()) {
+        return NULL;
+    }
+    uint8_t enc = iv_getEncoding(vector);
+    int packed = iv_isPacked(vector) && iv_width(vector) >= 1 && iv_width(vector) <= 64;
+    if ((!packed && enc != INT8_BYTES && enc != INT16_BYTES && enc != INT32_BYTES && enc != INT64_BYTES)
+        || (iv_getMode(vector) != INT_VECTOR_COMPACT && iv_getMode(vector) != INT_VECTOR_GROWABLE)
+        || IntVectorCapacity(vector) != IntVectorSize(vector)
+        || iv_bytesFor(IntVectorSize(vector), enc) != bytes) {
+        return NULL;
+    }
+    return vector;
+}
+
+IntVector *IntVectorViewFromMmap(const void *addr, size_t len, int verify) {
+    return iv_view(addr, len, verify);
+}
+
+void IntVectorMemoryUsage(IntVector *vector, IntVectorMemory *usage) {
+    uint8_t enc = iv_getEncoding(vector);
+    memset(usage, 0, sizeof(*usage));
+    usage->headerBytes = iv_headerBytes();
+    usage->logicalBytes = iv_bytesFor(IntVectorSize(vector), enc);
+    usage->allocatedBytes = iv_bytesFor(IntVectorCapacity(vector), enc);
+    usage->usableBytes = mem_usableSize(vector, usage->allocatedBytes);
+    usage->spareBytes = usage->allocatedBytes - usage->logicalBytes;
+    usage->encoding = enc;
+    if (!iv_isPacked(vector)) {
+        IVK_DISPATCH(enc, , ivk_countNeeds, iv_firstElement(vector), IntVectorSize(vector), usage->needs);
+        return;
+    }
+    int64_t size = IntVectorSize(vector), block[IV_BLOCK];
+    for (int64_t i = 0; i < size; i += IV_BLOCK) {
+        int64_t len = size - i < IV_BLOCK ? size - i : IV_BLOCK;
+        iv_decode(vector, i, len, block);
+        ivk_countNeeds64((const char *) block, len, usage->needs);
+    }
+}
+
+IntVector *IntVectorLoad(const char *path) {
+    size_t len;
+    const void *addr = BlobFileMap(path, &len);
+    IntVector *view = iv_view(addr, len, 1), *vector = NULL;
+    if (view) {
+        size_t bytes = iv_bytesFor(IntVectorCapacity(view), iv_getEncoding(view));
+        if ((vector = mem_malloc(bytes)) == NULL) {
+            panic("IntVector load: malloc failed\n");
+        }
+        memcpy(vector, view, bytes);
+    }
+    if (addr) BlobFileUnmap(addr, len);
+    return vector;
 }
 
 #define IV_ITER_HEAD 1
@@ -277,12 +739,14 @@ int64_t IntVectorBinarySearch(IntVector *vector, int64_t x) {
 
 static IntVectorIterator *iv_iter_new(IntVector *vector, int direction) {
     IntVectorIterator *iter;
-    if ((iter = malloc(sizeof(*iter))) == NULL) {
+    if ((iter = mem_malloc(sizeof(*iter))) == NULL) {
         panic("IntVector Iterator malloc failed\n");
     }
     iter->vector = vector;
     iter->direction = direction;
-    iter->curIdx = -1;
+    iter->curIdx = direction == IV_ITER_HEAD ? -1 : (int64_t) IntVectorSize(vector);
+    iter->blockStart = 0;
+    iter->blockLen = 0;
     return iter;
 }
 
@@ -301,24 +765,47 @@ int IntVectorIteratorHasNext(IntVectorIterator *iter) {
         if (iter->direction == IV_ITER_HEAD) {
             return iter->curIdx < iv_lastIdx(iter->vector);
         } else {
-            return iter->curIdx >= 1;
+            return iter->curIdx > 0;
         }
     }
 }
 
+void IntVectorIteratorFree(IntVectorIterator *iter) {
+    mem_free(iter, sizeof(*iter));
+}
+
 int64_t IntVectorIteratorNext(IntVectorIterator *iter) {
     if (iter->direction == IV_ITER_HEAD) {
         iter->curIdx++;
     } else {
         iter->curIdx--;
     }
-    return iv_valueAt(iter->vector, iter->curIdx);
+    IntVector *vector = iter->vector;
+    if (!iv_isPacked(vector)) {
+        return IntVectorValueAt(vector, iter->curIdx);
+    }
+    //decode the block ahead in the walking direction
+    int64_t idx = iter->curIdx;
+    if (idx < iter->blockStart || idx >= iter->blockStart + iter->blockLen) {
+        iv_validIndex(vector, idx);
+        int64_t start = idx;
+        if (iter->direction == IV_ITER_TAIL) {
+            start = idx - INT_VECTOR_ITER_BLOCK + 1 < 0 ? 0 : idx - INT_VECTOR_ITER_BLOCK + 1;
+        }
+        int64_t len = IntVectorSize(vector) - start;
+        iter->blockStart = start;
+        iter->blockLen = len < INT_VECTOR_ITER_BLOCK ? len : INT_VECTOR_ITER_BLOCK;
+        iv_decode(vector, start, iter->blockLen, iter->block);
+    }
+    return iter->block[idx - iter->blockStart];
 }
 
 //#define INT_VECTOR_TEST
 #ifdef INT_VECTOR_TEST
 
 #include <assert.h>
+#include <stdlib.h>
+#include <unistd.h>
 
 int main() {
     IntVector *vector = IntVectorNew();
@@ -340,6 +827,7 @@ int main() {
         assert(correct == x);
         correct++;
     }
+    IntVectorIteratorFree(iter);
 
     correct = 9;
     iter = IntVectorReverseIteratorNew(vector);
@@ -348,6 +836,7 @@ int main() {
         assert(correct == x);
         correct--;
     }
+    IntVectorIteratorFree(iter);
 
     int succ = 0;
     for(int i=0; i<10; i++){
@@ -371,6 +860,298 @@ int main() {
     assert(val == INT8_MAX);
     vector = IntVectorRemoveTail(vector, &val);
     assert(val == INT64_MAX);
+    assert(IntVectorCapacity(vector) == IntVectorSize(vector));
+    assert(vector->encoding == INT64_BYTES);
+    vector = IntVectorCompact(vector);
+    assert(vector->encoding == INT32_BYTES);
+    assert(IntVectorValueAt(vector, 0) == INT16_MAX && IntVectorValueAt(vector, 1) == INT32_MAX);
+    vector = IntVectorRemoveTail(vector, &val);
+    vector = IntVectorPrepend(vector, INT8_MIN);
+    vector = IntVectorCompact(vector);
+    assert(vector->encoding == INT16_BYTES);
+    assert(IntVectorValueAt(vector, 0) == INT8_MIN && IntVectorValueAt(vector, 1) == INT16_MAX);
+    IntVectorFree(vector);
+
+    vector = IntVectorNewWithMode(INT_VECTOR_GROWABLE);
+    for (int i = 0; i < 1000; i++) {
+        vector = IntVectorAppend(vector, i * 1000);
+    }
+    assert(IntVectorSize(vector) == 1000);
+    assert(IntVectorCapacity(vector) >= 1000 && IntVectorCapacity(vector) < 2000);
+    for (int i = 0; i < 1000; i++) {
+        assert(IntVectorValueAt(vector, i) == i * 1000);
+    }
+    while (IntVectorSize(vector) > 10) {
+        vector = IntVectorRemoveTail(vector, NULL);
+    }
+    assert(IntVectorCapacity(vector) < 1000);
+    vector = IntVectorShrinkToFit(vector);
+    assert(IntVectorCapacity(vector) == 10);
+    vector = IntVectorReserve(vector, 100);
+    assert(IntVectorCapacity(vector) == 100);
+    vector = IntVectorPrepend(vector, -1);
+    assert(IntVectorCapacity(vector) == 100);
+    assert(IntVectorValueAt(vector, 0) == -1 && IntVectorValueAt(vector, 10) == 9000);
+    IntVectorFree(vector);
+
+    vector = IntVectorNew();
+    for (int i = 0; i < 100; i += 2) {
+        vector = IntVectorAppend(vector, i);
+    }
+    assert(IntVectorLowerBound(vector, 51) == 26);
+    assert(IntVectorLowerBound(vector, 50) == 25);
+    assert(IntVectorLowerBound(vector, 1000) == 50);
+    assert(IntVectorBinarySearch(vector, 51) == -1);
+    vector = IntVectorInsert(vector, INT32_MIN, 0);
+    vector = IntVectorInsert(vector, 300, 50);
+    assert(IntVectorValueAt(vector, 0) == INT32_MIN);
+    assert(IntVectorValueAt(vector, 1) == 0);
+    assert(IntVectorValueAt(vector, 50) == 300);
+    assert(IntVectorValueAt(vector, 51) == 98);
+    assert(IntVectorIndexOf(vector, 98) == 51);
+    assert(IntVectorIndexOf(vector, INT64_MAX) == -1);
+    IntVectorFree(vector);
+
+    //every block goes back to the pool, through upgrades and narrowing
+    Allocator *pool = AllocatorPoolNew();
+    AllocatorUse(pool);
+    IntVector *vectors[20];
+    for (int v = 0; v < 20; v++) {
+        vectors[v] = IntVectorNewWithMode(v % 2 ? INT_VECTOR_GROWABLE : INT_VECTOR_COMPACT);
+        for (int i = 0; i < 300; i++) {
+            vectors[v] = IntVectorAppend(vectors[v], (int64_t) i << (v % 5 * 8));
+        }
+        assert(IntVectorValueAt(vectors[v], 299) == (int64_t) 299 << (v % 5 * 8));
+    }
+    for (int v = 0; v < 20; v++) {
+        for (int i = 0; i < 299; i++) {
+            vectors[v] = IntVectorRemove(vectors[v], (int64_t) i << (v % 5 * 8), &succ);
+        }
+        vectors[v] = IntVectorCompact(vectors[v]);
+        IntVectorFree(vectors[v]);
+    }
+    AllocatorStats stats = AllocatorGetStats(pool);
+    assert(stats.allocs == 20 && stats.frees == 20 && stats.bytesInUse == 0);
+    AllocatorUse(NULL);
+    AllocatorFree(pool);
+
+    //ranges, negative and clamped indexes
+    vector = IntVectorNewWithMode(INT_VECTOR_GROWABLE);
+    for (int i = 0; i < 100; i++) {
+        vector = IntVectorAppend(vector, i * 1000);
+    }
+    IntVector *slice = IntVectorSlice(vector, -10, 1000);
+    assert(IntVectorSize(slice) == 10 && IntVectorValueAt(slice, 0) == 90000);
+    assert(IntVectorValueAt(slice, 9) == 99000 && IntVectorCapacity(slice) == 10);
+    IntVectorFree(slice);
+    slice = IntVectorSlice(vector, 50, 10);
+    assert(IntVectorIsEmpty(slice));
+    IntVectorFree(slice);
+    vector = IntVectorRemoveRange(vector, 10, -11);
+    assert(IntVectorSize(vector) == 20);
+    assert(IntVectorValueAt(vector, 9) == 9000 && IntVectorValueAt(vector, 10) == 90000);
+    vector = IntVectorRemoveRange(vector, -200, 4);
+    assert(IntVectorSize(vector) == 15 && IntVectorValueAt(vector, 0) == 5000);
+    vector = IntVectorRemoveRange(vector, 15, 20);
+    assert(IntVectorSize(vector) == 15);
+    vector = IntVectorRemoveRange(vector, 0, -1);
+    assert(IntVectorIsEmpty(vector));
+    IntVectorFree(vector);
+
+    //saved, loaded and mapped back without spare capacity
+    const char *path = "/tmp/int_vector_test.bin";
+    vector = IntVectorNewWithMode(INT_VECTOR_GROWABLE);
+    for (int i = 0; i < 1000; i++) {
+        vector = IntVectorAppend(vector, (int64_t) i * 3 - 70000);
+    }
+    assert(IntVectorCapacity(vector) > IntVectorSize(vector) && IntVectorSave(vector, path));
+    IntVector *loaded = IntVectorLoad(path);
+    assert(loaded && IntVectorSize(loaded) == 1000 && IntVectorCapacity(loaded) == 1000);
+    loaded = IntVectorAppend(loaded, 1 << 30);
+    assert(IntVectorValueAt(loaded, 999) == 2997 - 70000 && IntVectorValueAt(loaded, 1000) == 1 << 30);
+    IntVectorFree(loaded);
+
+    size_t len;
+    const void *addr = BlobFileMap(path, &len);
+    IntVector *view = IntVectorViewFromMmap(addr, len, 1);
+    assert((const char *) view == (const char *) addr + sizeof(BlobFileHeader));
+    assert(IntVectorBinarySearch(view, 300 * 3 - 70000) == 300 && IntVectorBinarySearch(view, 1) == -1);
+    iter = IntVectorIteratorNew(view);
+    for (int i = 0; IntVectorIteratorHasNext(iter); i++) {
+        assert(IntVectorIteratorNext(iter) == (int64_t) i * 3 - 70000);
+    }
+    IntVectorIteratorFree(iter);
+    assert(IntVectorViewFromMmap(addr, len - 1, 0) == NULL);
+    BlobFileUnmap(addr, len);
+    IntVectorFree(vector);
+    unlink(path);
+    assert(IntVectorLoad(path) == NULL);
+
+    //memory by the width values need, spare slots of a growable vector
+    IntVectorMemory usage;
+    int64_t widths[] = {5, -300, 70000, INT64_MIN};
+    vector = IntVectorNewWithMode(INT_VECTOR_GROWABLE);
+    for (int i = 0; i < 100; i++) {
+        vector = IntVectorAppend(vector, widths[i % 4]);
+    }
+    IntVectorMemoryUsage(vector, &usage);
+    assert(usage.encoding == INT64_BYTES);
+    assert(usage.needs[0] == 25 && usage.needs[1] == 25 && usage.needs[2] == 25 && usage.needs[3] == 25);
+    assert(usage.logicalBytes == usage.headerBytes + 800);
+    assert(usage.spareBytes == (IntVectorCapacity(vector) - 100) * 8);
+    assert(usage.usableBytes >= usage.allocatedBytes && usage.allocatedBytes == usage.logicalBytes + usage.spareBytes);
+    IntVectorFree(vector);
+
+    //packed ids of a narrow range take 7 bits each
+    vector = IntVectorNew();
+    for (int i = 0; i <= 100; i++) {
+        vector = IntVectorAppend(vector, 1000000 + i);
+    }
+    vector = IntVectorPack(vector);
+    assert(IntVectorIsPacked(vector) && vector->encoding == (INT_VECTOR_PACKED | 7));
+    IntVectorMemoryUsage(vector, &usage);
+    assert(usage.logicalBytes == usage.headerBytes + 8 + (101 * 7 + 7) / 8 + 8 && usage.needs[2] == 101);
+    assert(IntVectorValueAt(vector, 0) == 1000000 && IntVectorValueAt(vector, 100) == 1000100);
+    assert(IntVectorBinarySearch(vector, 1000042) == 42 && IntVectorBinarySearch(vector, 999999) == -1);
+    assert(IntVectorLowerBound(vector, 0) == 0 && IntVectorLowerBound(vector, INT64_MAX) == 101);
+    assert(IntVectorIndexOf(vector, 1000100) == 100 && IntVectorIndexOf(vector, 1000200) == -1);
+    //appends above widen, a prepend below moves the base
+    vector = IntVectorAppend(vector, 1000300);
+    assert(vector->encoding == (INT_VECTOR_PACKED | 9) && IntVectorValueAt(vector, 101) == 1000300);
+    vector = IntVectorPrepend(vector, 999000);
+    assert(IntVectorValueAt(vector, 0) == 999000 && IntVectorValueAt(vector, 1) == 1000000);
+    assert(IntVectorValueAt(vector, 102) == 1000300 && IntVectorLowerBound(vector, 999001) == 1);
+    vector = IntVectorRemoveHead(vector, NULL);
+    vector = IntVectorRemoveTail(vector, NULL);
+    vector = IntVectorCompact(vector);
+    assert(vector->encoding == (INT_VECTOR_PACKED | 7) && IntVectorValueAt(vector, 100) == 1000100);
+
+    //slice, merge, iterate both ways, save and map back packed
+    slice = IntVectorSlice(vector, 3, 60);
+    assert(IntVectorIsPacked(slice) && IntVectorSize(slice) == 58 && IntVectorValueAt(slice, 57) == 1000060);
+    IntVectorFree(slice);
+    int64_t merge[] = {999999, 1000050, 1000101, 1000500};
+    uint32_t added;
+    vector = IntVectorMergeSorted(vector, merge, 4, &added);
+    assert(added == 3 && IntVectorSize(vector) == 104);
+    assert(IntVectorValueAt(vector, 0) == 999999 && IntVectorValueAt(vector, 103) == 1000500);
+    slice = IntVectorUnpack(IntVectorSlice(vector, 0, 103));
+    assert(!IntVectorIsPacked(slice));
+    IntVector *walked[2] = {vector, slice};
+    for (int w = 0; w < 2; w++) {
+        int visited = 0;
+        iter = IntVectorIteratorNew(walked[w]);
+        for (int i = 0; IntVectorIteratorHasNext(iter); i++, visited++) {
+            assert(IntVectorIteratorNext(iter) == IntVectorValueAt(vector, i));
+        }
+        IntVectorIteratorFree(iter);
+        assert(visited == 104);
+        visited = 0;
+        iter = IntVectorReverseIteratorNew(walked[w]);
+        for (int i = 103; IntVectorIteratorHasNext(iter); i--, visited++) {
+            assert(IntVectorIteratorNext(iter) == IntVectorValueAt(vector, i));
+        }
+        IntVectorIteratorFree(iter);
+        assert(visited == 104);
+    }
+    IntVectorFree(slice);
+    assert(IntVectorSave(vector, path));
+    addr = BlobFileMap(path, &len);
+    view = IntVectorViewFromMmap(addr, len, 1);
+    assert(view && IntVectorIsPacked(view) && IntVectorBinarySearch(view, 1000500) == 103);
+    BlobFileUnmap(addr, len);
+    loaded = IntVectorLoad(path);
+    loaded = IntVectorUnpack(loaded);
+    assert(!IntVectorIsPacked(loaded) && loaded->encoding == INT32_BYTES && IntVectorValueAt(loaded, 50) == 1000049);
+    IntVectorFree(loaded);
+    unlink(path);
+    IntVectorFree(vector);
+
+    //random edits against a plain array, over every width
+    int64_t shadow[600];
+    int n = 0;
+    vector = IntVectorPack(IntVectorNewWithMode(INT_VECTOR_GROWABLE));
+    srand(11);
+    for (int step = 0; step < 20000; step++) {
+        int op = rand() % 8, bits = rand() % 64;
+        int64_t x = (int64_t) ((uint64_t) rand() << 40 ^ (uint64_t) rand() << 20 ^ (uint64_t) rand());
+        x = bits == 63 ? (rand() % 2 ? INT64_MIN : INT64_MAX) : x % ((int64_t) 1 << bits);
+        if (step % 5000 == 4999) {
+            vector = IntVectorPack(vector);
+        }
+        if (op < 3 && n < 600) {
+            int at = rand() % (n + 1);
+            memmove(shadow + at + 1, shadow + at, (size_t) (n - at) * sizeof(int64_t));
+            shadow[at] = x;
+            n++;
+            vector = IntVectorInsert(vector, x, at);
+        } else if (op < 5 && n > 0) {
+            int at = rand() % n;
+            memmove(shadow + at, shadow + at + 1, (size_t) (n - at - 1) * sizeof(int64_t));
+            n--;
+            vector = IntVectorRemoveAt(vector, at);
+        } else if (op < 6 && n > 0) {
+            int at = rand() % n;
+            shadow[at] = x;
+            vector = IntVectorSetValueAt(vector, x, at);
+        } else if (op < 7 && n < 590) {
+            int64_t many[10];
+            for (int k = 0; k < 10; k++) many[k] = shadow[n++] = x / 2 + k * 1000;
+            vector = IntVectorAppendMany(vector, many, 10);
+        } else if (n > 20) {
+            vector = IntVectorRemoveRange(vector, 5, 9);
+            memmove(shadow + 5, shadow + 10, (size_t) (n - 10) * sizeof(int64_t));
+            n -= 5;
+        }
+        assert(IntVectorIsPacked(vector) && IntVectorSize(vector) == (uint32_t) n);
+        if (step % 97 == 0) {
+            for (int i = 0; i < n; i++) {
+                assert(IntVectorValueAt(vector, i) == shadow[i]);
+            }
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        assert(IntVectorIndexOf(vector, shadow[i]) != -1);
+    }
+    IntVectorFree(vector);
+
+    //sorted values over every width search like the byte encodings
+    for (int width = 1; width <= 64; width++) {
+        vector = IntVectorNew();
+        uint64_t span = width == 64 ? UINT64_MAX : ((uint64_t) 1 << width) - 1;
+        for (int i = 0; i <= 100; i++) {
+            vector = IntVectorAppend(vector, (int64_t) ((uint64_t) INT64_MIN + span / 100 * i + (i == 100 ? span % 100 : 0)));
+        }
+        vector = IntVectorPack(vector);
+        assert(vector->encoding == (INT_VECTOR_PACKED | width));
+        for (int i = 0; i <= 100; i++) {
+            int64_t x = IntVectorValueAt(vector, i);
+            assert(IntVectorLowerBound(vector, x) <= i && IntVectorBinarySearch(vector, x) != -1);
+        }
+        IntVectorFree(vector);
+    }
+    vector = IntVectorPack(IntVectorNew());
+    vector = IntVectorAppend(vector, INT64_MAX);
+    vector = IntVectorAppend(vector, INT64_MIN);
+    vector = IntVectorAppend(vector, 0);
+    assert(vector->encoding == (INT_VECTOR_PACKED | 64));
+    assert(IntVectorValueAt(vector, 0) == INT64_MAX && IntVectorValueAt(vector, 1) == INT64_MIN);
+    assert(IntVectorValueAt(vector, 2) == 0);
+    IntVectorFree(vector);
+
+    //a sized vector is a single allocation
+    AllocatorStats before = AllocatorGetStats(AllocatorDefault());
+    vector = IntVectorNewWithEncoding(INT32_BYTES, 1000);
+    AllocatorStats after = AllocatorGetStats(AllocatorDefault());
+    assert(after.allocs == before.allocs + 1 && after.reallocs == before.reallocs);
+    assert(IntVectorCapacity(vector) == 1000 && IntVectorSize(vector) == 0);
+    for (int i = 0; i < 1000; i++) {
+        vector = IntVectorAppend(vector, 100000 + i);
+    }
+    assert(AllocatorGetStats(AllocatorDefault()).reallocs == before.reallocs);
+    assert(IntVectorValueAt(vector, 999) == 100999);
+    IntVectorFree(vector);
+    return 0;
 }
 
 #endif
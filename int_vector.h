@@ -6,23 +6,49 @@
 #include <glob.h>
 #include <stdint.h>
 /**
- * IntVector is a COMPACTED dynamic sized array, which
- * means size is always equals to capacity.
+ * IntVector is a dynamic sized array of integers.
+ *
+ * In COMPACT mode (the default) the vector never keeps spare
+ * slots on its own: size equals capacity after every mutation,
+ * so each append or remove reallocs.
+ *
+ * In GROWABLE mode capacity grows geometrically and is only
+ * given back once the vector falls under a quarter full, so
+ * appends are amortized O(1).
+ *
+ * A packed vector (IntVectorPack) stores every element as its
+ * distance from a base, in just as many bits as the widest distance
+ * needs, 1 to 64. The base and the width follow the values: a value
+ * above the range widens it and one below moves the base down.
  */
 
 typedef struct __attribute__((__packed__)){
-    uint8_t encoding; // sizeof one element
+    uint8_t encoding; // sizeof one element, or INT_VECTOR_PACKED | bits of one element
+    uint8_t mode; // INT_VECTOR_COMPACT or INT_VECTOR_GROWABLE
     uint32_t size; // element count
+    uint32_t capacity; // element slots allocated
     char elements[];
 } IntVector;
 
 
 #define INT_VECTOR_MAX_SIZE UINT32_MAX
 
+#define INT_VECTOR_COMPACT 0
+#define INT_VECTOR_GROWABLE 1
+
+//encoding flag of a packed vector, the low bits are the width
+#define INT_VECTOR_PACKED 0x80
+
 IntVector *IntVectorNew();
+IntVector *IntVectorNewWithMode(uint8_t mode);
+/**
+ * Compact vector starting at encoding with capacity slots reserved.
+ */
+IntVector *IntVectorNewWithEncoding(uint8_t encoding, uint32_t capacity);
 void IntVectorFree(IntVector *vector);
 
 uint32_t IntVectorSize(IntVector *vector);
+uint32_t IntVectorCapacity(IntVector *vector);
 int IntVectorIsEmpty(IntVector *vector);
 int IntVectorIsFull(IntVector *vector);
 
@@ -32,6 +58,11 @@ IntVector *IntVectorSetValueAt(IntVector *vector, int64_t val, int64_t idx);
 IntVector *IntVectorInsert(IntVector *vector, int64_t val, int64_t idx);
 IntVector *IntVectorAppend(IntVector *vector, int64_t val);
 IntVector *IntVectorPrepend(IntVector *vector, int64_t val);
+IntVector *IntVectorAppendMany(IntVector *vector, const int64_t *vals, uint32_t n);
+/**
+ * Append n elements of src starting at start, src must not be vector.
+ */
+IntVector *IntVectorAppendRange(IntVector *vector, IntVector *src, int64_t start, int64_t n);
 
 int64_t IntVectorValueAt(IntVector *vector, int64_t idx);
 
@@ -40,12 +71,118 @@ IntVector *IntVectorRemoveAt(IntVector *vector, int64_t idx);
 IntVector *IntVectorRemoveHead(IntVector *vector, int64_t *val);
 IntVector *IntVectorRemoveTail(IntVector *vector, int64_t *val);
 
+/**
+ * Ranges are inclusive, a negative index counts from the end, -1
+ * being the last element. Out of range indexes are clamped and a
+ * range with start after stop is empty.
+ */
+
+/**
+ * Remove elements start to stop with one move and one resize.
+ */
+IntVector *IntVectorRemoveRange(IntVector *vector, int64_t start, int64_t stop);
+
+/**
+ * Copy elements start to stop into a new vector of the same
+ * encoding and mode.
+ */
+IntVector *IntVectorSlice(IntVector *vector, int64_t start, int64_t stop);
+
 int64_t IntVectorBinarySearch(IntVector *vector, int64_t x);
 
+/**
+ * Index of the first element not less than x in an ascending
+ * vector, size if there is none.
+ */
+int64_t IntVectorLowerBound(IntVector *vector, int64_t x);
+
+/**
+ * Merge n ascending, distinct values into an ascending vector,
+ * skipping values it already holds. The vector is upgraded and
+ * grown once, then filled by a single backward pass.
+ */
+IntVector *IntVectorMergeSorted(IntVector *vector, const int64_t *vals, uint32_t n, uint32_t *added);
+
+/**
+ * Re-encode to the narrowest encoding that holds every element.
+ * Encodings only widen on their own, call this after wide values
+ * were removed to get the memory back.
+ */
+IntVector *IntVectorCompact(IntVector *vector);
+
+/**
+ * Switch to the packed encoding, based at the smallest element and
+ * as wide as the distance to the largest one. On a packed vector
+ * this tightens base and width after removals, like Compact.
+ */
+IntVector *IntVectorPack(IntVector *vector);
+
+/**
+ * Switch back to the narrowest byte encoding.
+ */
+IntVector *IntVectorUnpack(IntVector *vector);
+
+int IntVectorIsPacked(IntVector *vector);
+
+/**
+ * Make sure at least capacity slots are allocated.
+ */
+IntVector *IntVectorReserve(IntVector *vector, uint32_t capacity);
+
+/**
+ * Give back every unused slot.
+ */
+IntVector *IntVectorShrinkToFit(IntVector *vector);
+
+/**
+ * Write the vector to a file, see blob_file.h. Return 1 on success.
+ */
+int IntVectorSave(IntVector *vector, const char *path);
+
+/**
+ * Read a saved vector into memory, NULL if the file is missing,
+ * damaged or of another kind.
+ */
+IntVector *IntVectorLoad(const char *path);
+
+/**
+ * Vector inside a mapped file (BlobFileMap), used in place without
+ * copying. Only pass it to calls that read, it lives in read only
+ * memory and must not be freed. NULL if the region doesn't hold a
+ * vector, the checksum is only checked when verify is set.
+ */
+IntVector *IntVectorViewFromMmap(const void *addr, size_t len, int verify);
+
+/**
+ * Memory held by a vector. needs[k] counts the elements whose value
+ * fits 1 << k bytes and no fewer, so it tells how much a narrower
+ * encoding would save, it takes a pass over the elements.
+ */
+typedef struct {
+    uint64_t logicalBytes; //header and elements in use
+    uint64_t allocatedBytes; //header and every slot, as asked from the allocator
+    uint64_t usableBytes; //what the allocator really handed out
+    uint64_t headerBytes;
+    uint64_t spareBytes; //slots allocated and not used
+    uint8_t encoding;
+    uint32_t needs[4];
+} IntVectorMemory;
+
+/**
+ * Call under the allocator the vector was made with, not on a view.
+ */
+void IntVectorMemoryUsage(IntVector *vector, IntVectorMemory *usage);
+
+//elements a packed vector is decoded ahead by while iterating
+#define INT_VECTOR_ITER_BLOCK 32
+
 typedef struct{
     IntVector *vector;
     int direction;
     int64_t curIdx;
+    int64_t blockStart; // index of block[0]
+    int64_t blockLen;
+    int64_t block[INT_VECTOR_ITER_BLOCK];
 } IntVectorIterator;
 
 
@@ -53,5 +190,6 @@ IntVectorIterator *IntVectorIteratorNew(IntVector *vector);
 IntVectorIterator *IntVectorReverseIteratorNew(IntVector *vector);
 int IntVectorIteratorHasNext(IntVectorIterator *iter);
 int64_t IntVectorIteratorNext(IntVectorIterator *iter);
+void IntVectorIteratorFree(IntVectorIterator *iter);
 
 #endif //INT_VECTOR_H
@@ -0,0 +1,497 @@
+#ifndef INT_VECTOR_KERNEL_H
+#define INT_VECTOR_KERNEL_H
+
+#include <stdint.h>
+#include <string.h>
+#include "integer.h"
+#include "panic.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/**
+ * Element kernels specialized per encoding, shared by IntVector
+ * and the structures built on it.
+ *
+ * Every kernel works on a raw element array. Callers check bounds
+ * and pick the kernel once per operation through IVK_DISPATCH,
+ * so inner loops only see plain typed loads and stores.
+ *
+ * Elements are not aligned (headers are packed), loads and stores
+ * go through memcpy which compiles to a single move.
+ */
+
+#define IVK_DEFINE(bits)                                                            \
+static inline int64_t ivk_get##bits(const char *elements, int64_t idx) {            \
+    int##bits##_t v;                                                                \
+    memcpy(&v, elements + idx * (int64_t) sizeof(v), sizeof(v));                    \
+    return v;                                                                       \
+}                                                                                   \
+                                                                                    \
+static inline void ivk_set##bits(char *elements, int64_t idx, int64_t val) {        \
+    int##bits##_t v = (int##bits##_t) val;                                          \
+    memcpy(elements + idx * (int64_t) sizeof(v), &v, sizeof(v));                    \
+}                                                                                   \
+                                                                                    \
+static inline int64_t ivk_indexOf##bits(const char *elements, int64_t n,            \
+                                        int64_t val) {                              \
+    if (bytesForInt(val) > sizeof(int##bits##_t)) return -1;                        \
+    int##bits##_t x = (int##bits##_t) val;                                          \
+    for (int64_t i = 0; i < n; i++) {                                               \
+        int##bits##_t v;                                                            \
+        memcpy(&v, elements + i * (int64_t) sizeof(v), sizeof(v));                  \
+        if (v == x) return i;                                                       \
+    }                                                                               \
+    return -1;                                                                      \
+}                                                                                   \
+                                                                                    \
+/* index of the first element not less than val, n if there is none */             \
+static inline int64_t ivk_lowerBound##bits(const char *elements, int64_t n,         \
+                                           int64_t val) {                           \
+    int64_t lf = 0, len = n;                                                        \
+    while (len > 0) {                                                               \
+        int64_t half = len / 2;                                                     \
+        if (ivk_get##bits(elements, lf + half) < val) {                             \
+            lf += half + 1;                                                         \
+            len -= half + 1;                                                        \
+        } else {                                                                    \
+            len = half;                                                             \
+        }                                                                           \
+    }                                                                               \
+    return lf;                                                                      \
+}                                                                                   \
+                                                                                    \
+static inline void ivk_decode##bits(const char *elements, int64_t start,            \
+                                    int64_t n, int64_t *out) {                      \
+    for (int64_t i = 0; i < n; i++) out[i] = ivk_get##bits(elements, start + i);    \
+}                                                                                   \
+                                                                                    \
+static inline void ivk_encode##bits(char *elements, int64_t start,                  \
+                                    const int64_t *vals, int64_t n) {               \
+    for (int64_t i = 0; i < n; i++) ivk_set##bits(elements, start + i, vals[i]);    \
+}                                                                                   \
+                                                                                    \
+static inline void ivk_minMax##bits(const char *elements, int64_t n,                \
+                                    int64_t *min, int64_t *max) {                   \
+    int##bits##_t lo = INT##bits##_MAX, hi = INT##bits##_MIN;                       \
+    for (int64_t i = 0; i < n; i++) {                                               \
+        int##bits##_t v;                                                            \
+        memcpy(&v, elements + i * (int64_t) sizeof(v), sizeof(v));                  \
+        lo = v < lo ? v : lo;                                                       \
+        hi = v > hi ? v : hi;                                                       \
+    }                                                                               \
+    *min = lo;                                                                      \
+    *max = hi;                                                                      \
+}                                                                                   \
+                                                                                    \
+/* needs[k] += elements that need 1 << k bytes */                                  \
+static inline void ivk_countNeeds##bits(const char *elements, int64_t n,            \
+                                        uint32_t *needs) {                          \
+    for (int64_t i = 0; i < n; i++) {                                               \
+        int64_t v = ivk_get##bits(elements, i);                                     \
+        needs[v == (int8_t) v ? 0 : v == (int16_t) v ? 1 : v == (int32_t) v ? 2 : 3]++; \
+    }                                                                               \
+}                                                                                   \
+                                                                                    \
+/* count values of the ascending array vals found in the ascending elements */      \
+static inline int64_t ivk_countCommon##bits(const char *elements, int64_t size,     \
+                                            const int64_t *vals, int64_t n) {       \
+    int64_t i = 0, j = 0, common = 0;                                               \
+    while (i < size && j < n) {                                                     \
+        int64_t x = ivk_get##bits(elements, i);                                     \
+        if (x < vals[j]) {                                                          \
+            i++;                                                                    \
+        } else if (x > vals[j]) {                                                   \
+            j++;                                                                    \
+        } else {                                                                    \
+            common++;                                                               \
+            i++;                                                                    \
+            j++;                                                                    \
+        }                                                                           \
+    }                                                                               \
+    return common;                                                                  \
+}                                                                                   \
+                                                                                    \
+/* merge from the back, elements must have room for size + fresh values */          \
+static inline void ivk_mergeBackward##bits(char *elements, int64_t size,            \
+                                           const int64_t *vals, int64_t n,          \
+                                           int64_t fresh) {                         \
+    int64_t i = size - 1, j = n - 1, k = size + fresh - 1;                          \
+    while (j >= 0) {                                                                \
+        if (i >= 0) {                                                               \
+            int64_t x = ivk_get##bits(elements, i);                                 \
+            if (x > vals[j]) {                                                      \
+                ivk_set##bits(elements, k--, x);                                    \
+                i--;                                                                \
+                continue;                                                           \
+            } else if (x == vals[j]) {                                              \
+                i--;                                                                \
+            }                                                                       \
+        }                                                                           \
+        ivk_set##bits(elements, k--, vals[j--]);                                    \
+    }                                                                               \
+}
+
+IVK_DEFINE(8)
+IVK_DEFINE(16)
+IVK_DEFINE(32)
+IVK_DEFINE(64)
+
+/**
+ * Call the kernel of an encoding, e.g.
+ * IVK_DISPATCH(enc, return, ivk_indexOf, elements, n, val);
+ */
+#define IVK_DISPATCH(enc, ret, kernel, ...)                                         \
+    switch (enc) {                                                                  \
+        case INT8_BYTES:                                                            \
+            ret kernel##8(__VA_ARGS__);                                             \
+            break;                                                                  \
+        case INT16_BYTES:                                                           \
+            ret kernel##16(__VA_ARGS__);                                            \
+            break;                                                                  \
+        case INT32_BYTES:                                                           \
+            ret kernel##32(__VA_ARGS__);                                            \
+            break;                                                                  \
+        case INT64_BYTES:                                                           \
+            ret kernel##64(__VA_ARGS__);                                            \
+            break;                                                                  \
+        default:                                                                    \
+            panic("unknown encoding: %d\n", enc);                                   \
+    }
+
+/*
+ * Re-encode n elements in place. Widening walks from the back
+ * and narrowing from the front, so no element is overwritten
+ * before it is read.
+ */
+#define IVK_DEFINE_CONVERT(from, to)                                                \
+static inline void ivk_convert##from##to(char *elements, int64_t n) {               \
+    if (sizeof(int##to##_t) > sizeof(int##from##_t)) {                              \
+        for (int64_t i = n - 1; i >= 0; i--)                                        \
+            ivk_set##to(elements, i, ivk_get##from(elements, i));                   \
+    } else {                                                                        \
+        for (int64_t i = 0; i < n; i++)                                             \
+            ivk_set##to(elements, i, ivk_get##from(elements, i));                   \
+    }                                                                               \
+}
+
+IVK_DEFINE_CONVERT(8, 16)
+IVK_DEFINE_CONVERT(8, 32)
+IVK_DEFINE_CONVERT(8, 64)
+IVK_DEFINE_CONVERT(16, 8)
+IVK_DEFINE_CONVERT(16, 32)
+IVK_DEFINE_CONVERT(16, 64)
+IVK_DEFINE_CONVERT(32, 8)
+IVK_DEFINE_CONVERT(32, 16)
+IVK_DEFINE_CONVERT(32, 64)
+IVK_DEFINE_CONVERT(64, 8)
+IVK_DEFINE_CONVERT(64, 16)
+IVK_DEFINE_CONVERT(64, 32)
+
+static inline void ivk_convert(char *elements, int64_t n, uint8_t from, uint8_t to) {
+#define IVK_CONVERT_CASE(f, t) \
+    case (INT##f##_BYTES << 4 | INT##t##_BYTES): ivk_convert##f##t(elements, n); break;
+
+    if (from == to) return;
+    switch (from << 4 | to) {
+        IVK_CONVERT_CASE(8, 16)
+        IVK_CONVERT_CASE(8, 32)
+        IVK_CONVERT_CASE(8, 64)
+        IVK_CONVERT_CASE(16, 8)
+        IVK_CONVERT_CASE(16, 32)
+        IVK_CONVERT_CASE(16, 64)
+        IVK_CONVERT_CASE(32, 8)
+        IVK_CONVERT_CASE(32, 16)
+        IVK_CONVERT_CASE(32, 64)
+        IVK_CONVERT_CASE(64, 8)
+        IVK_CONVERT_CASE(64, 16)
+        IVK_CONVERT_CASE(64, 32)
+        default:
+            panic("unknown conversion: %d to %d\n", from, to);
+    }
+#undef IVK_CONVERT_CASE
+}
+
+/**
+ * Bit packed kernels. Element idx takes bits idx * width to
+ * (idx + 1) * width - 1 of bits, counted from the low bit of the
+ * first byte, and holds its value minus a base as unsigned.
+ *
+ * Every access is one unaligned 8 byte word, plus the next byte
+ * when a width over 56 straddles the word, so 8 bytes past the
+ * last element must be readable.
+ */
+
+//bits a word loaded at any bit offset still covers
+#define IVK_WORD_BITS 56
+#define IVK_PACK_PAD 8
+
+static inline uint64_t ivk_mask(uint8_t width) {
+    return width == 64 ? UINT64_MAX : ((uint64_t) 1 << width) - 1;
+}
+
+//width that holds every delta up to range, at least 1
+static inline uint8_t ivk_widthFor(uint64_t range) {
+    return (uint8_t) (64 - __builtin_clzll(range | 1));
+}
+
+static inline uint64_t ivk_getBits(const char *bits, uint64_t pos, uint8_t width) {
+    uint64_t word;
+    uint32_t shift = pos & 7;
+    memcpy(&word, bits + (pos >> 3), sizeof(word));
+    word >>= shift;
+    if (shift + width > 64) {
+        word |= (uint64_t) (unsigned char) bits[(pos >> 3) + 8] << (64 - shift);
+    }
+    return word & ivk_mask(width);
+}
+
+//val must fit width
+static inline void ivk_putBits(char *bits, uint64_t pos, uint8_t width, uint64_t val) {
+    uint64_t word, mask = ivk_mask(width);
+    uint32_t shift = pos & 7;
+    memcpy(&word, bits + (pos >> 3), sizeof(word));
+    word = (word & ~(mask << shift)) | val << shift;
+    memcpy(bits + (pos >> 3), &word, sizeof(word));
+    if (shift + width > 64) {
+        unsigned char *spill = (unsigned char *) bits + (pos >> 3) + 8;
+        uint32_t high = shift + width - 64;
+        *spill = (unsigned char) ((*spill & ~((1u << high) - 1)) | val >> (64 - shift));
+    }
+}
+
+static inline uint64_t ivk_unpack(const char *bits, uint8_t width, int64_t idx) {
+    return ivk_getBits(bits, (uint64_t) idx * width, width);
+}
+
+static inline void ivk_pack(char *bits, uint8_t width, int64_t idx, uint64_t delta) {
+    ivk_putBits(bits, (uint64_t) idx * width, width, delta);
+}
+
+/*
+ * Decode n elements from start. Widths up to 56 never straddle, so
+ * the loop is a load, a shift and a mask per element.
+ */
+static inline void ivk_unpackMany(const char *bits, uint8_t width, int64_t base,
+                                  int64_t start, int64_t n, int64_t *out) {
+    uint64_t pos = (uint64_t) start * width, mask = ivk_mask(width);
+    if (width <= IVK_WORD_BITS) {
+        for (int64_t i = 0; i < n; i++, pos += width) {
+            uint64_t word;
+            memcpy(&word, bits + (pos >> 3), sizeof(word));
+            out[i] = (int64_t) ((uint64_t) base + ((word >> (pos & 7)) & mask));
+        }
+    } else {
+        for (int64_t i = 0; i < n; i++, pos += width) {
+            out[i] = (int64_t) ((uint64_t) base + ivk_getBits(bits, pos, width));
+        }
+    }
+}
+
+//values must lie in [base, base + mask(width)]
+static inline void ivk_packMany(char *bits, uint8_t width, int64_t base,
+                                int64_t start, const int64_t *vals, int64_t n) {
+    for (int64_t i = 0; i < n; i++) {
+        ivk_pack(bits, width, start + i, (uint64_t) vals[i] - (uint64_t) base);
+    }
+}
+
+static inline int64_t ivk_indexOfPacked(const char *bits, uint8_t width, int64_t n, uint64_t delta) {
+    if (width > IVK_WORD_BITS) {
+        for (int64_t i = 0; i < n; i++) {
+            if (ivk_unpack(bits, width, i) == delta) return i;
+        }
+        return -1;
+    }
+    uint64_t pos = 0, mask = ivk_mask(width);
+    for (int64_t i = 0; i < n; i++, pos += width) {
+        uint64_t word;
+        memcpy(&word, bits + (pos >> 3), sizeof(word));
+        if (((word >> (pos & 7)) & mask) == delta) return i;
+    }
+    return -1;
+}
+
+//index of the first delta not less than delta, n if there is none
+static inline int64_t ivk_lowerBoundPacked(const char *bits, uint8_t width, int64_t n, uint64_t delta) {
+    int64_t lf = 0, len = n;
+    while (len > 0) {
+        int64_t half = len / 2;
+        if (ivk_unpack(bits, width, lf + half) < delta) {
+            lf += half + 1;
+            len -= half + 1;
+        } else {
+            len = half;
+        }
+    }
+    return lf;
+}
+
+/*
+ * Move n bits in chunks read before they are written. Going down
+ * they run from the low chunks up and going up from the high ones
+ * down, so no chunk is overwritten before it is read.
+ */
+static inline void ivk_moveChunks(char *dst, uint64_t to, const char *src, uint64_t from, uint64_t n, int up) {
+    if (!up) {
+        for (uint64_t k = 0; k < n; k += IVK_WORD_BITS) {
+            uint8_t len = (uint8_t) (n - k < IVK_WORD_BITS ? n - k : IVK_WORD_BITS);
+            ivk_putBits(dst, to + k, len, ivk_getBits(src, from + k, len));
+        }
+    } else {
+        for (uint64_t k = n; k > 0;) {
+            uint8_t len = (uint8_t) (k < IVK_WORD_BITS ? k : IVK_WORD_BITS);
+            k -= len;
+            ivk_putBits(dst, to + k, len, ivk_getBits(src, from + k, len));
+        }
+    }
+}
+
+/*
+ * Fill words 8 byte words of dst with the bits of src starting
+ * shift bits into its first byte. In the same phase that is a
+ * memmove, otherwise every word is funneled from two loads, two
+ * words a step with SSE2. Reads up to 7 bytes past the last bit.
+ *
+ * Going up, dst may start less than a word above src, so the high
+ * word is carried from the step before instead of loaded again.
+ */
+static inline void ivk_moveWords(char *dst, const char *src, uint64_t words, uint32_t shift, int up) {
+    if (shift == 0) {
+        memmove(dst, src, words * 8);
+        return;
+    }
+    uint64_t lo, hi, word, i;
+#if defined(__SSE2__)
+    __m128i right = _mm_cvtsi32_si128((int) shift), left = _mm_cvtsi32_si128((int) (64 - shift));
+#endif
+    if (!up) {
+        i = 0;
+#if defined(__SSE2__)
+        for (; i + 2 <= words; i += 2) {
+            __m128i a = _mm_loadu_si128((const __m128i *) (src + i * 8));
+            __m128i b = _mm_loadu_si128((const __m128i *) (src + i * 8 + 8));
+            _mm_storeu_si128((__m128i *) (dst + i * 8), _mm_or_si128(_mm_srl_epi64(a, right), _mm_sll_epi64(b, left)));
+        }
+#endif
+        memcpy(&lo, src + i * 8, sizeof(lo));
+        for (; i < words; i++) {
+            memcpy(&hi, src + i * 8 + 8, sizeof(hi));
+            word = lo >> shift | hi << (64 - shift);
+            memcpy(dst + i * 8, &word, sizeof(word));
+            lo = hi;
+        }
+    } else {
+        i = words;
+        memcpy(&hi, src + words * 8, sizeof(hi));
+#if defined(__SSE2__)
+        __m128i next = _mm_loadl_epi64((const __m128i *) (src + words * 8));
+        for (; i >= 2; i -= 2) {
+            __m128i a = _mm_loadu_si128((const __m128i *) (src + i * 8 - 16));
+            __m128i b = _mm_or_si128(_mm_srli_si128(a, 8), _mm_slli_si128(next, 8));
+            _mm_storeu_si128((__m128i *) (dst + i * 8 - 16), _mm_or_si128(_mm_srl_epi64(a, right), _mm_sll_epi64(b, left)));
+            next = a;
+        }
+        _mm_storel_epi64((__m128i *) &hi, next);
+#endif
+        for (; i > 0; i--) {
+            memcpy(&lo, src + i * 8 - 8, sizeof(lo));
+            word = lo >> shift | hi << (64 - shift);
+            memcpy(dst + i * 8 - 8, &word, sizeof(word));
+            hi = lo;
+        }
+    }
+}
+
+/*
+ * Move n bits from bit from of src to bit to of dst. When both are
+ * one buffer the ranges may overlap, up tells they move to higher
+ * bits. The bits up to a byte boundary of to and the last partial
+ * word are merged in chunks, the rest goes a whole word at a time.
+ */
+static inline void ivk_moveBitsBetween(char *dst, uint64_t to, const char *src, uint64_t from, uint64_t n, int up) {
+    uint64_t head = (8 - (to & 7)) & 7;
+    if (head > n) head = n;
+    uint64_t words = (n - head) / 64, end = head + words * 64;
+    if (!up) {
+        ivk_moveChunks(dst, to, src, from, head, 0);
+    } else {
+        ivk_moveChunks(dst, to + end, src, from + end, n - end, 1);
+    }
+    ivk_moveWords(dst + ((to + head) >> 3), src + ((from + head) >> 3), words, (from + head) & 7, up);
+    if (!up) {
+        ivk_moveChunks(dst, to + end, src, from + end, n - end, 0);
+    } else {
+        ivk_moveChunks(dst, to, src, from, head, 1);
+    }
+}
+
+static inline void ivk_copyBits(char *dst, uint64_t to, const char *src, uint64_t from, uint64_t n) {
+    ivk_moveBitsBetween(dst, to, src, from, n, 0);
+}
+
+//move n bits from bit from to bit to, the ranges may overlap
+static inline void ivk_moveBits(char *bits, uint64_t to, uint64_t from, uint64_t n) {
+    if (to != from) {
+        ivk_moveBitsBetween(bits, to, bits, from, n, to > from);
+    }
+}
+
+/*
+ * Re-pack n elements in place to another width and base, every
+ * value must fit the new ones. Like ivk_convert, widening walks
+ * from the back and narrowing from the front.
+ */
+static inline void ivk_repack(char *bits, int64_t n, uint8_t fromWidth, int64_t fromBase,
+                              uint8_t toWidth, int64_t toBase) {
+    uint64_t shift = (uint64_t) fromBase - (uint64_t) toBase;
+    if (toWidth > fromWidth) {
+        for (int64_t i = n - 1; i >= 0; i--)
+            ivk_pack(bits, toWidth, i, ivk_unpack(bits, fromWidth, i) + shift);
+    } else {
+        for (int64_t i = 0; i < n; i++)
+            ivk_pack(bits, toWidth, i, ivk_unpack(bits, fromWidth, i) + shift);
+    }
+}
+
+//same as ivk_countCommon on packed elements
+static inline int64_t ivk_countCommonPacked(const char *bits, uint8_t width, int64_t base, int64_t size,
+                                            const int64_t *vals, int64_t n) {
+    int64_t i = 0, j = 0, common = 0;
+    while (i < size && j < n) {
+        int64_t x = (int64_t) ((uint64_t) base + ivk_unpack(bits, width, i));
+        if (x < vals[j]) {
+            i++;
+        } else if (x > vals[j]) {
+            j++;
+        } else {
+            common++;
+            i++;
+            j++;
+        }
+    }
+    return common;
+}
+
+//same as ivk_mergeBackward on packed elements, every value must fit
+static inline void ivk_mergeBackwardPacked(char *bits, uint8_t width, int64_t base, int64_t size,
+                                           const int64_t *vals, int64_t n, int64_t fresh) {
+    int64_t i = size - 1, j = n - 1, k = size + fresh - 1;
+    while (j >= 0) {
+        if (i >= 0) {
+            uint64_t x = ivk_unpack(bits, width, i);
+            int64_t val = (int64_t) ((uint64_t) base + x);
+            if (val > vals[j]) {
+                ivk_pack(bits, width, k--, x);
+                i--;
+                continue;
+            } else if (val == vals[j]) {
+                i--;
+            }
+        }
+        ivk_pack(bits, width, k--, (uint64_t) vals[j--] - (uint64_t) base);
+    }
+}
+
+#endif //INT_VECTOR_KERNEL_H
@@ -1,122 +1,188 @@
 
 #include "integer.h"
-#include <ctype.h>
+#include <string.h>
 #include "panic.h"
 
-inline uint8_t bytesForInt(int64_t val) {
-    if (val <= INT8_MAX && val >= INT8_MIN) {
-        return INT8_BYTES;
-    }
-    if (val <= INT16_MAX && val >= INT16_MIN) {
-        return INT16_BYTES;
-    }
-    if (val <= INT32_MAX && val >= INT32_MIN) {
-        return INT32_BYTES;
-    } else {
-        return INT64_BYTES;
-    }
-}
-
-inline uint8_t bytesForUnsignedInt(uint64_t val) {
-    if (val <= UINT8_MAX) {
-        return INT8_BYTES;
-    } else if (val <= UINT16_MAX) {
-        return INT16_BYTES;
-    } else if (val <= UINT32_MAX) {
-        return INT32_BYTES;
-    } else {
-        return INT64_BYTES;
-    }
-
-}
-
 inline int int_setValue(char *pt, int64_t val) {
     int bytes = bytesForInt(val);
-    switch (bytes) {
-        case INT8_BYTES:
-            ((int8_t *) pt)[0] = (int8_t) val;
+    int_setValueByType(pt, val, bytes);
+    return bytes;
+}
+
+//entries are packed, so values go through memcpy, not unaligned casts
+inline void int_setValueByType(char *pt, int64_t val, int type) {
+    switch (type) {
+        case INT8_BYTES: {
+            int8_t v = (int8_t) val;
+            memcpy(pt, &v, sizeof(v));
             break;
-        case INT16_BYTES:
-            ((int16_t *) pt)[0] = (int16_t) val;
+        }
+        case INT16_BYTES: {
+            int16_t v = (int16_t) val;
+            memcpy(pt, &v, sizeof(v));
             break;
-        case INT32_BYTES:
-            ((int32_t *) pt)[0] = (int32_t) val;
+        }
+        case INT32_BYTES: {
+            int32_t v = (int32_t) val;
+            memcpy(pt, &v, sizeof(v));
             break;
+        }
         case INT64_BYTES:
-            ((int64_t *) pt)[0] = (int64_t) val;
+            memcpy(pt, &val, sizeof(val));
             break;
         default:
-            panic("unknown encoding: %d\n", bytes);
+            panic("unknown bytes: %d\n", type);
             break;
     }
-    return bytes;
 }
 
 inline int64_t int_getValue(char *pt, int type) {
     switch (type) {
-        case INT8_BYTES:
-            return ((int8_t *) pt)[0];
-
-        case INT16_BYTES:
-            return ((int16_t *) pt)[0];
-
-        case INT32_BYTES:
-            return ((int32_t *) pt)[0];
-
-        case INT64_BYTES:
-            return ((int64_t *) pt)[0];
-
+        case INT8_BYTES: {
+            int8_t v;
+            memcpy(&v, pt, sizeof(v));
+            return v;
+        }
+        case INT16_BYTES: {
+            int16_t v;
+            memcpy(&v, pt, sizeof(v));
+            return v;
+        }
+        case INT32_BYTES: {
+            int32_t v;
+            memcpy(&v, pt, sizeof(v));
+            return v;
+        }
+        case INT64_BYTES: {
+            int64_t v;
+            memcpy(&v, pt, sizeof(v));
+            return v;
+        }
         default:
             panic("unknown bytes: %d\n", type);
             break;
     }
 }
 
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define INT_SWAR
+#endif
+
+#ifdef INT_SWAR
+
+//8 bytes are all '0' to '9'
+static inline int int_allDigits8(uint64_t chunk) {
+    return (chunk & (chunk + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) == 0x3030303030303030ULL;
+}
+
+//value of 8 digits, the first one in the lowest byte: pairs, then quads, then all 8
+static inline uint64_t int_parse8(uint64_t chunk) {
+    chunk -= 0x3030303030303030ULL;
+    chunk = (chunk * 10 + (chunk >> 8)) & 0x00FF00FF00FF00FFULL;
+    chunk = (chunk * 100 + (chunk >> 16)) & 0x0000FFFF0000FFFFULL;
+    return (chunk * 10000 + (chunk >> 32)) & 0xFFFFFFFFULL;
+}
+
+#endif
+
 int string2int(char *str, uint64_t len, int64_t *ret) {
-    if (len >= UINT8_MAX) {
+    if (len == 0 || len > INT_STRING_MAX) {
+        return 0;
+    }
+    int neg = str[0] == '-';
+    const char *pt = str + neg;
+    uint64_t digits = len - neg;
+    //canonical: no empty number, no leading zero, no "-0"
+    if (digits == 0 || (pt[0] == '0' && (digits > 1 || neg)) || digits > 19) {
         return 0;
     }
-    int64_t result = 0, weight = 1;
-
-    for (int64_t i = len - 1; i >= 0; i--) {
-        char c = str[i];
-        if (isdigit(c)) {
-            result += weight * (c - '0');
-            weight *= 10;
-        } else if (c == '-' && i == 0) {
-            result = -result;
-        } else {
-            return 0;
+
+    //19 digits fit an uint64_t, the range is checked once at the end
+    //a bad digit is remembered rather than branched on, one test at the end
+    uint64_t val = 0;
+    int bad = 0;
+    uint64_t head = digits % 8;
+    for (uint64_t i = 0; i < head; i++) {
+        unsigned char d = (unsigned char) (pt[i] - '0');
+        bad |= d > 9;
+        val = val * 10 + d;
+    }
+    for (pt += head, digits -= head; digits > 0; pt += 8, digits -= 8) {
+#ifdef INT_SWAR
+        uint64_t chunk;
+        memcpy(&chunk, pt, 8);
+        bad |= !int_allDigits8(chunk);
+        val = val * 100000000 + int_parse8(chunk);
+#else
+        for (int i = 0; i < 8; i++) {
+            unsigned char d = (unsigned char) (pt[i] - '0');
+            bad |= d > 9;
+            val = val * 10 + d;
         }
+#endif
     }
 
-    if (ret) *ret = result;
+    if (bad || val > (uint64_t) INT64_MAX + neg) {
+        return 0;
+    }
+    if (ret) *ret = neg ? (int64_t) (0 - val) : (int64_t) val;
     return 1;
 }
 
+static const uint64_t int_pow10[20] = {
+        1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+        100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL,
+        10000000000000ULL, 100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+        100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL
+};
+
+//digits of u > 0: log10 estimated from log2, then corrected by one compare
+static inline uint8_t int_digits(uint64_t u) {
+    uint32_t t = (uint32_t) (64 - __builtin_clzll(u)) * 1233 >> 12;
+    return (uint8_t) (t + (u >= int_pow10[t]));
+}
+
 uint8_t countDigit(int64_t val) {
-    uint8_t ret = 0;
-    while (val != 0) {
-        ret++;
-        val /= 10;
-    }
-    return ret;
+    uint64_t u = val < 0 ? 0 - (uint64_t) val : (uint64_t) val;
+    return u == 0 ? 0 : int_digits(u);
 }
 
-uint8_t bitCount(int64_t val) {
-    uint8_t ret = 0;
-    while (val != 0) {
-        ret++;
-        val >>= 1;
+static const char int_digitPairs[201] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+
+int int2string(char *buf, int64_t val) {
+    uint64_t u = val < 0 ? 0 - (uint64_t) val : (uint64_t) val;
+    int neg = val < 0;
+    if (u < 10) {
+        buf[0] = '-';
+        buf[neg] = (char) ('0' + u);
+        return neg + 1;
+    }
+    int len = neg + int_digits(u);
+    char *pt = buf + len;
+    //two digits per division
+    while (u >= 100) {
+        pt -= 2;
+        memcpy(pt, int_digitPairs + u % 100 * 2, 2);
+        u /= 100;
     }
-    return ret;
+    if (u >= 10) {
+        pt -= 2;
+        memcpy(pt, int_digitPairs + u * 2, 2);
+    } else {
+        *--pt = (char) ('0' + u);
+    }
+    if (neg) buf[0] = '-';
+    return len;
 }
 
-
 //#define INTEGER_TEST
 #ifdef INTEGER_TEST
 
 #include <assert.h>
+#include <stdio.h>
 
 int main(){
     int64_t  ret, success;
@@ -129,6 +195,58 @@ int main(){
 
     success = string2int("abc", 3, &ret);
     assert(!success);
+
+    //overflow and non canonical forms are strings, ret untouched
+    char *rejects[] = {"", "-", "007", "-0", "00", "+5", " 5", "5 ", "1234567a9", "12345678901234567a",
+                       "9223372036854775808", "-9223372036854775809", "99999999999999999999",
+                       "184467440737095516160", "1:345678"};
+    for (int i = 0; i < (int) (sizeof(rejects) / sizeof(rejects[0])); i++) {
+        ret = 42;
+        assert(!string2int(rejects[i], strlen(rejects[i]), &ret) && ret == 42);
+    }
+    assert(string2int("9223372036854775807", 19, &ret) && ret == INT64_MAX);
+    assert(string2int("-9223372036854775808", 20, &ret) && ret == INT64_MIN);
+    assert(string2int("0", 1, &ret) && ret == 0);
+    assert(string2int("12345678", 8, &ret) && ret == 12345678);
+    assert(string2int("-1000000000000000000", 20, &ret) && ret == -1000000000000000000);
+
+    //round trips through the formatter, across every digit count
+    char buf[INT_STRING_MAX + 1];
+    int64_t vals[] = {0, 1, -1, 9, 10, -10, 99, 100, INT64_MAX, INT64_MIN, INT32_MIN, UINT32_MAX};
+    for (int i = 0; i < (int) (sizeof(vals) / sizeof(vals[0])); i++) {
+        int len = int2string(buf, vals[i]);
+        buf[len] = 0;
+        char expect[32];
+        sprintf(expect, "%ld", (long) vals[i]);
+        assert(strcmp(buf, expect) == 0);
+        assert(string2int(buf, (uint64_t) len, &ret) && ret == vals[i]);
+    }
+    uint64_t x = 88172645463325252ULL;
+    for (int i = 0; i < 200000; i++) {
+        x ^= x << 13, x ^= x >> 7, x ^= x << 17;
+        int64_t val = (int64_t) (x >> (x % 64));
+        val = i % 2 ? val : -val;
+        int len = int2string(buf, val);
+        assert(string2int(buf, (uint64_t) len, &ret) && ret == val);
+
+        uint64_t u = val < 0 ? 0 - (uint64_t) val : (uint64_t) val;
+        uint8_t digits = 0, bits = 0;
+        for (uint64_t t = u; t != 0; t /= 10) digits++;
+        for (int64_t t = val < 0 ? ~val : val; t != 0; t >>= 1) bits++;
+        assert(countDigit(val) == digits && len == digits + (val < 0) + (val == 0));
+        assert(bitCount(val) == bits);
+    }
+
+    assert(bytesForInt(127) == 1 && bytesForInt(-128) == 1 && bytesForInt(128) == 2);
+    assert(bytesForInt(-32769) == 4 && bytesForInt(INT32_MAX) == 4 && bytesForInt((int64_t) INT32_MAX + 1) == 8);
+    assert(bytesForInt(INT64_MIN) == 8 && bytesForInt(0) == 1 && bytesForInt(-1) == 1);
+    assert(bytesForUnsignedInt(255) == 1 && bytesForUnsignedInt(256) == 2 && bytesForUnsignedInt(UINT64_MAX) == 8);
+    assert(bitCount(0) == 0 && bitCount(-1) == 0 && bitCount(5) == 3 && bitCount(INT64_MIN) == 63);
+
+    char packed[9];
+    int_setValueByType(packed + 1, -2, INT64_BYTES);
+    assert(int_getValue(packed + 1, INT64_BYTES) == -2 && int_setValue(packed + 1, 300) == 2);
+    assert(int_getValue(packed + 1, INT16_BYTES) == 300);
     return 0;
 }
 #endif
\ No newline at end of file
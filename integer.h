@@ -1,4 +1,3 @@
-
 #ifndef INTEGER_H
 #define INTEGER_H
 
@@ -11,16 +10,54 @@
 #define INT32_BYTES _INT_BYTES(32)
 #define INT64_BYTES _INT_BYTES(64)
 
+//longest int64 as text, "-9223372036854775808"
+#define INT_STRING_MAX 20
+
+//bytes of the encoding holding bits significant bits, 1 to 64
+static const uint8_t int_bytesForBits[8] = {1, 2, 4, 4, 8, 8, 8, 8};
+
 /**
  * Get number of bytes to store an integer.
  */
-uint8_t bytesForInt(int64_t val);
-uint8_t bytesForUnsignedInt(uint64_t val);
+static inline uint8_t bytesForInt(int64_t val) {
+    //bits besides the copies of the sign bit, plus the sign bit
+    int bits = 64 - __builtin_clrsbll(val);
+    return int_bytesForBits[(bits - 1) >> 3];
+}
+
+static inline uint8_t bytesForUnsignedInt(uint64_t val) {
+    int bits = 64 - __builtin_clzll(val | 1);
+    return int_bytesForBits[(bits - 1) >> 3];
+}
+
+/**
+ * Bits of val besides its sign, 0 for 0 and -1.
+ */
+static inline uint8_t bitCount(int64_t val) {
+    return (uint8_t) (63 - __builtin_clrsbll(val));
+}
 
 int int_setValue(char *pt, int64_t val);
+void int_setValueByType(char *pt, int64_t val, int type);
 int64_t int_getValue(char *pt, int type);
+
+/**
+ * Parse an integer in canonical form: optional '-', then digits
+ * without leading zeros, "0" for zero. Anything else, "-0" and
+ * values out of int64 range included, returns 0 and ret is left
+ * alone. So a string parses only if int2string gives it back.
+ */
 int string2int(char *str, uint64_t len, int64_t *ret);
+
+/**
+ * Write val in canonical form into buf, at least INT_STRING_MAX
+ * bytes, no terminating zero. Return the length.
+ */
+int int2string(char *buf, int64_t val);
+
+/**
+ * Decimal digits of val without sign, 0 for 0.
+ */
 uint8_t countDigit(int64_t val);
-uint8_t bitCount(int64_t val);
 
 #endif //INTEGER_H
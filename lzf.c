@@ -0,0 +1,231 @@
+#include <string.h>
+#include "lzf.h"
+
+#define LZF_HASH_BITS 12
+#define LZF_HASH_SIZE (1 << LZF_HASH_BITS)
+
+//literals one control byte covers
+#define LZF_MAX_LIT 32
+
+//bytes of the longest back reference
+#define LZF_REF_BYTES 3
+
+static inline uint32_t lzf_hash(const unsigned char *pt) {
+    uint32_t val = (uint32_t) pt[0] << 16 | (uint32_t) pt[1] << 8 | pt[2];
+    return (val * 2654435761u) >> (32 - LZF_HASH_BITS);
+}
+
+/*
+ * The table keeps the last position of every hashed 3 byte prefix,
+ * a stale or colliding slot costs a compare and is skipped. The
+ * control byte of the literals being collected is reserved ahead
+ * and dropped again if none follow.
+ */
+uint32_t lzf_compress(const void *in, uint32_t inLen, void *out, uint32_t outLen) {
+    const unsigned char *base = in, *ip = base, *end = base + inLen;
+    unsigned char *op = out, *oend = op + outLen;
+    uint32_t table[LZF_HASH_SIZE];
+    memset(table, 0, sizeof(table));
+
+    if (outLen == 0) {
+        return 0;
+    }
+    unsigned char *litCtrl = op++;
+    uint32_t lit = 0;
+
+    while (ip < end) {
+        if (end - ip > 2) {
+            uint32_t h = lzf_hash(ip);
+            const unsigned char *ref = base + table[h];
+            table[h] = (uint32_t) (ip - base);
+            uint32_t off = (uint32_t) (ip - ref) - 1;
+            if (ref < ip && off < LZF_MAX_OFF && ref[0] == ip[0] && ref[1] == ip[1] && ref[2] == ip[2]) {
+                uint32_t len = 3, maxLen = end - ip < LZF_MAX_REF ? (uint32_t) (end - ip) : LZF_MAX_REF;
+                while (len < maxLen && ref[len] == ip[len]) {
+                    len++;
+                }
+                if (lit) {
+                    *litCtrl = (unsigned char) (lit - 1);
+                    lit = 0;
+                } else {
+                    op--;
+                }
+                //the reference and the next control byte
+                if (oend - op < LZF_REF_BYTES + 1) {
+                    return 0;
+                }
+                uint32_t code = len - 2;
+                if (code < 7) {
+                    *op++ = (unsigned char) (code << 5 | off >> 8);
+                } else {
+                    *op++ = (unsigned char) (7 << 5 | off >> 8);
+                    *op++ = (unsigned char) (code - 7);
+                }
+                *op++ = (unsigned char) off;
+                litCtrl = op++;
+
+                //later matches may start inside this one
+                const unsigned char *stop = ip + len;
+                for (ip++; ip < stop && end - ip > 2; ip++) {
+                    table[lzf_hash(ip)] = (uint32_t) (ip - base);
+                }
+                ip = stop;
+                continue;
+            }
+        }
+        if (op >= oend) {
+            return 0;
+        }
+        *op++ = *ip++;
+        if (++lit == LZF_MAX_LIT) {
+            *litCtrl = LZF_MAX_LIT - 1;
+            lit = 0;
+            if (ip < end) {
+                if (op >= oend) {
+                    return 0;
+                }
+                litCtrl = op++;
+            } else {
+                litCtrl = NULL;
+            }
+        }
+    }
+    if (lit) {
+        *litCtrl = (unsigned char) (lit - 1);
+    } else if (litCtrl) {
+        op--;
+    }
+    return (uint32_t) (op - (unsigned char *) out);
+}
+
+uint32_t lzf_decompress(const void *in, uint32_t inLen, void *out, uint32_t outLen) {
+    const unsigned char *ip = in, *end = ip + inLen;
+    unsigned char *start = out, *op = start, *oend = op + outLen;
+
+    while (ip < end) {
+        uint32_t ctrl = *ip++;
+        if (ctrl < LZF_MAX_LIT) {
+            uint32_t len = ctrl + 1;
+            if ((uint32_t) (end - ip) < len || (uint32_t) (oend - op) < len) {
+                return 0;
+            }
+            //a whole control's worth is one fixed copy while both sides have room
+            if (end - ip >= LZF_MAX_LIT && oend - op >= LZF_MAX_LIT) {
+                memcpy(op, ip, LZF_MAX_LIT);
+            } else {
+                memcpy(op, ip, len);
+            }
+            op += len;
+            ip += len;
+            continue;
+        }
+        uint32_t len = ctrl >> 5;
+        if (len == 7) {
+            if (ip >= end) {
+                return 0;
+            }
+            len += *ip++;
+        }
+        len += 2;
+        if (ip >= end) {
+            return 0;
+        }
+        uint32_t back = ((ctrl & 0x1F) << 8 | *ip++) + 1;
+        if (back > (uint32_t) (op - start) || (uint32_t) (oend - op) < len) {
+            return 0;
+        }
+        const unsigned char *ref = op - back;
+        if (back >= 8 && (uint32_t) (oend - op) >= len + 8) {
+            //8 bytes at a time, each read is of bytes written before it
+            unsigned char *stop = op + len;
+            do {
+                memcpy(op, ref, 8);
+                op += 8;
+                ref += 8;
+            } while (op < stop);
+            op = stop;
+        } else {
+            //overlapping by less than 8 or near the end, a byte at a time
+            //repeats the last back bytes
+            while (len--) {
+                *op++ = *ref++;
+            }
+        }
+    }
+    return (uint32_t) (op - start);
+}
+
+//#define LZF_TEST
+#ifdef LZF_TEST
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static void lzf_roundTrip(const unsigned char *data, uint32_t len) {
+    //incompressible input grows by a control byte per 32 literals
+    uint32_t room = len + len / LZF_MAX_LIT + 1;
+    unsigned char *packed = malloc(room), *back = malloc(len + 1);
+    uint32_t packedLen = lzf_compress(data, len, packed, room);
+    assert(len == 0 || packedLen > 0);
+    assert(lzf_decompress(packed, packedLen, back, len) == len);
+    assert(memcmp(back, data, len) == 0);
+    //one byte short of the output is rejected, not overrun
+    if (len > 0) {
+        assert(lzf_decompress(packed, packedLen, back, len - 1) == 0);
+    }
+    //cutting the input never reads past it
+    for (uint32_t cut = 1; cut < packedLen && cut < 64; cut++) {
+        assert(lzf_decompress(packed, packedLen - cut, back, len) < len);
+    }
+    free(packed);
+    free(back);
+}
+
+int main() {
+    srand(7);
+    unsigned char buf[70000];
+
+    lzf_roundTrip(buf, 0);
+    buf[0] = 'x';
+    lzf_roundTrip(buf, 1);
+
+    //random bytes don't shrink and take the worst case room
+    for (int i = 0; i < 70000; i++) buf[i] = (unsigned char) rand();
+    lzf_roundTrip(buf, 70000);
+    unsigned char small[70000];
+    assert(lzf_compress(buf, 70000, small, 69999) == 0);
+
+    //a single byte repeated, every reference overlaps its output
+    memset(buf, 'a', 70000);
+    lzf_roundTrip(buf, 70000);
+    uint32_t packed = lzf_compress(buf, 70000, small, sizeof(small));
+    assert(packed > 0 && packed < 70000 / 50);
+
+    //text with repeats further apart than the window
+    uint32_t len = 0;
+    for (int i = 0; len < 69000; i++) {
+        len += (uint32_t) sprintf((char *) buf + len, "entry %d of %d;", i % 700, i % 13);
+    }
+    lzf_roundTrip(buf, len);
+    packed = lzf_compress(buf, len, small, sizeof(small));
+    assert(packed > 0 && packed < len / 2);
+
+    //short inputs of few symbols hit every length
+    for (uint32_t n = 2; n < 600; n += 7) {
+        for (uint32_t i = 0; i < n; i++) buf[i] = (unsigned char) "abab"[rand() % 4];
+        lzf_roundTrip(buf, n);
+    }
+
+    //references reaching before the output
+    unsigned char bad[] = {0, 'a', 0x20, 0x05};
+    assert(lzf_decompress(bad, sizeof(bad), small, sizeof(small)) == 0);
+    bad[3] = 0;
+    assert(lzf_decompress(bad, sizeof(bad), small, sizeof(small)) == 4);
+    assert(memcmp(small, "aaaa", 4) == 0);
+
+    printf("lzf test passed\n");
+    return 0;
+}
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef LZF_H
+#define LZF_H
+
+#include <stdint.h>
+
+/**
+ * Byte oriented LZ77 codec in the LZF format, fast on both sides
+ * and good enough for the repetitive bytes of an encoded list.
+ *
+ * [000 lllll] literals, l + 1 bytes follow
+ * [lll ooooo] [o] back reference of l + 2 bytes, l below 7
+ * [111 ooooo] [l] [o] back reference of l + 9 bytes
+ *
+ * The offset is 13 bits, a reference copies from offset + 1 bytes
+ * behind the output.
+ */
+
+//longest back reference, the 8 bit length after the 7 of the control
+#define LZF_MAX_REF (7 + 255 + 2)
+
+//window a back reference can reach
+#define LZF_MAX_OFF (1 << 13)
+
+/**
+ * Compress inLen bytes into out, return the bytes written or 0 if
+ * they don't fit into outLen. Giving less room than the input is
+ * the usual way to only keep results that shrink.
+ */
+uint32_t lzf_compress(const void *in, uint32_t inLen, void *out, uint32_t outLen);
+
+/**
+ * Expand inLen bytes into out, return the bytes written or 0 if
+ * the input is damaged or expands past outLen.
+ */
+uint32_t lzf_decompress(const void *in, uint32_t inLen, void *out, uint32_t outLen);
+
+#endif //LZF_H
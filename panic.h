@@ -6,6 +6,6 @@
 #include <stdarg.h>
 #include <stdio.h>
 
-void panic(char *format, ...);
+void panic(char *format, ...) __attribute__((__noreturn__));
 
 #endif //PANIC_H
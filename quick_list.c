@@ -0,0 +1,658 @@
+#include <string.h>
+#include "quick_list.h"
+#include "allocator.h"
+#include "panic.h"
+#include "stats.h"
+
+//header and end byte of an empty node list
+#define QL_EMPTY_BYTES (sizeof(CompactList) + CL_END_BYTES)
+
+QuickList *QuickListNewWithCap(uint32_t maxEntries, uint32_t maxBytes) {
+    QuickList *ql;
+    if ((ql = mem_malloc(sizeof(*ql))) == NULL) {
+        panic("QuickList malloc failed\n");
+    }
+    ql->head = NULL;
+    ql->tail = NULL;
+    ql->size = 0;
+    ql->nodes = 0;
+    ql->maxEntries = maxEntries;
+    ql->maxBytes = maxBytes;
+    ql->compressBytes = 0;
+    ql->idleCalls = 1;
+    ql->cacheNodes = 1;
+    ql->cached = 0;
+    ql->clock = 0;
+    return ql;
+}
+
+QuickList *QuickListNew() {
+    return QuickListNewWithCap(0, QUICK_LIST_DEFAULT_BYTES);
+}
+
+void QuickListFree(QuickList *ql) {
+    QuickListNode *node = ql->head;
+    while (node) {
+        QuickListNode *next = node->next;
+        if (node->list) CompactListFree(node->list);
+        if (node->compressed) CompactListCompressedFree(node->compressed);
+        mem_free(node, sizeof(*node));
+        node = next;
+    }
+    mem_free(ql, sizeof(*ql));
+}
+
+inline uint64_t QuickListSize(QuickList *ql) {
+    return ql->size;
+}
+
+static inline uint32_t ql_nodeSize(QuickListNode *node) {
+    return node->list ? node->list->size : node->compressed->size;
+}
+
+//bytes of the node expanded
+static inline uint64_t ql_nodeBytes(QuickListNode *node) {
+    return node->list ? node->list->bytes : node->compressed->bytes;
+}
+
+//link a node holding list after prev, at the head if prev is NULL
+static QuickListNode *ql_linkAfter(QuickList *ql, QuickListNode *prev, CompactList *list) {
+    QuickListNode *node;
+    if ((node = mem_malloc(sizeof(*node))) == NULL) {
+        panic("QuickList node malloc failed\n");
+    }
+    node->list = list;
+    node->compressed = NULL;
+    node->used = ql->clock;
+    node->incompressible = 0;
+    node->prev = prev;
+    node->next = prev ? prev->next : ql->head;
+    if (node->next) {
+        node->next->prev = node;
+    } else {
+        ql->tail = node;
+    }
+    if (prev) {
+        prev->next = node;
+    } else {
+        ql->head = node;
+    }
+    ql->nodes++;
+    return node;
+}
+
+//take a node out of the read cache, if it is in
+static void ql_uncache(QuickList *ql, QuickListNode *node) {
+    for (uint32_t i = 0; i < ql->cached; i++) {
+        if (ql->cache[i] == node) {
+            memmove(ql->cache + i, ql->cache + i + 1, (ql->cached - i - 1) * sizeof(node));
+            ql->cached--;
+            return;
+        }
+    }
+}
+
+//the last read node drops its expanded copy, the compressed one stays
+static void ql_evict(QuickList *ql) {
+    QuickListNode *last = ql->cache[--ql->cached];
+    CompactListFree(last->list);
+    last->list = NULL;
+}
+
+static void ql_cacheFirst(QuickList *ql, QuickListNode *node) {
+    ql_uncache(ql, node);
+    if (ql->cached == ql->cacheNodes) {
+        ql_evict(ql);
+    }
+    memmove(ql->cache + 1, ql->cache, ql->cached * sizeof(node));
+    ql->cache[0] = node;
+    ql->cached++;
+}
+
+/*
+ * A node to read is expanded beside its compressed copy and put in
+ * the cache. Nodes in the cache are exactly those holding both.
+ */
+static CompactList *ql_read(QuickList *ql, QuickListNode *node) {
+    node->used = ql->clock;
+    if (node->compressed) {
+        if (node->list) {
+            STATS_ADD(STATS_QL_CACHE_HITS, 1);
+        } else {
+            node->list = CompactListDecompress(node->compressed);
+        }
+        ql_cacheFirst(ql, node);
+    }
+    return node->list;
+}
+
+//a node to change loses its compressed copy, it would be stale
+static CompactList *ql_write(QuickList *ql, QuickListNode *node) {
+    node->used = ql->clock;
+    node->incompressible = 0;
+    if (node->compressed) {
+        if (node->list) {
+            ql_uncache(ql, node);
+        } else {
+            node->list = CompactListDecompress(node->compressed);
+        }
+        CompactListCompressedFree(node->compressed);
+        node->compressed = NULL;
+    }
+    return node->list;
+}
+
+//compress the idle nodes, read ones that went idle only drop their expanded copy
+static uint32_t ql_sweep(QuickList *ql) {
+    uint32_t compressed = 0;
+    for (QuickListNode *node = ql->head; node; node = node->next) {
+        if (ql->clock - node->used < ql->idleCalls) {
+            continue;
+        }
+        if (node->compressed) {
+            if (node->list) {
+                ql_uncache(ql, node);
+                CompactListFree(node->list);
+                node->list = NULL;
+            }
+            continue;
+        }
+        if (node->incompressible || node->list->bytes < ql->compressBytes) {
+            continue;
+        }
+        if ((node->compressed = CompactListCompress(node->list)) == NULL) {
+            node->incompressible = 1;
+            continue;
+        }
+        CompactListFree(node->list);
+        node->list = NULL;
+        compressed++;
+    }
+    return compressed;
+}
+
+//every call counts as a tick, sweep once per idleCalls ticks
+static inline void ql_tick(QuickList *ql) {
+    ql->clock++;
+    if (ql->compressBytes && ql->clock % ql->idleCalls == 0) {
+        ql_sweep(ql);
+    }
+}
+
+//unlink and free a node, its list is left to the caller
+static void ql_unlink(QuickList *ql, QuickListNode *node) {
+    if (node->compressed) {
+        ql_uncache(ql, node);
+        CompactListCompressedFree(node->compressed);
+    }
+    if (node->prev) {
+        node->prev->next = node->next;
+    } else {
+        ql->head = node->next;
+    }
+    if (node->next) {
+        node->next->prev = node->prev;
+    } else {
+        ql->tail = node->prev;
+    }
+    ql->nodes--;
+    mem_free(node, sizeof(*node));
+}
+
+//an empty node takes any entry, so every entry has somewhere to go
+static inline int ql_fits(QuickList *ql, QuickListNode *node, uint32_t entryBytes) {
+    uint32_t size = ql_nodeSize(node);
+    if (size == 0) {
+        return 1;
+    }
+    return (ql->maxEntries == 0 || size < ql->maxEntries)
+           && (ql->maxBytes == 0 || ql_nodeBytes(node) + entryBytes <= ql->maxBytes);
+}
+
+/*
+ * Merged nodes must leave a quarter of the cap free, otherwise a
+ * node just split would merge back on the next remove.
+ */
+static inline int ql_canMerge(QuickList *ql, QuickListNode *a, QuickListNode *b) {
+    uint64_t entries = (uint64_t) ql_nodeSize(a) + ql_nodeSize(b);
+    uint64_t bytes = ql_nodeBytes(a) + ql_nodeBytes(b) - QL_EMPTY_BYTES;
+    return (ql->maxEntries == 0 || entries <= (uint64_t) ql->maxEntries * 3 / 4)
+           && (ql->maxBytes == 0 || bytes <= (uint64_t) ql->maxBytes * 3 / 4);
+}
+
+/*
+ * Cutting an int run in the middle of a node takes more bytes than
+ * the entry inserted or removed, split a node pushed over the byte
+ * cap that way.
+ */
+static void ql_fitCap(QuickList *ql, QuickListNode *node) {
+    if (ql->maxBytes == 0 || node->list->size < 2 || node->list->bytes <= ql->maxBytes) {
+        return;
+    }
+    CompactList *rest;
+    node->list = CompactListSplit(node->list, node->list->size / 2, &rest);
+    ql_fitCap(ql, ql_linkAfter(ql, node, rest));
+    ql_fitCap(ql, node);
+}
+
+//node holding entry idx, offset is the index inside it
+static QuickListNode *ql_locate(QuickList *ql, int64_t idx, int64_t *offset) {
+    if (idx < 0 || (uint64_t) idx >= ql->size) {
+        panic("QuickList index out of range: %ld\n", idx);
+    }
+    QuickListNode *node;
+    if ((uint64_t) idx < ql->size / 2) {
+        node = ql->head;
+        while (idx >= ql_nodeSize(node)) {
+            idx -= ql_nodeSize(node);
+            node = node->next;
+        }
+        *offset = idx;
+    } else {
+        int64_t rest = (int64_t) ql->size - 1 - idx;
+        node = ql->tail;
+        while (rest >= ql_nodeSize(node)) {
+            rest -= ql_nodeSize(node);
+            node = node->prev;
+        }
+        *offset = ql_nodeSize(node) - 1 - rest;
+    }
+    return node;
+}
+
+QuickList *QuickListInsert(QuickList *ql, char *data, size_t len, int64_t idx) {
+    if (idx < 0 || (uint64_t) idx > ql->size) {
+        panic("QuickList index out of range: %ld\n", idx);
+    }
+    ql_tick(ql);
+    uint32_t entryBytes = CompactListEntrySize(data, len);
+    QuickListNode *node;
+    int64_t offset;
+    if (ql->nodes == 0) {
+        node = ql_linkAfter(ql, NULL, CompactListNew());
+        offset = 0;
+    } else if ((uint64_t) idx == ql->size) {
+        node = ql->tail;
+        offset = ql_nodeSize(node);
+    } else {
+        node = ql_locate(ql, idx, &offset);
+    }
+
+    for (;;) {
+        int64_t size = ql_nodeSize(node);
+        if (ql_fits(ql, node, entryBytes)) {
+            break;
+        } else if (offset == 0 && node->prev && ql_fits(ql, node->prev, entryBytes)) {
+            node = node->prev;
+            offset = ql_nodeSize(node);
+            break;
+        } else if (offset == size && node->next && ql_fits(ql, node->next, entryBytes)) {
+            node = node->next;
+            offset = 0;
+            break;
+        } else if (offset == 0) {
+            node = ql_linkAfter(ql, node->prev, CompactListNew());
+            break;
+        } else if (offset == size) {
+            node = ql_linkAfter(ql, node, CompactListNew());
+            offset = 0;
+            break;
+        }
+        //full in the middle, split and retry at the end of the first half
+        CompactList *rest;
+        node->list = CompactListSplit(ql_write(ql, node), offset, &rest);
+        ql_linkAfter(ql, node, rest);
+    }
+    node->list = CompactListInsert(ql_write(ql, node), data, len, offset);
+    ql->size++;
+    ql_fitCap(ql, node);
+    return ql;
+}
+
+QuickList *QuickListPushHead(QuickList *ql, char *data, size_t len) {
+    return QuickListInsert(ql, data, len, 0);
+}
+
+QuickList *QuickListPushTail(QuickList *ql, char *data, size_t len) {
+    return QuickListInsert(ql, data, len, (int64_t) ql->size);
+}
+
+//drop an emptied node or merge it into a neighbour
+static void ql_afterRemove(QuickList *ql, QuickListNode *node) {
+    if (node->list->size == 0) {
+        CompactListFree(node->list);
+        ql_unlink(ql, node);
+        return;
+    }
+    ql_fitCap(ql, node);
+    if (node->prev && ql_canMerge(ql, node->prev, node)) {
+        QuickListNode *prev = node->prev;
+        prev->list = CompactListMerge(ql_write(ql, prev), node->list);
+        ql_unlink(ql, node);
+        node = prev;
+    }
+    if (node->next && ql_canMerge(ql, node, node->next)) {
+        QuickListNode *next = node->next;
+        node->list = CompactListMerge(node->list, ql_write(ql, next));
+        ql_unlink(ql, next);
+    }
+}
+
+QuickList *QuickListRemoveAt(QuickList *ql, int64_t idx) {
+    int64_t offset;
+    ql_tick(ql);
+    QuickListNode *node = ql_locate(ql, idx, &offset);
+    node->list = CompactListRemoveAt(ql_write(ql, node), offset);
+    ql->size--;
+    ql_afterRemove(ql, node);
+    return ql;
+}
+
+QuickList *QuickListRemove(QuickList *ql, char *data, size_t len, int *ret) {
+    ql_tick(ql);
+    for (QuickListNode *node = ql->head; node; node = node->next) {
+        //a compressed node is only read, unless it holds the value
+        if (node->compressed) {
+            if (CompactListFindStr(ql_read(ql, node), data, len) == -1) {
+                continue;
+            }
+            ql_write(ql, node);
+        }
+        int removed;
+        node->list = CompactListRemove(node->list, data, len, &removed);
+        if (removed) {
+            ql_write(ql, node);
+            ql->size--;
+            ql_afterRemove(ql, node);
+            if (ret) *ret = 1;
+            return ql;
+        }
+    }
+    if (ret) *ret = 0;
+    return ql;
+}
+
+static int ql_pop(QuickList *ql, int64_t idx, CompactListValue *value) {
+    if (ql->size == 0) {
+        return 0;
+    }
+    if (value) {
+        char *strVal;
+        int64_t len = QuickListValueAt(ql, idx, &value->intVal, &strVal);
+        if (len == -1) {
+            value->type = CL_TYPE_INT;
+            value->strVal = NULL;
+            value->len = 0;
+        } else {
+            value->type = CL_TYPE_STR;
+            value->len = (uint32_t) len;
+            if ((value->strVal = malloc(len > 0 ? (size_t) len : 1)) == NULL) {
+                panic("QuickList pop: malloc failed\n");
+            }
+            memcpy(value->strVal, strVal, (size_t) len);
+        }
+    }
+    QuickListRemoveAt(ql, idx);
+    return 1;
+}
+
+int QuickListPopHead(QuickList *ql, CompactListValue *value) {
+    return ql_pop(ql, 0, value);
+}
+
+int QuickListPopTail(QuickList *ql, CompactListValue *value) {
+    return ql_pop(ql, (int64_t) ql->size - 1, value);
+}
+
+int64_t QuickListValueAt(QuickList *ql, int64_t idx, int64_t *intVal, char **strVal) {
+    int64_t offset;
+    ql_tick(ql);
+    QuickListNode *node = ql_locate(ql, idx, &offset);
+    return CompactListValueAt(ql_read(ql, node), NULL, offset, intVal, strVal);
+}
+
+int64_t QuickListIndexOf(QuickList *ql, char *data, size_t len) {
+    int64_t base = 0;
+    ql_tick(ql);
+    for (QuickListNode *node = ql->head; node; node = node->next) {
+        int64_t idx = CompactListFindStr(ql_read(ql, node), data, len);
+        if (idx != -1) {
+            return base + idx;
+        }
+        base += ql_nodeSize(node);
+    }
+    return -1;
+}
+
+void QuickListSetCompress(QuickList *ql, uint32_t minBytes, uint32_t idleCalls, uint32_t cacheNodes) {
+    ql->compressBytes = minBytes;
+    ql->idleCalls = idleCalls ? idleCalls : 1;
+    ql->cacheNodes = cacheNodes < 1 ? 1 : cacheNodes > QUICK_LIST_CACHE_MAX ? QUICK_LIST_CACHE_MAX : cacheNodes;
+    if (minBytes == 0) {
+        for (QuickListNode *node = ql->head; node; node = node->next) {
+            ql_write(ql, node);
+        }
+    }
+    while (ql->cached > ql->cacheNodes) {
+        ql_evict(ql);
+    }
+}
+
+uint32_t QuickListCompressIdle(QuickList *ql) {
+    return ql->compressBytes ? ql_sweep(ql) : 0;
+}
+
+void QuickListMemoryUsage(QuickList *ql, QuickListMemory *usage) {
+    memset(usage, 0, sizeof(*usage));
+    for (QuickListNode *node = ql->head; node; node = node->next) {
+        usage->nodes++;
+        if (node->list) {
+            usage->listBytes += node->list->bytes;
+        }
+        if (node->compressed) {
+            usage->compressedBytes += CompactListCompressedBytes(node->compressed);
+            if (node->list) {
+                usage->cachedNodes++;
+            } else {
+                usage->compressedNodes++;
+            }
+        }
+        usage->expandedBytes += ql_nodeBytes(node);
+    }
+}
+
+//#define QUICK_LIST_TEST
+#ifdef QUICK_LIST_TEST
+
+#include <assert.h>
+#include <stdio.h>
+
+//every node non empty and within the caps, unless it holds a single entry,
+//and the cache holds exactly the nodes expanded beside a compressed copy
+static void ql_check(QuickList *ql) {
+    uint64_t size = 0;
+    uint32_t nodes = 0, cached = 0;
+    QuickListNode *prev = NULL;
+    for (QuickListNode *node = ql->head; node; node = node->next) {
+        assert(node->prev == prev);
+        assert(node->list || node->compressed);
+        assert(ql_nodeSize(node) > 0);
+        if (ql_nodeSize(node) > 1) {
+            assert(ql->maxEntries == 0 || ql_nodeSize(node) <= ql->maxEntries);
+            assert(ql->maxBytes == 0 || ql_nodeBytes(node) <= ql->maxBytes);
+        }
+        if (node->list && node->compressed) {
+            int found = 0;
+            for (uint32_t i = 0; i < ql->cached; i++) found += ql->cache[i] == node;
+            assert(found == 1);
+            cached++;
+        }
+        size += ql_nodeSize(node);
+        nodes++;
+        prev = node;
+    }
+    assert(ql->tail == prev && ql->size == size && ql->nodes == nodes);
+    assert(ql->cached == cached && cached <= ql->cacheNodes);
+}
+
+int main() {
+    char buf[64];
+    int64_t expect[4000];
+    //the last one keeps idle nodes compressed
+    uint32_t caps[][3] = {{4, 0, 0}, {0, 128, 0}, {16, 256, 0}, {0, 0, 0}, {0, 256, 64}};
+
+    for (int c = 0; c < 5; c++) {
+        QuickList *ql = QuickListNewWithCap(caps[c][0], caps[c][1]);
+        QuickListSetCompress(ql, caps[c][2], 16, 2);
+        int n = 0, ret;
+        for (int i = 0; i < 4000; i++) {
+            int64_t idx = i % 4 == 0 ? n : i % 4 == 1 ? 0 : (i * 7919) % (n + 1);
+            int len = sprintf(buf, i % 2 ? "%d" : "str%d", i);
+            ql = QuickListInsert(ql, buf, (size_t) len, idx);
+            memmove(expect + idx + 1, expect + idx, (n - idx) * sizeof(int64_t));
+            expect[idx] = i;
+            n++;
+            if (i % 3 == 2) {
+                int64_t victim = (i * 31) % n;
+                if (i % 2) {
+                    ql = QuickListRemoveAt(ql, victim);
+                } else {
+                    len = sprintf(buf, expect[victim] % 2 ? "%ld" : "str%ld", expect[victim]);
+                    ql = QuickListRemove(ql, buf, (size_t) len, &ret);
+                    assert(ret == 1);
+                }
+                memmove(expect + victim, expect + victim + 1, (n - victim - 1) * sizeof(int64_t));
+                n--;
+            }
+            if (i % 100 == 0) ql_check(ql);
+        }
+        ql_check(ql);
+        assert(QuickListSize(ql) == (uint64_t) n);
+        for (int i = 0; i < n; i++) {
+            int64_t intVal;
+            char *strVal;
+            int64_t len = QuickListValueAt(ql, i, &intVal, &strVal);
+            if (expect[i] % 2) {
+                assert(len == -1 && intVal == expect[i]);
+            } else {
+                assert(len == sprintf(buf, "str%ld", expect[i]) && memcmp(strVal, buf, (size_t) len) == 0);
+            }
+            if (i % 97 == 0) {
+                assert(QuickListIndexOf(ql, buf, (size_t) sprintf(buf, expect[i] % 2 ? "%ld" : "str%ld", expect[i])) == i);
+            }
+        }
+
+        //drain from both ends
+        CompactListValue value;
+        int head = 0, tail = n - 1;
+        while (head <= tail) {
+            if ((head + tail) % 2) {
+                assert(QuickListPopHead(ql, &value));
+                assert(value.type == (expect[head] % 2 ? CL_TYPE_INT : CL_TYPE_STR));
+                if (value.type == CL_TYPE_STR) free(value.strVal);
+                head++;
+            } else {
+                assert(QuickListPopTail(ql, &value));
+                if (value.type == CL_TYPE_INT) assert(value.intVal == expect[tail]);
+                else free(value.strVal);
+                tail--;
+            }
+            if (head % 500 == 0) ql_check(ql);
+        }
+        assert(!QuickListPopHead(ql, &value) && ql->nodes == 0 && ql->head == NULL);
+        QuickListFree(ql);
+    }
+
+    //an entry larger than the byte cap gets a node of its own
+    QuickList *ql = QuickListNewWithCap(0, 64);
+    char big[200];
+    memset(big, 'x', sizeof(big));
+    for (int i = 0; i < 20; i++) {
+        int len = sprintf(buf, "v%d", i);
+        ql = QuickListPushTail(ql, buf, (size_t) len);
+    }
+    ql = QuickListInsert(ql, big, sizeof(big), 10);
+    ql_check(ql);
+    assert(QuickListIndexOf(ql, big, sizeof(big)) == 10 && QuickListIndexOf(ql, "v10", 3) == 11);
+    QuickListFree(ql);
+
+    //counters pushed at the tail pack into runs, cutting them keeps nodes within the cap
+    ql = QuickListNewWithCap(0, 256);
+    int n = 0;
+    for (; n < 3000; n++) {
+        expect[n] = 1000 + n;
+        ql = QuickListPushTail(ql, buf, (size_t) sprintf(buf, "%ld", expect[n]));
+    }
+    for (int i = 0; i < 300; i++) {
+        int64_t idx = (i * 7919) % n;
+        ql = QuickListInsert(ql, buf, (size_t) sprintf(buf, "%d", i * 7919), idx);
+        memmove(expect + idx + 1, expect + idx, (n - idx) * sizeof(int64_t));
+        expect[idx] = i * 7919;
+        idx = (i * 104729) % ++n;
+        ql = QuickListRemoveAt(ql, idx);
+        memmove(expect + idx, expect + idx + 1, (--n - idx) * sizeof(int64_t));
+        ql_check(ql);
+    }
+    for (int i = 0; i < n; i += 7) {
+        int64_t intVal;
+        assert(QuickListValueAt(ql, i, &intVal, NULL) == -1 && intVal == expect[i]);
+    }
+    QuickListFree(ql);
+
+    //written once, read rarely: idle nodes end up compressed and expand when read
+    StatsSnapshot before, after;
+    int ret;
+    StatsGet(&before);
+    ql = QuickListNewWithCap(0, 1024);
+    QuickListSetCompress(ql, 512, 50, 2);
+    for (int i = 0; i < 4000; i++) {
+        ql = QuickListPushTail(ql, buf, (size_t) sprintf(buf, "session:%d:user:%d", i % 40, i % 7));
+    }
+    ql_check(ql);
+    QuickListMemory usage;
+    QuickListMemoryUsage(ql, &usage);
+    assert(usage.nodes == ql->nodes && usage.compressedNodes > usage.nodes / 2);
+    assert(usage.listBytes + usage.compressedBytes < usage.expandedBytes / 2);
+    for (int i = 0; i < 4000; i += 13) {
+        char *strVal;
+        int64_t len = QuickListValueAt(ql, i, NULL, &strVal);
+        assert(len == sprintf(buf, "session:%d:user:%d", i % 40, i % 7) && memcmp(strVal, buf, (size_t) len) == 0);
+    }
+    ql_check(ql);
+    QuickListMemoryUsage(ql, &usage);
+    assert(usage.cachedNodes == 2);
+    assert(QuickListIndexOf(ql, "session:39:user:4", 17) == 39);
+
+    //changing a compressed node drops its copy until it is idle again
+    QuickListNode *node = ql->head->next;
+    assert(node->compressed && node->list == NULL);
+    ql = QuickListRemoveAt(ql, (int64_t) ql_nodeSize(ql->head));
+    assert(node->compressed == NULL && node->list);
+    ql = QuickListRemove(ql, "session:5:user:4", 16, &ret);
+    assert(ret == 1 && QuickListSize(ql) == 3998);
+    ql_check(ql);
+    for (int i = 0; i < 100; i++) {
+        QuickListValueAt(ql, (int64_t) QuickListSize(ql) - 1, NULL, NULL);
+    }
+    assert(node->compressed && node->list == NULL);
+    assert(QuickListCompressIdle(ql) == 0);
+
+    StatsGet(&after);
+    if (StatsEnabled()) {
+        uint64_t *a = after.counters, *b = before.counters;
+        assert(a[STATS_CL_COMPRESSED] - b[STATS_CL_COMPRESSED] >= usage.nodes);
+        assert(a[STATS_CL_DECOMPRESSED] > b[STATS_CL_DECOMPRESSED]);
+        assert(a[STATS_CL_COMPRESS_OUT_BYTES] - b[STATS_CL_COMPRESS_OUT_BYTES]
+               < (a[STATS_CL_COMPRESS_IN_BYTES] - b[STATS_CL_COMPRESS_IN_BYTES]) / 2);
+    }
+
+    //turned off every node is expanded again
+    QuickListSetCompress(ql, 0, 0, 0);
+    ql_check(ql);
+    QuickListMemoryUsage(ql, &usage);
+    assert(usage.compressedNodes == 0 && usage.cachedNodes == 0 && usage.listBytes == usage.expandedBytes);
+    assert(QuickListIndexOf(ql, "session:39:user:4", 17) == 39);
+    QuickListFree(ql);
+    return 0;
+}
+#endif
@@ -0,0 +1,110 @@
+#ifndef QUICK_LIST_H
+#define QUICK_LIST_H
+
+#include "compact_list.h"
+
+/**
+ * List of many entries, kept as a doubly linked chain of small
+ * CompactLists so an insert or remove only moves the bytes of one
+ * node.
+ *
+ * A node holds at most maxEntries entries and maxBytes bytes, 0
+ * means no limit. An entry too large for any node gets one of its
+ * own. A full node is split at the insert position, and a node
+ * that shrinks is merged into a neighbour once both fit into one.
+ *
+ * Indexed access skips whole nodes by their size header, starting
+ * from the closer end.
+ *
+ * Nodes left untouched for a while can be kept compressed, see
+ * QuickListSetCompress. A compressed node is expanded on the next
+ * call that reaches it. One only read keeps its compressed copy
+ * and sits in a small cache of expanded nodes, dropping out of it
+ * costs nothing. One changed loses its copy and is compressed again
+ * once idle.
+ */
+typedef struct QuickListNode {
+    struct QuickListNode *prev;
+    struct QuickListNode *next;
+    CompactList *list; //NULL while the node is compressed
+    CompactListCompressed *compressed; //kept as long as list is unchanged
+    uint64_t used; //clock of the last call that reached the node
+    int incompressible; //compressing didn't pay, not tried until the node changes
+} QuickListNode;
+
+//most nodes kept expanded after a read
+#define QUICK_LIST_CACHE_MAX 8
+
+typedef struct {
+    QuickListNode *head;
+    QuickListNode *tail;
+    uint64_t size; //entry count
+    uint32_t nodes; //node count
+    uint32_t maxEntries;
+    uint32_t maxBytes;
+    uint32_t compressBytes; //smallest node compressed, 0 for none
+    uint32_t idleCalls;
+    uint32_t cacheNodes;
+    uint32_t cached;
+    uint64_t clock; //calls made on the list
+    QuickListNode *cache[QUICK_LIST_CACHE_MAX]; //read nodes, the last read first
+} QuickList;
+
+#define QUICK_LIST_DEFAULT_BYTES (8 * 1024)
+
+QuickList *QuickListNew();
+QuickList *QuickListNewWithCap(uint32_t maxEntries, uint32_t maxBytes);
+void QuickListFree(QuickList *ql);
+
+uint64_t QuickListSize(QuickList *ql);
+
+QuickList *QuickListInsert(QuickList *ql, char *data, size_t len, int64_t idx);
+QuickList *QuickListPushHead(QuickList *ql, char *data, size_t len);
+QuickList *QuickListPushTail(QuickList *ql, char *data, size_t len);
+
+/**
+ * Remove the first or last entry into value, return 0 if the list
+ * is empty. A string is copied with malloc, the caller frees it.
+ */
+int QuickListPopHead(QuickList *ql, CompactListValue *value);
+int QuickListPopTail(QuickList *ql, CompactListValue *value);
+
+QuickList *QuickListRemoveAt(QuickList *ql, int64_t idx);
+QuickList *QuickListRemove(QuickList *ql, char *data, size_t len, int *ret);
+
+/**
+ * Same as CompactListValueAt, strVal points into the list.
+ */
+int64_t QuickListValueAt(QuickList *ql, int64_t idx, int64_t *intVal, char **strVal);
+int64_t QuickListIndexOf(QuickList *ql, char *data, size_t len);
+
+/**
+ * Compress nodes of at least minBytes once idleCalls calls on the
+ * list went by without reaching them. Up to cacheNodes read nodes,
+ * at least 1 and at most QUICK_LIST_CACHE_MAX, stay expanded beside
+ * their compressed copy. minBytes 0 turns compression off and
+ * expands every node again. Off for a new list.
+ *
+ * Strings read stay valid until the next call on the list, as a
+ * node compressed by it frees the expanded copy.
+ */
+void QuickListSetCompress(QuickList *ql, uint32_t minBytes, uint32_t idleCalls, uint32_t cacheNodes);
+
+/**
+ * Compress idle nodes now instead of on the next sweep, return the
+ * nodes compressed. Every call sweeps once per idleCalls calls.
+ */
+uint32_t QuickListCompressIdle(QuickList *ql);
+
+typedef struct {
+    uint32_t nodes;
+    uint32_t compressedNodes; //nodes held compressed only
+    uint32_t cachedNodes; //nodes expanded beside their compressed copy
+    uint64_t listBytes; //bytes of the expanded nodes
+    uint64_t compressedBytes; //bytes of the compressed copies
+    uint64_t expandedBytes; //bytes all nodes would take expanded
+} QuickListMemory;
+
+void QuickListMemoryUsage(QuickList *ql, QuickListMemory *usage);
+
+#endif //QUICK_LIST_H
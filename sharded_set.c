@@ -0,0 +1,289 @@
+#include <stdlib.h>
+#include <string.h>
+#include "sharded_set.h"
+#include "allocator.h"
+#include "panic.h"
+
+//splitmix64 finalizer, so runs of close values spread over all shards
+static inline uint32_t ss_shardOf(ShardedSet *set, int64_t val) {
+    uint64_t h = (uint64_t) val;
+    h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+    h ^= h >> 31;
+    return (uint32_t) h & (set->count - 1);
+}
+
+ShardedSet *ShardedSetNew(uint32_t shards) {
+    if (shards == 0) {
+        shards = SHARDED_SET_DEFAULT_SHARDS;
+    }
+    if (shards > (1u << 31)) {
+        panic("ShardedSet too many shards\n");
+    }
+    uint32_t count = 1;
+    while (count < shards) count <<= 1;
+
+    ShardedSet *set;
+    void *mem;
+    if ((set = malloc(sizeof(ShardedSet))) == NULL
+        || posix_memalign(&mem, 64, count * sizeof(ShardedSetShard)) != 0) {
+        panic("ShardedSet malloc failed\n");
+    }
+    set->count = count;
+    set->shards = mem;
+    Allocator *prev = AllocatorUse(NULL);
+    for (uint32_t i = 0; i < count; i++) {
+        if (pthread_rwlock_init(&set->shards[i].lock, NULL) != 0) {
+            panic("ShardedSet lock init failed\n");
+        }
+        set->shards[i].set = IntSetNew();
+    }
+    AllocatorUse(prev);
+    return set;
+}
+
+void ShardedSetFree(ShardedSet *set) {
+    Allocator *prev = AllocatorUse(NULL);
+    for (uint32_t i = 0; i < set->count; i++) {
+        pthread_rwlock_destroy(&set->shards[i].lock);
+        IntSetFree(set->shards[i].set);
+    }
+    AllocatorUse(prev);
+    free(set->shards);
+    free(set);
+}
+
+uint64_t ShardedSetSize(ShardedSet *set) {
+    uint64_t size = 0;
+    for (uint32_t i = 0; i < set->count; i++) {
+        ShardedSetShard *shard = &set->shards[i];
+        pthread_rwlock_rdlock(&shard->lock);
+        size += IntSetSize(shard->set);
+        pthread_rwlock_unlock(&shard->lock);
+    }
+    return size;
+}
+
+int ShardedSetPut(ShardedSet *set, int64_t val) {
+    ShardedSetShard *shard = &set->shards[ss_shardOf(set, val)];
+    int ret;
+    Allocator *prev = AllocatorUse(NULL);
+    pthread_rwlock_wrlock(&shard->lock);
+    shard->set = IntSetPut(shard->set, val, &ret);
+    pthread_rwlock_unlock(&shard->lock);
+    AllocatorUse(prev);
+    return ret;
+}
+
+int ShardedSetContains(ShardedSet *set, int64_t val) {
+    ShardedSetShard *shard = &set->shards[ss_shardOf(set, val)];
+    pthread_rwlock_rdlock(&shard->lock);
+    int ret = IntSetContains(shard->set, val);
+    pthread_rwlock_unlock(&shard->lock);
+    return ret;
+}
+
+int ShardedSetRemove(ShardedSet *set, int64_t val) {
+    ShardedSetShard *shard = &set->shards[ss_shardOf(set, val)];
+    int ret;
+    Allocator *prev = AllocatorUse(NULL);
+    pthread_rwlock_wrlock(&shard->lock);
+    shard->set = IntSetRemove(shard->set, val, &ret);
+    pthread_rwlock_unlock(&shard->lock);
+    AllocatorUse(prev);
+    return ret;
+}
+
+//keys grouped by shard, keys of shard s are grouped[offsets[s] .. offsets[s + 1])
+//and came from keys[order[i]]
+typedef struct {
+    int64_t *grouped;
+    uint32_t *order;
+    uint32_t *offsets;
+} ss_batch;
+
+//counting sort by shard, stable so sorted input stays sorted per shard
+static void ss_group(ShardedSet *set, const int64_t *keys, uint32_t n, ss_batch *batch) {
+    if ((batch->grouped = malloc(n * sizeof(int64_t))) == NULL
+        || (batch->order = malloc(n * sizeof(uint32_t))) == NULL
+        || (batch->offsets = calloc(set->count + 1, sizeof(uint32_t))) == NULL) {
+        panic("ShardedSet batch malloc failed\n");
+    }
+    uint32_t *offsets = batch->offsets;
+    for (uint32_t i = 0; i < n; i++) {
+        offsets[ss_shardOf(set, keys[i]) + 1]++;
+    }
+    for (uint32_t s = 0; s < set->count; s++) {
+        offsets[s + 1] += offsets[s];
+    }
+    //offsets[s] walks to the end of shard s, then is moved back
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t pos = offsets[ss_shardOf(set, keys[i])]++;
+        batch->grouped[pos] = keys[i];
+        batch->order[pos] = i;
+    }
+    memmove(offsets + 1, offsets, set->count * sizeof(uint32_t));
+    offsets[0] = 0;
+}
+
+static void ss_batchFree(ss_batch *batch) {
+    free(batch->grouped);
+    free(batch->order);
+    free(batch->offsets);
+}
+
+uint32_t ShardedSetPutMany(ShardedSet *set, const int64_t *vals, uint32_t n) {
+    if (n == 0) {
+        return 0;
+    }
+    ss_batch batch;
+    ss_group(set, vals, n, &batch);
+
+    uint32_t total = 0;
+    Allocator *prev = AllocatorUse(NULL);
+    for (uint32_t s = 0; s < set->count; s++) {
+        uint32_t from = batch.offsets[s], m = batch.offsets[s + 1] - from, added;
+        if (m == 0) continue;
+        ShardedSetShard *shard = &set->shards[s];
+        pthread_rwlock_wrlock(&shard->lock);
+        shard->set = IntSetPutMany(shard->set, batch.grouped + from, m, &added);
+        pthread_rwlock_unlock(&shard->lock);
+        total += added;
+    }
+    AllocatorUse(prev);
+    ss_batchFree(&batch);
+    return total;
+}
+
+uint32_t ShardedSetContainsMany(ShardedSet *set, const int64_t *keys, uint32_t n, uint8_t *found) {
+    memset(found, 0, (n + 7) / 8);
+    if (n == 0) {
+        return 0;
+    }
+    ss_batch batch;
+    ss_group(set, keys, n, &batch);
+    uint8_t *bits;
+    if ((bits = malloc((n + 7) / 8)) == NULL) {
+        panic("ShardedSet batch malloc failed\n");
+    }
+
+    uint32_t total = 0;
+    for (uint32_t s = 0; s < set->count; s++) {
+        uint32_t from = batch.offsets[s], m = batch.offsets[s + 1] - from, hits;
+        if (m == 0) continue;
+        ShardedSetShard *shard = &set->shards[s];
+        pthread_rwlock_rdlock(&shard->lock);
+        hits = IntSetContainsMany(shard->set, batch.grouped + from, m, bits);
+        pthread_rwlock_unlock(&shard->lock);
+        total += hits;
+        for (uint32_t j = 0; j < m && hits > 0; j++) {
+            if ((bits[j / 8] >> (j % 8)) & 1) {
+                uint32_t i = batch.order[from + j];
+                found[i / 8] |= 1 << (i % 8);
+                hits--;
+            }
+        }
+    }
+    free(bits);
+    ss_batchFree(&batch);
+    return total;
+}
+
+//#define SHARDED_SET_TEST
+#ifdef SHARDED_SET_TEST
+
+#include <assert.h>
+#include <stdio.h>
+
+#define SS_THREADS 8
+#define SS_PER_THREAD 20000
+
+typedef struct {
+    ShardedSet *set;
+    int id;
+} ss_worker;
+
+//every thread owns the values congruent to its id, puts them one by
+//one and in batches, and probes what the others have written so far
+static void *ss_work(void *arg) {
+    ss_worker *worker = arg;
+    ShardedSet *set = worker->set;
+    int64_t batch[256];
+    uint8_t found[256 / 8];
+    int n = 0;
+    for (int64_t i = 0; i < SS_PER_THREAD; i++) {
+        int64_t val = i * SS_THREADS + worker->id;
+        if (i % 2) {
+            assert(ShardedSetPut(set, val) == 1);
+            assert(ShardedSetContains(set, val));
+        } else {
+            batch[n++] = val;
+        }
+        if (n == 256) {
+            assert(ShardedSetPutMany(set, batch, n) == 256);
+            assert(ShardedSetPutMany(set, batch, n) == 0);
+            assert(ShardedSetContainsMany(set, batch, n, found) == 256);
+            n = 0;
+        }
+        //other threads' values, may or may not be there yet
+        ShardedSetContains(set, val + 1);
+    }
+    assert(ShardedSetPutMany(set, batch, n) == (uint32_t) n);
+    //odd values of one thread, removed and put back
+    for (int64_t i = 1; i < SS_PER_THREAD; i += 64) {
+        int64_t val = i * SS_THREADS + worker->id;
+        assert(ShardedSetRemove(set, val) == 1);
+        assert(!ShardedSetContains(set, val));
+        assert(ShardedSetPut(set, val) == 1);
+    }
+    return NULL;
+}
+
+int main() {
+    ShardedSet *set = ShardedSetNew(5);
+    assert(set->count == 8);
+    assert(ShardedSetPut(set, 3) == 1);
+    assert(ShardedSetPut(set, 3) == 0);
+    assert(ShardedSetContains(set, 3) && !ShardedSetContains(set, 4));
+    assert(ShardedSetRemove(set, 3) == 1 && ShardedSetRemove(set, 3) == 0);
+    assert(ShardedSetSize(set) == 0);
+    ShardedSetFree(set);
+
+    //a current arena doesn't leak into the shards
+    Allocator *arena = AllocatorArenaNew(0);
+    Allocator *prev = AllocatorUse(arena);
+    set = ShardedSetNew(0);
+    assert(set->count == SHARDED_SET_DEFAULT_SHARDS);
+    for (int64_t i = 0; i < 1000; i++) {
+        ShardedSetPut(set, -i * 1000003 - 1);
+    }
+    AllocatorFree(arena);
+    AllocatorUse(prev);
+    assert(ShardedSetSize(set) == 1000);
+
+    pthread_t threads[SS_THREADS];
+    ss_worker workers[SS_THREADS];
+    for (int t = 0; t < SS_THREADS; t++) {
+        workers[t].set = set;
+        workers[t].id = t;
+        assert(pthread_create(&threads[t], NULL, ss_work, &workers[t]) == 0);
+    }
+    for (int t = 0; t < SS_THREADS; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    assert(ShardedSetSize(set) == SS_THREADS * SS_PER_THREAD + 1000);
+
+    int64_t keys[1000];
+    uint8_t found[1000 / 8];
+    for (int i = 0; i < 1000; i++) {
+        keys[i] = SS_THREADS * SS_PER_THREAD - 500 + i;
+    }
+    assert(ShardedSetContainsMany(set, keys, 1000, found) == 500);
+    for (int i = 0; i < 1000; i++) {
+        assert(((found[i / 8] >> (i % 8)) & 1) == (i < 500));
+    }
+    ShardedSetFree(set);
+    return 0;
+}
+#endif
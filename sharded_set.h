@@ -0,0 +1,55 @@
+#ifndef SHARDED_SET_H
+#define SHARDED_SET_H
+
+#include <pthread.h>
+#include "int_set.h"
+
+/**
+ * Integer set safe to share between threads.
+ *
+ * Values are hash partitioned over a power of two number of
+ * IntSet shards, each behind its own reader-writer lock, so
+ * writers to different shards never wait on each other and
+ * readers only wait on a writer of the same shard.
+ *
+ * The batch calls group keys by shard first and take every lock
+ * once per batch, instead of once per key.
+ *
+ * Shards always allocate from the default allocator, whatever the
+ * calling thread has made current.
+ */
+typedef struct {
+    pthread_rwlock_t lock;
+    IntSet *set;
+} __attribute__((aligned(64))) ShardedSetShard;
+
+typedef struct {
+    uint32_t count; //shard count, a power of two
+    ShardedSetShard *shards;
+} ShardedSet;
+
+#define SHARDED_SET_DEFAULT_SHARDS 64
+
+/**
+ * shards is rounded up to a power of two, 0 means the default.
+ */
+ShardedSet *ShardedSetNew(uint32_t shards);
+void ShardedSetFree(ShardedSet *set);
+
+/**
+ * Sum of the shard sizes. Shards are counted one after another,
+ * so it's exact only when no writer is active.
+ */
+uint64_t ShardedSetSize(ShardedSet *set);
+int ShardedSetPut(ShardedSet *set, int64_t val);
+int ShardedSetContains(ShardedSet *set, int64_t val);
+int ShardedSetRemove(ShardedSet *set, int64_t val);
+
+/**
+ * Same as IntSetPutMany and IntSetContainsMany, found is a bitmap
+ * of n bits.
+ */
+uint32_t ShardedSetPutMany(ShardedSet *set, const int64_t *vals, uint32_t n);
+uint32_t ShardedSetContainsMany(ShardedSet *set, const int64_t *keys, uint32_t n, uint8_t *found);
+
+#endif //SHARDED_SET_H
@@ -0,0 +1,176 @@
+#include "simd_scan.h"
+#include "int_vector_kernel.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
+typedef int64_t (*scan_fn)(const char *elements, int64_t n, int64_t val);
+
+//kernels indexed by log2 of the encoding
+static scan_fn scan_kernels[4] = {ivk_indexOf8, ivk_indexOf16, ivk_indexOf32, ivk_indexOf64};
+static int scan_curLevel = -1;
+
+#ifdef SCAN_X86
+
+/*
+ * Every kernel compares a full register per step and turns the
+ * result into a byte mask, the lowest set bit is the first match.
+ * The tail shorter than a register is scanned by the scalar kernel.
+ */
+
+#define SCAN_DEFINE_MOVEMASK(isa, bits, reg, bytes, load, set1, cmpeq, movemask)    \
+__attribute__((target(#isa)))                                                       \
+static int64_t scan_##isa##_##bits(const char *elements, int64_t n, int64_t val) {  \
+    if (bytesForInt(val) > sizeof(int##bits##_t)) return -1;                        \
+    const int64_t width = sizeof(int##bits##_t), lanes = bytes / width;            \
+    reg needle = set1((int##bits##_t) val);                                         \
+    int64_t i = 0;                                                                  \
+    for (; i + lanes <= n; i += lanes) {                                            \
+        reg v = load((const reg *) (elements + i * width));                         \
+        uint32_t mask = (uint32_t) movemask(cmpeq(v, needle));                      \
+        if (mask) return i + __builtin_ctz(mask) / width;                           \
+    }                                                                               \
+    int64_t rest = ivk_indexOf##bits(elements + i * width, n - i, val);             \
+    return rest == -1 ? -1 : i + rest;                                              \
+}
+
+//SSE2 has no 64 bit compare, both 32 bit halves must match
+__attribute__((target("sse2")))
+static inline __m128i scan_cmpeq64_sse2(__m128i a, __m128i b) {
+    __m128i eq = _mm_cmpeq_epi32(a, b);
+    return _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+}
+
+SCAN_DEFINE_MOVEMASK(sse2, 8, __m128i, 16, _mm_loadu_si128, _mm_set1_epi8, _mm_cmpeq_epi8, _mm_movemask_epi8)
+SCAN_DEFINE_MOVEMASK(sse2, 16, __m128i, 16, _mm_loadu_si128, _mm_set1_epi16, _mm_cmpeq_epi16, _mm_movemask_epi8)
+SCAN_DEFINE_MOVEMASK(sse2, 32, __m128i, 16, _mm_loadu_si128, _mm_set1_epi32, _mm_cmpeq_epi32, _mm_movemask_epi8)
+SCAN_DEFINE_MOVEMASK(sse2, 64, __m128i, 16, _mm_loadu_si128, _mm_set1_epi64x, scan_cmpeq64_sse2, _mm_movemask_epi8)
+
+SCAN_DEFINE_MOVEMASK(avx2, 8, __m256i, 32, _mm256_loadu_si256, _mm256_set1_epi8, _mm256_cmpeq_epi8, _mm256_movemask_epi8)
+SCAN_DEFINE_MOVEMASK(avx2, 16, __m256i, 32, _mm256_loadu_si256, _mm256_set1_epi16, _mm256_cmpeq_epi16, _mm256_movemask_epi8)
+SCAN_DEFINE_MOVEMASK(avx2, 32, __m256i, 32, _mm256_loadu_si256, _mm256_set1_epi32, _mm256_cmpeq_epi32, _mm256_movemask_epi8)
+SCAN_DEFINE_MOVEMASK(avx2, 64, __m256i, 32, _mm256_loadu_si256, _mm256_set1_epi64x, _mm256_cmpeq_epi64, _mm256_movemask_epi8)
+
+//AVX-512 compares straight into a mask register, one bit per lane
+#define SCAN_DEFINE_AVX512(bits, set1, cmpeq)                                       \
+__attribute__((target("avx512f,avx512bw")))                                         \
+static int64_t scan_avx512_##bits(const char *elements, int64_t n, int64_t val) {   \
+    if (bytesForInt(val) > sizeof(int##bits##_t)) return -1;                        \
+    const int64_t width = sizeof(int##bits##_t), lanes = 64 / width;                \
+    __m512i needle = set1((int##bits##_t) val);                                     \
+    int64_t i = 0;                                                                  \
+    for (; i + lanes <= n; i += lanes) {                                            \
+        __m512i v = _mm512_loadu_si512((const void *) (elements + i * width));      \
+        uint64_t mask = (uint64_t) cmpeq(v, needle);                                \
+        if (mask) return i + __builtin_ctzll(mask);                                 \
+    }                                                                               \
+    int64_t rest = ivk_indexOf##bits(elements + i * width, n - i, val);             \
+    return rest == -1 ? -1 : i + rest;                                              \
+}
+
+SCAN_DEFINE_AVX512(8, _mm512_set1_epi8, _mm512_cmpeq_epi8_mask)
+SCAN_DEFINE_AVX512(16, _mm512_set1_epi16, _mm512_cmpeq_epi16_mask)
+SCAN_DEFINE_AVX512(32, _mm512_set1_epi32, _mm512_cmpeq_epi32_mask)
+SCAN_DEFINE_AVX512(64, _mm512_set1_epi64, _mm512_cmpeq_epi64_mask)
+
+static int scan_supportedLevel() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+        return SCAN_AVX512;
+    } else if (__builtin_cpu_supports("avx2")) {
+        return SCAN_AVX2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        return SCAN_SSE2;
+    }
+    return SCAN_SCALAR;
+}
+
+#else
+
+static int scan_supportedLevel() {
+    return SCAN_SCALAR;
+}
+
+#endif
+
+int scan_useLevel(int level) {
+    int supported = scan_supportedLevel();
+    if (level > supported) level = supported;
+
+    scan_fn kernels[4] = {ivk_indexOf8, ivk_indexOf16, ivk_indexOf32, ivk_indexOf64};
+#ifdef SCAN_X86
+    if (level == SCAN_SSE2) {
+        kernels[0] = scan_sse2_8, kernels[1] = scan_sse2_16, kernels[2] = scan_sse2_32, kernels[3] = scan_sse2_64;
+    } else if (level == SCAN_AVX2) {
+        kernels[0] = scan_avx2_8, kernels[1] = scan_avx2_16, kernels[2] = scan_avx2_32, kernels[3] = scan_avx2_64;
+    } else if (level == SCAN_AVX512) {
+        kernels[0] = scan_avx512_8, kernels[1] = scan_avx512_16, kernels[2] = scan_avx512_32, kernels[3] = scan_avx512_64;
+    }
+#endif
+    //racing first calls all store the same pointers
+    for (int i = 0; i < 4; i++) {
+        __atomic_store_n(&scan_kernels[i], kernels[i], __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&scan_curLevel, level, __ATOMIC_RELEASE);
+    return level;
+}
+
+int scan_level() {
+    int level = __atomic_load_n(&scan_curLevel, __ATOMIC_ACQUIRE);
+    return level < 0 ? scan_useLevel(SCAN_AVX512) : level;
+}
+
+int64_t scan_indexOf(const char *elements, int64_t n, uint8_t encoding, int64_t val) {
+    scan_level();
+    switch (encoding) {
+        case INT8_BYTES:
+            return __atomic_load_n(&scan_kernels[0], __ATOMIC_RELAXED)(elements, n, val);
+        case INT16_BYTES:
+            return __atomic_load_n(&scan_kernels[1], __ATOMIC_RELAXED)(elements, n, val);
+        case INT32_BYTES:
+            return __atomic_load_n(&scan_kernels[2], __ATOMIC_RELAXED)(elements, n, val);
+        case INT64_BYTES:
+            return __atomic_load_n(&scan_kernels[3], __ATOMIC_RELAXED)(elements, n, val);
+        default:
+            panic("unknown encoding: %d\n", encoding);
+    }
+}
+
+//#define SIMD_SCAN_TEST
+#ifdef SIMD_SCAN_TEST
+
+#include <assert.h>
+
+int main() {
+    char elements[8 * 300];
+    uint8_t encodings[] = {INT8_BYTES, INT16_BYTES, INT32_BYTES, INT64_BYTES};
+
+    for (int level = SCAN_SCALAR; level <= SCAN_AVX512; level++) {
+        if (scan_useLevel(level) != level) break;
+
+        for (int e = 0; e < 4; e++) {
+            uint8_t enc = encodings[e];
+            for (int n = 0; n <= 300; n += 13) {
+                for (int i = 0; i < n; i++) {
+                    int_setValueByType(elements + i * enc, i % 100 - 50, enc);
+                }
+                for (int x = -60; x < 60; x += 7) {
+                    int64_t expect = -1;
+                    for (int i = 0; i < n; i++) {
+                        if (i % 100 - 50 == x) {
+                            expect = i;
+                            break;
+                        }
+                    }
+                    assert(scan_indexOf(elements, n, enc, x) == expect);
+                }
+                //must not match a truncated wide value
+                assert(scan_indexOf(elements, n, enc, ((int64_t) 1 << 40) + 1) == -1);
+            }
+        }
+    }
+    return 0;
+}
+#endif
@@ -0,0 +1,33 @@
+#ifndef SIMD_SCAN_H
+#define SIMD_SCAN_H
+
+#include <stdint.h>
+
+/**
+ * Vectorized equality scan over a raw array of 1, 2, 4 or 8 byte
+ * integers. The widest instruction set the CPU supports is picked
+ * on first use, falling back to a scalar loop.
+ */
+
+#define SCAN_SCALAR 0
+#define SCAN_SSE2 1
+#define SCAN_AVX2 2
+#define SCAN_AVX512 3
+
+/**
+ * Index of the first element equal to val, -1 if there is none.
+ */
+int64_t scan_indexOf(const char *elements, int64_t n, uint8_t encoding, int64_t val);
+
+/**
+ * Instruction set currently used.
+ */
+int scan_level();
+
+/**
+ * Use at most level, capped by what the CPU supports.
+ * Return the level actually used.
+ */
+int scan_useLevel(int level);
+
+#endif //SIMD_SCAN_H
@@ -0,0 +1,243 @@
+#include <string.h>
+#include "stats.h"
+
+static const char *stats_counterNames[STATS_COUNTERS] = {
+        "iv_reallocs",
+        "iv_realloc_bytes",
+        "iv_upgrades",
+        "iv_shifted",
+        "iv_shifted_bytes",
+        "cl_reallocs",
+        "cl_realloc_bytes",
+        "cl_moved_bytes",
+        "cl_walked",
+        "cl_compressed",
+        "cl_compress_in_bytes",
+        "cl_compress_out_bytes",
+        "cl_compress_skipped",
+        "cl_decompressed",
+        "cl_decompress_bytes",
+        "ql_cache_hits",
+};
+
+static const char *stats_callNames[STATS_CALLS] = {
+        "IntVectorSetValueAt",
+        "IntVectorInsert",
+        "IntVectorRemoveAt",
+        "IntSetPut",
+        "IntSetRemove",
+        "IntSetContains",
+        "CompactListInsert",
+        "CompactListInsertMany",
+        "CompactListRemove",
+        "CompactListRemoveAt",
+        "CompactListFind",
+        "CompactListCompress",
+        "CompactListDecompress",
+};
+
+const char *StatsCounterName(int counter) {
+    return counter >= 0 && counter < STATS_COUNTERS ? stats_counterNames[counter] : NULL;
+}
+
+const char *StatsCallName(int call) {
+    return call >= 0 && call < STATS_CALLS ? stats_callNames[call] : NULL;
+}
+
+#ifdef DS_STATS
+
+#include <pthread.h>
+#include <time.h>
+
+__thread StatsThread stats_thread;
+int stats_latencyOn;
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t stats_once = PTHREAD_ONCE_INIT;
+static pthread_key_t stats_key;
+static StatsThread *stats_threads; //live threads
+static StatsSnapshot stats_retired; //sum of the threads that exited
+static StatsSnapshot stats_base; //totals at the last reset
+
+static void stats_addBlock(StatsSnapshot *to, const StatsThread *block) {
+    for (int i = 0; i < STATS_COUNTERS; i++) {
+        to->counters[i] += __atomic_load_n(&block->counters[i], __ATOMIC_RELAXED);
+    }
+    for (int c = 0; c < STATS_CALLS; c++) {
+        for (int b = 0; b < STATS_LATENCY_BUCKETS; b++) {
+            to->latency[c][b] += __atomic_load_n(&block->latency[c][b], __ATOMIC_RELAXED);
+        }
+    }
+}
+
+//fold an exiting thread into the retired totals
+static void stats_unregister(void *arg) {
+    StatsThread *block = arg;
+    pthread_mutex_lock(&stats_lock);
+    stats_addBlock(&stats_retired, block);
+    if (block->prev) block->prev->next = block->next;
+    else stats_threads = block->next;
+    if (block->next) block->next->prev = block->prev;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+static void stats_init() {
+    pthread_key_create(&stats_key, stats_unregister);
+}
+
+void stats_register() {
+    pthread_once(&stats_once, stats_init);
+    StatsThread *block = &stats_thread;
+    pthread_mutex_lock(&stats_lock);
+    block->prev = NULL;
+    block->next = stats_threads;
+    if (stats_threads) stats_threads->prev = block;
+    stats_threads = block;
+    block->registered = 1;
+    pthread_mutex_unlock(&stats_lock);
+    pthread_setspecific(stats_key, block);
+}
+
+uint64_t stats_nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+void stats_recordLatency(int call, uint64_t ns) {
+    if (__builtin_expect(!stats_thread.registered, 0)) stats_register();
+    int bucket = ns ? 63 - __builtin_clzll(ns) : 0;
+    if (bucket >= STATS_LATENCY_BUCKETS) bucket = STATS_LATENCY_BUCKETS - 1;
+    uint64_t *c = &stats_thread.latency[call][bucket];
+    __atomic_store_n(c, __atomic_load_n(c, __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED);
+}
+
+//totals since the start, caller holds the lock
+static void stats_total(StatsSnapshot *snapshot) {
+    memcpy(snapshot, &stats_retired, sizeof(*snapshot));
+    for (StatsThread *block = stats_threads; block; block = block->next) {
+        stats_addBlock(snapshot, block);
+    }
+}
+
+int StatsEnabled() {
+    return 1;
+}
+
+void StatsGet(StatsSnapshot *snapshot) {
+    pthread_mutex_lock(&stats_lock);
+    stats_total(snapshot);
+    for (int i = 0; i < STATS_COUNTERS; i++) {
+        snapshot->counters[i] -= stats_base.counters[i];
+    }
+    for (int c = 0; c < STATS_CALLS; c++) {
+        for (int b = 0; b < STATS_LATENCY_BUCKETS; b++) {
+            snapshot->latency[c][b] -= stats_base.latency[c][b];
+        }
+    }
+    pthread_mutex_unlock(&stats_lock);
+}
+
+//blocks belong to their threads, so a reset moves the baseline instead
+void StatsReset() {
+    pthread_mutex_lock(&stats_lock);
+    stats_total(&stats_base);
+    pthread_mutex_unlock(&stats_lock);
+}
+
+void StatsLatencyEnable(int enable) {
+    __atomic_store_n(&stats_latencyOn, enable != 0, __ATOMIC_RELAXED);
+}
+
+#else
+
+int StatsEnabled() {
+    return 0;
+}
+
+void StatsGet(StatsSnapshot *snapshot) {
+    memset(snapshot, 0, sizeof(*snapshot));
+}
+
+void StatsReset() {
+}
+
+void StatsLatencyEnable(int enable) {
+    (void) enable;
+}
+
+#endif
+
+//#define STATS_TEST
+#ifdef STATS_TEST
+
+#include <assert.h>
+
+#ifdef DS_STATS
+
+static void *stats_work(void *arg) {
+    (void) arg;
+    for (int i = 0; i < 1000; i++) {
+        STATS_ADD(STATS_CL_WALKED, 2);
+    }
+    return NULL;
+}
+
+#endif
+
+int main() {
+    StatsSnapshot snapshot;
+    assert(strcmp(StatsCounterName(STATS_CL_WALKED), "cl_walked") == 0);
+    assert(strcmp(StatsCallName(STATS_CALL_CL_FIND), "CompactListFind") == 0);
+    assert(StatsCounterName(STATS_COUNTERS) == NULL);
+#ifdef DS_STATS
+    assert(StatsEnabled());
+    StatsReset();
+    STATS_ADD(STATS_IV_REALLOCS, 3);
+    StatsGet(&snapshot);
+    assert(snapshot.counters[STATS_IV_REALLOCS] == 3);
+
+    //exited threads still count
+    pthread_t threads[4];
+    for (int t = 0; t < 4; t++) {
+        pthread_create(&threads[t], NULL, stats_work, NULL);
+    }
+    for (int t = 0; t < 4; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    StatsGet(&snapshot);
+    assert(snapshot.counters[STATS_CL_WALKED] == 8000);
+
+    StatsReset();
+    StatsGet(&snapshot);
+    assert(snapshot.counters[STATS_IV_REALLOCS] == 0 && snapshot.counters[STATS_CL_WALKED] == 0);
+
+    //latency is only taken while enabled
+    {
+        STATS_LATENCY(STATS_CALL_IV_SET);
+    }
+    StatsLatencyEnable(1);
+    for (int i = 0; i < 10; i++) {
+        STATS_LATENCY(STATS_CALL_IV_INSERT);
+    }
+    stats_recordLatency(STATS_CALL_CL_FIND, 1000);
+    stats_recordLatency(STATS_CALL_CL_FIND, (uint64_t) 1 << 40);
+    StatsLatencyEnable(0);
+    StatsGet(&snapshot);
+    uint64_t set = 0, insert = 0;
+    for (int b = 0; b < STATS_LATENCY_BUCKETS; b++) {
+        set += snapshot.latency[STATS_CALL_IV_SET][b];
+        insert += snapshot.latency[STATS_CALL_IV_INSERT][b];
+    }
+    assert(set == 0 && insert == 10);
+    assert(snapshot.latency[STATS_CALL_CL_FIND][9] == 1);
+    assert(snapshot.latency[STATS_CALL_CL_FIND][STATS_LATENCY_BUCKETS - 1] == 1);
+#else
+    assert(!StatsEnabled());
+    STATS_ADD(STATS_IV_REALLOCS, 3);
+    StatsGet(&snapshot);
+    assert(snapshot.counters[STATS_IV_REALLOCS] == 0);
+#endif
+    return 0;
+}
+#endif
@@ -0,0 +1,135 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+
+/**
+ * Counters of the work done inside the structures, built only
+ * when compiled with DS_STATS. Without it the hooks expand to
+ * nothing and a snapshot is all zeros.
+ *
+ * Every thread counts into its own block, a snapshot sums the
+ * blocks of live threads and of the ones that exited.
+ *
+ * Latency of the public calls is recorded into log2 histograms
+ * once turned on by StatsLatencyEnable, so the clock is only read
+ * when someone is looking.
+ */
+
+enum {
+    STATS_IV_REALLOCS, //IntVector reallocs
+    STATS_IV_REALLOC_BYTES, //bytes a realloc may have to copy, the smaller of both sizes
+    STATS_IV_UPGRADES, //encoding upgrades
+    STATS_IV_SHIFTED, //elements moved by inserts and removes
+    STATS_IV_SHIFTED_BYTES,
+    STATS_CL_REALLOCS, //CompactList reallocs on insert and remove
+    STATS_CL_REALLOC_BYTES,
+    STATS_CL_MOVED_BYTES, //entry bytes moved by inserts and removes
+    STATS_CL_WALKED, //entries stepped over walking the list
+    STATS_CL_COMPRESSED, //lists compressed
+    STATS_CL_COMPRESS_IN_BYTES, //list bytes given to compress, kept ones only
+    STATS_CL_COMPRESS_OUT_BYTES, //their compressed bytes
+    STATS_CL_COMPRESS_SKIPPED, //lists that didn't shrink enough to keep compressed
+    STATS_CL_DECOMPRESSED, //lists expanded again
+    STATS_CL_DECOMPRESS_BYTES,
+    STATS_QL_CACHE_HITS, //reads of a compressed node served by its expanded copy
+    STATS_COUNTERS
+};
+
+enum {
+    STATS_CALL_IV_SET, //IntVectorSetValueAt, appends included
+    STATS_CALL_IV_INSERT,
+    STATS_CALL_IV_REMOVE_AT,
+    STATS_CALL_INTSET_PUT,
+    STATS_CALL_INTSET_REMOVE,
+    STATS_CALL_INTSET_CONTAINS,
+    STATS_CALL_CL_INSERT,
+    STATS_CALL_CL_INSERT_MANY,
+    STATS_CALL_CL_REMOVE,
+    STATS_CALL_CL_REMOVE_AT,
+    STATS_CALL_CL_FIND,
+    STATS_CALL_CL_COMPRESS,
+    STATS_CALL_CL_DECOMPRESS,
+    STATS_CALLS
+};
+
+//bucket i counts calls of 2^i to 2^(i+1) - 1 ns, the last one all slower
+#define STATS_LATENCY_BUCKETS 32
+
+typedef struct {
+    uint64_t counters[STATS_COUNTERS];
+    uint64_t latency[STATS_CALLS][STATS_LATENCY_BUCKETS];
+} StatsSnapshot;
+
+/**
+ * Return 1 if counters are compiled in.
+ */
+int StatsEnabled();
+
+/**
+ * Totals since the start or the last StatsReset.
+ */
+void StatsGet(StatsSnapshot *snapshot);
+void StatsReset();
+void StatsLatencyEnable(int enable);
+
+const char *StatsCounterName(int counter);
+const char *StatsCallName(int call);
+
+#ifdef DS_STATS
+
+typedef struct StatsThread {
+    uint64_t counters[STATS_COUNTERS];
+    uint64_t latency[STATS_CALLS][STATS_LATENCY_BUCKETS];
+    int registered;
+    struct StatsThread *prev;
+    struct StatsThread *next;
+} StatsThread;
+
+extern __thread StatsThread stats_thread;
+extern int stats_latencyOn;
+
+void stats_register();
+uint64_t stats_nowNs();
+void stats_recordLatency(int call, uint64_t ns);
+
+//only the owning thread writes, readers may load concurrently
+static inline void stats_add(int counter, uint64_t n) {
+    if (__builtin_expect(!stats_thread.registered, 0)) stats_register();
+    uint64_t *c = &stats_thread.counters[counter];
+    __atomic_store_n(c, __atomic_load_n(c, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+typedef struct {
+    int call;
+    uint64_t start;
+} stats_timer;
+
+static inline stats_timer stats_latencyBegin(int call) {
+    stats_timer timer = {call, 0};
+    if (__atomic_load_n(&stats_latencyOn, __ATOMIC_RELAXED)) {
+        timer.start = stats_nowNs();
+    }
+    return timer;
+}
+
+static inline void stats_latencyEnd(stats_timer *timer) {
+    if (timer->start) {
+        stats_recordLatency(timer->call, stats_nowNs() - timer->start);
+    }
+}
+
+#define STATS_ADD(counter, n) stats_add(counter, (uint64_t) (n))
+
+//time the rest of the enclosing block, every return included
+#define STATS_LATENCY(call) \
+    stats_timer stats_timerOfCall __attribute__((cleanup(stats_latencyEnd))) = stats_latencyBegin(call)
+
+#else
+
+#define STATS_ADD(counter, n) ((void) 0)
+#define STATS_LATENCY(call) ((void) 0)
+
+#endif
+
+#endif //STATS_H